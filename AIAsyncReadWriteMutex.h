@@ -0,0 +1,318 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIAsyncReadWriteMutex.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/macros.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <cstdint>
+
+// A read/write mutex with an explicit queue of waiters, so that a lock can be handed over to
+// something else than a blocked thread: a suspended coroutine (see threadsafe::async_wat).
+//
+// This class has the same interface as AIReadWriteMutex and AIReadWriteSpinLock and can be
+// used with threadsafe::policy::ReadWrite unmodified; in addition it provides async_lock.
+//
+// Uncontended locking and unlocking is a single RMW on m_state. Once somebody has to wait,
+// the `waiters` bit is set, which makes everyone take the slow path that uses m_queue_mutex,
+// until the queue is empty again. Waiters are served in FIFO order, where consecutive readers
+// at the front of the queue are admitted together. A thread that converts its read lock into
+// a write lock (rd2wrlock) is preferred over the queue.
+//
+// The thread that releases the lock wakes up the waiters that it handed the lock to, after
+// releasing m_queue_mutex. For a coroutine that means that it is resumed by that thread, unless
+// an executor was passed to async_wat / async_rat.
+class AIAsyncReadWriteMutex
+{
+ public:
+  // A thread or coroutine that waits for the lock.
+  struct Waiter
+  {
+    Waiter* m_next;                     // The next waiter in the queue.
+    bool const m_writer;                // True if this waiter wants the write lock.
+
+    Waiter(bool writer) : m_next(nullptr), m_writer(writer) { }
+    Waiter(Waiter const&) = delete;
+
+    // Called when the lock was handed over to this waiter (without holding any lock).
+    virtual void wake() = 0;
+
+   protected:
+    ~Waiter() = default;
+  };
+
+ private:
+  // A thread that is blocked in rdlock, wrlock or rd2wrlock.
+  struct ThreadWaiter final : Waiter
+  {
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_woken;
+
+    ThreadWaiter(bool writer) : Waiter(writer), m_woken(false) { }
+
+    void wake() override
+    {
+      // Notify while holding m_mutex, because this object is destroyed as soon as wait() returns.
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_woken = true;
+      m_condition.notify_one();
+    }
+
+    void wait()
+    {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_condition.wait(lk, [this]{ return m_woken; });
+    }
+  };
+
+  // The bits of m_state.
+  static constexpr uint32_t writer = 0x80000000;        // Set while a writer has the lock.
+  static constexpr uint32_t waiters = 0x40000000;       // Set while m_head or m_converter is non-null.
+  static constexpr uint32_t readers_mask = 0x3fffffff;  // The number of readers that have the lock.
+
+  std::atomic<uint32_t> m_state;
+  std::mutex m_queue_mutex;
+  Waiter* m_head;                       // The queue of waiters, protected by m_queue_mutex.
+  Waiter* m_tail;
+  Waiter* m_converter;                  // A thread that waits in rd2wrlock, protected by m_queue_mutex.
+
+  bool try_lock(bool as_writer)
+  {
+    return as_writer ? try_wrlock() : try_rdlock();
+  }
+
+  // Hand the lock over to the converter or the waiters at the front of the queue, as far as the current state allows.
+  // Returns the list of waiters that now have the lock and need to be woken up. Must be called with m_queue_mutex locked.
+  Waiter* dispatch()
+  {
+    Waiter* woken = nullptr;
+    Waiter** woken_tail = &woken;
+    // Concurrent unlocks that didn't see the waiters bit can still change m_state.
+    uint32_t state = m_state.load(std::memory_order::relaxed);
+    if (m_converter)
+    {
+      // Only the converter has a read lock when the number of readers is one.
+      do
+      {
+        if ((state & readers_mask) != 1)
+          return nullptr;
+      }
+      while (!m_state.compare_exchange_weak(state, (state - 1) | writer, std::memory_order::acquire, std::memory_order::relaxed));
+      woken = m_converter;
+      woken->m_next = nullptr;
+      m_converter = nullptr;
+      woken_tail = &woken->m_next;
+    }
+    else
+    {
+      while (m_head)
+      {
+        Waiter* front = m_head;
+        if (front->m_writer)
+        {
+          if ((state & (writer | readers_mask)))
+            break;
+          if (!m_state.compare_exchange_weak(state, state | writer, std::memory_order::acquire, std::memory_order::relaxed))
+            continue;
+        }
+        else
+        {
+          if ((state & writer))
+            break;
+          if (!m_state.compare_exchange_weak(state, state + 1, std::memory_order::acquire, std::memory_order::relaxed))
+            continue;
+        }
+        m_head = front->m_next;
+        front->m_next = nullptr;
+        *woken_tail = front;
+        woken_tail = &front->m_next;
+        if (front->m_writer)
+          break;
+        state += 1;
+      }
+    }
+    if (!m_head && !m_converter)
+      m_state.fetch_and(~waiters, std::memory_order::relaxed);
+    return woken;
+  }
+
+  // Wake up the waiters returned by dispatch, except `self`. Returns true if self was one of them.
+  static bool wake(Waiter* woken, Waiter const* self = nullptr)
+  {
+    bool self_woken = false;
+    while (woken)
+    {
+      // Read m_next before calling wake(), which might destroy the waiter.
+      Waiter* next = woken->m_next;
+      if (woken == self)
+        self_woken = true;
+      else
+        woken->wake();
+      woken = next;
+    }
+    return self_woken;
+  }
+
+  // Called after releasing (part of) the lock while the waiters bit was set.
+  void unlock_slow()
+  {
+    Waiter* woken;
+    {
+      std::lock_guard<std::mutex> lk(m_queue_mutex);
+      woken = dispatch();
+    }
+    wake(woken);
+  }
+
+ public:
+  AIAsyncReadWriteMutex() : m_state(0), m_head(nullptr), m_tail(nullptr), m_converter(nullptr) { }
+
+  bool try_rdlock()
+  {
+    uint32_t state = m_state.load(std::memory_order::relaxed);
+    while (!(state & (writer | waiters)))
+      if (m_state.compare_exchange_weak(state, state + 1, std::memory_order::acquire, std::memory_order::relaxed))
+        return true;
+    return false;
+  }
+
+  bool try_wrlock()
+  {
+    uint32_t state = 0;
+    return m_state.compare_exchange_strong(state, writer, std::memory_order::acquire, std::memory_order::relaxed);
+  }
+
+  // Obtain the lock for waiter, or queue it.
+  // Returns false if the lock was obtained immediately; otherwise returns true and
+  // waiter.wake() will be called (possibly before this function returns) as soon as
+  // the lock was handed over to the waiter.
+  bool async_lock(Waiter& waiter)
+  {
+    Waiter* woken;
+    {
+      std::lock_guard<std::mutex> lk(m_queue_mutex);
+      if (!m_head && !m_converter && try_lock(waiter.m_writer))
+        return false;
+      waiter.m_next = nullptr;
+      if (m_head)
+        m_tail->m_next = &waiter;
+      else
+        m_head = &waiter;
+      m_tail = &waiter;
+      // From here on, all unlocks take the slow path. Try again, in case the lock was released before this point.
+      m_state.fetch_or(waiters, std::memory_order::relaxed);
+      woken = dispatch();
+    }
+    return !wake(woken, &waiter);
+  }
+
+  void rdlock()
+  {
+    if (AI_LIKELY(try_rdlock()))
+      return;
+    ThreadWaiter waiter(false);
+    if (async_lock(waiter))
+      waiter.wait();
+  }
+
+  void rdunlock()
+  {
+    if (AI_UNLIKELY(m_state.fetch_sub(1, std::memory_order::release) & waiters))
+      unlock_slow();
+  }
+
+  void wrlock()
+  {
+    if (AI_LIKELY(try_wrlock()))
+      return;
+    ThreadWaiter waiter(true);
+    if (async_lock(waiter))
+      waiter.wait();
+  }
+
+  void wrunlock()
+  {
+    uint32_t state = writer;
+    if (AI_LIKELY(m_state.compare_exchange_strong(state, 0, std::memory_order::release, std::memory_order::relaxed)))
+      return;
+    m_state.fetch_and(~writer, std::memory_order::release);
+    unlock_slow();
+  }
+
+  void rd2wrlock()
+  {
+    uint32_t state = 1;
+    if (AI_LIKELY(m_state.compare_exchange_strong(state, writer, std::memory_order::acquire, std::memory_order::relaxed)))
+      return;
+    ThreadWaiter waiter(true);
+    Waiter* woken;
+    {
+      std::lock_guard<std::mutex> lk(m_queue_mutex);
+      if (m_converter)
+      {
+        // It is impossible to recover from this: two threads have a read lock
+        // and require to turn that into a write lock. The only way out of this
+        // is to throw an exception and let the caller solve the mess.
+        // Call rdunlock() and then rd2wryield() before trying again.
+        throw std::exception();
+      }
+      m_converter = &waiter;
+      m_state.fetch_or(waiters, std::memory_order::relaxed);
+      woken = dispatch();
+    }
+    if (!wake(woken, &waiter))
+      waiter.wait();
+  }
+
+  void wr2rdlock()
+  {
+    uint32_t state = writer;
+    if (AI_LIKELY(m_state.compare_exchange_strong(state, 1, std::memory_order::release, std::memory_order::relaxed)))
+      return;
+    // Let the readers at the front of the queue in too.
+    m_state.fetch_add(1 - writer, std::memory_order::release);
+    unlock_slow();
+  }
+
+  // Called after rd2wrlock threw and the read lock was released.
+  // Wait until the converter that caused the exception is done.
+  void rd2wryield()
+  {
+    for (;;)
+    {
+      std::this_thread::yield();
+      std::lock_guard<std::mutex> lk(m_queue_mutex);
+      if (!m_converter)
+        break;
+    }
+  }
+};
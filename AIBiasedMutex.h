@@ -0,0 +1,222 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIBiasedMutex.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// A mutex that is biased towards one thread, the owner.
+//
+// Use this for objects that are nearly always accessed by the same thread, but
+// sometimes by another one (for example to collect statistics, or upon shutdown),
+// so that policy::OneThread can't be used. For example,
+//
+//   using connection_t = threadsafe::Unlocked<Connection, threadsafe::policy::Primitive<AIBiasedMutex>>;
+//
+// The first thread that locks the mutex becomes its owner. The owner locks and unlocks
+// the mutex without any read-modify-write operation or memory fence: it raises a flag
+// and then checks that no other thread revoked the bias. Any other thread serializes
+// on a std::mutex, revokes the bias and waits until the owner lowered its flag. Because
+// the owner doesn't use a fence between raising its flag and reading the revoke flag,
+// the other thread has to force one upon the owner: on linux that is done with the
+// membarrier system call, which interrupts all running threads of the process. This
+// makes every lock by a foreign thread expensive (in the order of microseconds), which
+// is the price for the cheap locking by the owner. When membarrier is not available
+// the owner uses a normal fence.
+//
+// While the bias is revoked, the owner waits on the std::mutex too.
+class AIBiasedMutex
+{
+ private:
+  std::atomic<std::thread::id> m_owner;         // The owner thread, or id{} if nobody locked the mutex yet.
+  std::atomic<bool> m_owner_locked;             // Set while the owner has (or is about to get) the lock through the fast path.
+  bool m_owner_slow;                            // Set while the owner has the lock through m_mutex (only accessed by the owner).
+  std::atomic<bool> m_revoked;                  // Set while a foreign thread has (or is about to get) the lock.
+  std::atomic<std::thread::id> m_foreign_id;    // The foreign thread that has the lock, used by is_self_locked.
+  std::mutex m_mutex;                           // Serializes the foreign threads, and the owner while the bias is revoked.
+
+  static constexpr int max_spin_count = 128;
+
+  // Returns true if membarrier can be used.
+  static bool use_membarrier()
+  {
+#ifdef __linux__
+    static bool const s_use_membarrier = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+    return s_use_membarrier;
+#else
+    return false;
+#endif
+  }
+
+  // Order the store to m_owner_locked before the load of m_revoked, in the owner thread.
+  static void owner_fence()
+  {
+    if (AI_LIKELY(use_membarrier()))
+      std::atomic_signal_fence(std::memory_order::seq_cst);     // Only stop the compiler from reordering.
+    else
+      std::atomic_thread_fence(std::memory_order::seq_cst);
+  }
+
+  // Order the store to m_revoked before the load of m_owner_locked, in a foreign thread, and in the owner thread(!).
+  static void foreign_fence()
+  {
+#ifdef __linux__
+    if (AI_LIKELY(use_membarrier()))
+    {
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+      return;
+    }
+#endif
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+  }
+
+  // Returns true if the calling thread is the owner, making it the owner if the mutex has no owner yet.
+  bool is_owner(std::thread::id self)
+  {
+    std::thread::id owner = m_owner.load(std::memory_order::relaxed);
+    if (AI_LIKELY(owner == self))
+      return true;
+    if (owner != std::thread::id{})
+      return false;
+    // Only happens once.
+    return m_owner.compare_exchange_strong(owner, self, std::memory_order::relaxed) || owner == self;
+  }
+
+  // Try to get the lock through the fast path. Only called by the owner.
+  bool owner_try_lock()
+  {
+    m_owner_locked.store(true, std::memory_order::relaxed);
+    owner_fence();
+    if (AI_LIKELY(!m_revoked.load(std::memory_order::acquire)))
+      return true;
+    // A foreign thread has (or is about to get) the lock.
+    m_owner_locked.store(false, std::memory_order::relaxed);
+    return false;
+  }
+
+  // Revoke the bias. Called by a foreign thread that holds m_mutex.
+  // Returns false if the owner has the lock, and wait is false.
+  bool revoke(bool wait)
+  {
+    m_revoked.store(true, std::memory_order::relaxed);
+    foreign_fence();
+    int spin_count = 0;
+    while (m_owner_locked.load(std::memory_order::acquire))
+    {
+      if (!wait)
+      {
+        m_revoked.store(false, std::memory_order::relaxed);
+        return false;
+      }
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else
+        std::this_thread::yield();    // The owner might have been descheduled.
+    }
+    m_foreign_id.store(std::this_thread::get_id(), std::memory_order::relaxed);
+    return true;
+  }
+
+ public:
+  AIBiasedMutex() : m_owner(std::thread::id{}), m_owner_locked(false), m_owner_slow(false), m_revoked(false), m_foreign_id(std::thread::id{}) { }
+
+  void lock()
+  {
+    // AIBiasedMutex is not recursive.
+    ASSERT(!is_self_locked());
+    std::thread::id self = std::this_thread::get_id();
+    if (AI_LIKELY(is_owner(self)))
+    {
+      if (AI_LIKELY(owner_try_lock()))
+        return;
+      m_mutex.lock();
+      m_owner_slow = true;
+      return;
+    }
+    m_mutex.lock();
+    revoke(true);
+  }
+
+  bool try_lock()
+  {
+    // AIBiasedMutex is not recursive.
+    ASSERT(!is_self_locked());
+    std::thread::id self = std::this_thread::get_id();
+    if (AI_LIKELY(is_owner(self)))
+    {
+      if (AI_LIKELY(owner_try_lock()))
+        return true;
+      if (!m_mutex.try_lock())
+        return false;
+      m_owner_slow = true;
+      return true;
+    }
+    if (!m_mutex.try_lock())
+      return false;
+    if (revoke(false))
+      return true;
+    m_mutex.unlock();
+    return false;
+  }
+
+  void unlock()
+  {
+    if (m_owner.load(std::memory_order::relaxed) == std::this_thread::get_id())
+    {
+      if (AI_LIKELY(!m_owner_slow))
+      {
+        m_owner_locked.store(false, std::memory_order::release);
+        return;
+      }
+      m_owner_slow = false;
+    }
+    else
+    {
+      m_foreign_id.store(std::thread::id(), std::memory_order::relaxed);
+      m_revoked.store(false, std::memory_order::release);
+    }
+    m_mutex.unlock();
+  }
+
+  bool is_self_locked() const
+  {
+    std::thread::id self = std::this_thread::get_id();
+    if (m_owner.load(std::memory_order::relaxed) == self)
+      return m_owner_slow || m_owner_locked.load(std::memory_order::relaxed);
+    return m_foreign_id.load(std::memory_order::relaxed) == self;
+  }
+};
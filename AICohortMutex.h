@@ -0,0 +1,241 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AICohortMutex.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <atomic>
+#include <array>
+#include <thread>
+#include <cstdint>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+// A NUMA-aware (cohort) mutex.
+//
+// On a machine with more than one NUMA node, handing a lock over to a thread on another
+// node means that the cache lines of the lock and of the data that it protects have to
+// travel between the sockets. AICohortMutex therefore prefers to hand the lock over to
+// a thread on the same node.
+//
+// Every node has its own (local) ticket lock, and there is one global ticket lock.
+// A thread first obtains the local lock of its node and then, unless it got that from
+// a thread that still had the global lock, the global lock. Upon unlock, if another
+// thread of the same node is waiting, the global lock is passed on together with the
+// local lock; but no more than max_batch times in a row, after which the global lock
+// is released so that the other nodes get their turn. This is the C-TKT-TKT lock of
+// D. Dice, V. Marathe and N. Shavit ("Lock Cohorting: A General Technique for Designing
+// NUMA Locks", 2012).
+//
+// The NUMA node of a thread is determined once, the first time that the thread uses a
+// cohort lock (on linux with getcpu; elsewhere all threads are considered to be on node 0).
+//
+// Waiting threads spin for a while and then go to sleep on a futex (like ConditionVariable),
+// keeping track of the number of sleepers so that an unlock only makes a system call when
+// somebody is sleeping. Like AIMCSMutex the lock is handed over in FIFO order (per node),
+// so it should not be used when there are more runnable threads than cores.
+//
+// This class has the same interface as AIMutex and can be used with threadsafe::policy::Primitive
+// unmodified, for example:
+//
+//   using queue_t = threadsafe::Unlocked<Queue, threadsafe::policy::Primitive<AICohortMutex>>;
+//
+// See AICohortReadWriteLock for the read/write variant.
+class AICohortMutex
+{
+ public:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr unsigned int max_nodes = 8;          // Nodes beyond this share a local lock.
+  static constexpr uint32_t max_batch = 64;             // The maximum number of consecutive hand overs within a node.
+
+  // Return the NUMA node of the current thread (modulo max_nodes).
+  static unsigned int current_node()
+  {
+#ifdef __linux__
+    static thread_local unsigned int const s_node = []{
+      unsigned int cpu, node;
+      return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? node % max_nodes : 0;
+    }();
+    return s_node;
+#else
+    return 0;
+#endif
+  }
+
+  // Sleep until word no longer has the value `value` (or spuriously). sleepers counts the threads that sleep on word.
+  static void sleep_on(std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& sleepers)
+  {
+    sleepers.fetch_add(1, std::memory_order::seq_cst);
+    if (word.load(std::memory_order::seq_cst) == value)
+    {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#else
+      word.wait(value, std::memory_order::relaxed);
+#endif
+    }
+    sleepers.fetch_sub(1, std::memory_order::relaxed);
+  }
+
+  // Wake up the threads that sleep on word. Must be called after changing word (with memory_order::seq_cst).
+  static void wake_all(std::atomic<uint32_t>& word, std::atomic<uint32_t> const& sleepers)
+  {
+    if (sleepers.load(std::memory_order::seq_cst) == 0)
+      return;
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    word.notify_all();
+#endif
+  }
+
+ private:
+  static constexpr int max_spin_count = 128;
+
+  struct alignas(cache_line_size) Cohort
+  {
+    std::atomic<uint32_t> m_next;       // The next ticket of the local lock.
+    std::atomic<uint32_t> m_serving;    // The ticket of the local lock that is being served.
+    std::atomic<uint32_t> m_sleepers;   // The number of threads that sleep on m_serving.
+    // Only accessed by the thread that has the local lock.
+    bool m_owns_global;                 // Set when the global lock was passed on together with the local lock.
+    uint32_t m_batch;                   // The number of consecutive local hand overs.
+
+    Cohort() : m_next(0), m_serving(0), m_sleepers(0), m_owns_global(false), m_batch(0) { }
+  };
+
+  std::array<Cohort, max_nodes> m_cohorts;
+  alignas(cache_line_size) std::atomic<uint32_t> m_global_next;
+  std::atomic<uint32_t> m_global_serving;
+  std::atomic<uint32_t> m_global_sleepers;
+  unsigned int m_owner_node;                    // The node of the thread that has the lock (only accessed by that thread).
+  std::atomic<std::thread::id> m_id;            // Must be atomic because of the access in is_self_locked().
+
+  // Wait until `atomic` has the value `ticket`; sleep after a while, as the thread that has the lock could be descheduled.
+  static void wait_for_ticket(std::atomic<uint32_t>& serving, std::atomic<uint32_t>& sleepers, uint32_t ticket)
+  {
+    int spin_count = 0;
+    uint32_t value;
+    while ((value = serving.load(std::memory_order::acquire)) != ticket)
+    {
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else
+        sleep_on(serving, value, sleepers);
+    }
+  }
+
+  static void serve_next(std::atomic<uint32_t>& serving, std::atomic<uint32_t> const& sleepers)
+  {
+    serving.fetch_add(1, std::memory_order::seq_cst);
+    wake_all(serving, sleepers);
+  }
+
+  void locked(unsigned int node)
+  {
+    m_owner_node = node;
+    m_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  }
+
+ public:
+  AICohortMutex() : m_global_next(0), m_global_serving(0), m_global_sleepers(0), m_owner_node(0), m_id(std::thread::id{}) { }
+
+  void lock()
+  {
+    // AICohortMutex is not recursive.
+    ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
+    unsigned int node = current_node();
+    Cohort& cohort = m_cohorts[node];
+    wait_for_ticket(cohort.m_serving, cohort.m_sleepers, cohort.m_next.fetch_add(1, std::memory_order::relaxed));
+    if (!cohort.m_owns_global)
+    {
+      wait_for_ticket(m_global_serving, m_global_sleepers, m_global_next.fetch_add(1, std::memory_order::relaxed));
+      cohort.m_owns_global = true;
+    }
+    locked(node);
+  }
+
+  bool try_lock()
+  {
+    // AICohortMutex is not recursive.
+    ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
+    unsigned int node = current_node();
+    Cohort& cohort = m_cohorts[node];
+    // The releasing thread only writes m_serving (and m_global_serving), so those have to be loaded
+    // with acquire to synchronize with the previous unlock(); the CAS on m_next doesn't do that.
+    uint32_t ticket = cohort.m_serving.load(std::memory_order::acquire);
+    if (!cohort.m_next.compare_exchange_strong(ticket, ticket + 1, std::memory_order::acquire, std::memory_order::relaxed))
+      return false;
+    if (!cohort.m_owns_global)
+    {
+      uint32_t global_ticket = m_global_serving.load(std::memory_order::acquire);
+      if (!m_global_next.compare_exchange_strong(global_ticket, global_ticket + 1, std::memory_order::acquire, std::memory_order::relaxed))
+      {
+        serve_next(cohort.m_serving, cohort.m_sleepers);
+        return false;
+      }
+      cohort.m_owns_global = true;
+    }
+    locked(node);
+    return true;
+  }
+
+  // Returns true if unlock() will hand the lock over to a thread of the same node that is already waiting.
+  // Only call this while holding the lock.
+  bool will_pass_locally() const
+  {
+    Cohort const& cohort = m_cohorts[m_owner_node];
+    return cohort.m_batch + 1 < max_batch &&
+      cohort.m_next.load(std::memory_order::relaxed) - cohort.m_serving.load(std::memory_order::relaxed) > 1;
+  }
+
+  void unlock()
+  {
+    Cohort& cohort = m_cohorts[m_owner_node];
+    m_id.store(std::thread::id(), std::memory_order_relaxed);
+    if (will_pass_locally())
+      ++cohort.m_batch;
+    else
+    {
+      cohort.m_batch = 0;
+      cohort.m_owns_global = false;
+      serve_next(m_global_serving, m_global_sleepers);
+    }
+    serve_next(cohort.m_serving, cohort.m_sleepers);
+  }
+
+  bool is_self_locked() const
+  {
+    return m_id.load(std::memory_order_relaxed) == std::this_thread::get_id();
+  }
+};
@@ -0,0 +1,207 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AICohortReadWriteLock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "AICohortMutex.h"
+#include <exception>
+
+// A NUMA-aware read/write lock.
+//
+// Writers are serialized with an AICohortMutex, so that the write lock is preferably
+// handed over between threads of the same NUMA node. Readers are counted per node,
+// every counter on its own cache line, so that readers on different nodes don't have
+// to share a cache line either. A writer that obtained the cohort mutex raises a flag
+// that keeps new readers out and then waits until the reader counts of all nodes
+// dropped to zero. As long as the write lock is handed over within a node, the flag
+// stays raised (this is the C-RW-WP lock of I. Calciu et al., "NUMA-Aware Reader-Writer
+// Locks", 2013). Hence writers are preferred over readers.
+//
+// This class has the same interface as AIReadWriteMutex and AIReadWriteSpinLock and
+// can be used with threadsafe::policy::ReadWrite unmodified, for example:
+//
+//   using queue_t = threadsafe::Unlocked<Queue, threadsafe::policy::ReadWrite<AICohortReadWriteLock>>;
+//
+// A thread that converts its read lock into a write lock (rd2wrlock) only succeeds when
+// the cohort mutex isn't taken by another writer (that writer could be waiting for our
+// read lock); otherwise it throws.
+class AICohortReadWriteLock
+{
+ public:
+  static constexpr size_t cache_line_size = AICohortMutex::cache_line_size;
+  static constexpr unsigned int max_nodes = AICohortMutex::max_nodes;
+
+ private:
+  static constexpr int max_spin_count = 128;
+
+  struct alignas(cache_line_size) ReaderCount
+  {
+    std::atomic<int> m_count;           // The number of readers of this node that have (or are trying to get) the lock.
+    ReaderCount() : m_count(0) { }
+  };
+
+  std::array<ReaderCount, max_nodes> m_readers;
+  AICohortMutex m_writers;
+  alignas(cache_line_size) std::atomic<uint32_t> m_writer;      // Non-zero while a writer has (or is about to get) the lock.
+  std::atomic<uint32_t> m_writer_sleepers;                      // The number of readers that sleep on m_writer.
+
+  std::atomic<int>& reader_count()
+  {
+    return m_readers[AICohortMutex::current_node()].m_count;
+  }
+
+  // Wait until no writer is present anymore.
+  void wait_for_writer()
+  {
+    int spin_count = 0;
+    while (m_writer.load(std::memory_order::acquire))
+    {
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else
+        AICohortMutex::sleep_on(m_writer, 1, m_writer_sleepers);
+    }
+  }
+
+  // Having raised m_writer, wait until all readers left.
+  // Readers don't hold the lock for long, and waking up a sleeping writer would cost every rdunlock a call to notify.
+  void wait_for_readers()
+  {
+    for (ReaderCount const& readers : m_readers)
+    {
+      int spin_count = 0;
+      while (readers.m_count.load(std::memory_order::seq_cst) != 0)
+      {
+        if (++spin_count < max_spin_count)
+          cpu_relax();
+        else
+          std::this_thread::yield();    // A reader might have been descheduled.
+      }
+    }
+  }
+
+  // Release the cohort mutex, and let the readers in unless the write lock is handed over within the node.
+  void release_writers()
+  {
+    if (!m_writers.will_pass_locally())
+    {
+      m_writer.store(0, std::memory_order::seq_cst);
+      AICohortMutex::wake_all(m_writer, m_writer_sleepers);
+    }
+    m_writers.unlock();
+  }
+
+ public:
+  AICohortReadWriteLock() : m_writer(0), m_writer_sleepers(0) { }
+
+  void rdlock()
+  {
+    std::atomic<int>& count = reader_count();
+    for (;;)
+    {
+      count.fetch_add(1, std::memory_order::seq_cst);
+      if (AI_LIKELY(!m_writer.load(std::memory_order::seq_cst)))
+        return;
+      // Back off (the writer is waiting for this count to become zero).
+      count.fetch_sub(1, std::memory_order::relaxed);
+      wait_for_writer();
+    }
+  }
+
+  bool try_rdlock()
+  {
+    std::atomic<int>& count = reader_count();
+    count.fetch_add(1, std::memory_order::seq_cst);
+    if (AI_LIKELY(!m_writer.load(std::memory_order::seq_cst)))
+      return true;
+    count.fetch_sub(1, std::memory_order::relaxed);
+    return false;
+  }
+
+  void rdunlock()
+  {
+    reader_count().fetch_sub(1, std::memory_order::release);
+  }
+
+  void wrlock()
+  {
+    m_writers.lock();
+    m_writer.store(1, std::memory_order::seq_cst);
+    wait_for_readers();
+  }
+
+  bool try_wrlock()
+  {
+    if (!m_writers.try_lock())
+      return false;
+    m_writer.store(1, std::memory_order::seq_cst);
+    for (ReaderCount const& readers : m_readers)
+      if (readers.m_count.load(std::memory_order::seq_cst) != 0)
+      {
+        release_writers();
+        return false;
+      }
+    return true;
+  }
+
+  void wrunlock()
+  {
+    release_writers();
+  }
+
+  void rd2wrlock()
+  {
+    if (!m_writers.try_lock())
+    {
+      // It is impossible to recover from this: another writer has the cohort mutex
+      // and might be waiting for our read lock. The only way out of this is to throw
+      // an exception and let the caller solve the mess. Call rdunlock() and then
+      // rd2wryield() before trying again.
+      throw std::exception();
+    }
+    m_writer.store(1, std::memory_order::seq_cst);
+    // Stop being a reader.
+    reader_count().fetch_sub(1, std::memory_order::relaxed);
+    wait_for_readers();
+  }
+
+  void wr2rdlock()
+  {
+    reader_count().fetch_add(1, std::memory_order::relaxed);
+    release_writers();
+  }
+
+  // Called after rd2wrlock threw and the read lock was released.
+  // Wait until the writers that were waiting at that moment are done.
+  void rd2wryield()
+  {
+    std::this_thread::yield();
+    // This is not just m_writers.lock() / unlock(), because a writer of the same node might be given the lock with m_writer raised.
+    wrlock();
+    wrunlock();
+  }
+};
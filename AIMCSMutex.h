@@ -0,0 +1,212 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIMCSMutex.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+// A queue-based (MCS) mutex with FIFO hand over.
+//
+// With AIMutex (std::mutex) all waiting threads poll and sleep on the same word, and whoever
+// happens to get there first after an unlock gets the lock. Under heavy contention that causes
+// a lot of cache line bouncing and, when the lock is held briefly but often, convoys.
+//
+// AIMCSMutex puts every thread that has to wait in a queue instead (J. Mellor-Crummey and M. Scott,
+// "Algorithms for Scalable Synchronization on Shared-Memory Multiprocessors", 1991).
+// Each waiter spins on a flag in its own queue node, that is on its own cache line, and unlock
+// hands the lock over directly to the next thread in the queue. Hence the lock is granted in
+// FIFO order and an unlock only touches the cache line of the next waiter. After spinning for
+// a while a waiter goes to sleep on its flag (the thread holding the lock might have been
+// descheduled); then only that hand over requires a system call.
+//
+// The price of FIFO hand over is that the lock can't be stolen by a thread that is running:
+// if the next waiter isn't running, everyone has to wait until it is scheduled again. So use
+// this for locks that are contended by many threads on many cores, not when there are (much)
+// more runnable threads than cores; then AIMutex performs better.
+//
+// This class has the same interface as AIMutex and can be used with threadsafe::policy::Primitive
+// and as base class of threadsafe::BasicConditionVariable, for example:
+//
+//   using queue_t = threadsafe::Unlocked<Queue, threadsafe::policy::Primitive<AIMCSMutex>>;
+//
+// The queue nodes come from a per-thread free list, so that a thread can hold any number of
+// AIMCSMutex locks at the same time. A lock must be released by the thread that obtained it.
+class AIMCSMutex
+{
+ private:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int max_spin_count = 128;
+
+  // The values of Node::m_state.
+  static constexpr uint32_t granted = 0;        // The lock was handed over to the owner of the node.
+  static constexpr uint32_t waiting = 1;        // The owner of the node is spinning.
+  static constexpr uint32_t sleeping = 2;       // The owner of the node is (about to go) sleeping on m_state.
+
+  struct alignas(cache_line_size) Node
+  {
+    std::atomic<Node*> m_next;                  // The next waiter in the queue, or the next free node.
+    std::atomic<uint32_t> m_state;
+  };
+
+  // The nodes of the current thread that are not in use.
+  struct FreeList
+  {
+    Node* m_head = nullptr;
+
+    ~FreeList()
+    {
+      while (m_head)
+      {
+        Node* node = m_head;
+        m_head = node->m_next.load(std::memory_order::relaxed);
+        delete node;
+      }
+    }
+  };
+
+  static FreeList& free_list()
+  {
+    static thread_local FreeList s_free_list;
+    return s_free_list;
+  }
+
+  static Node* get_node()
+  {
+    FreeList& fl = free_list();
+    Node* node = fl.m_head;
+    if (AI_UNLIKELY(!node))
+      return new Node;
+    fl.m_head = node->m_next.load(std::memory_order::relaxed);
+    return node;
+  }
+
+  static void release_node(Node* node)
+  {
+    FreeList& fl = free_list();
+    node->m_next.store(fl.m_head, std::memory_order::relaxed);
+    fl.m_head = node;
+  }
+
+  alignas(cache_line_size) std::atomic<Node*> m_tail;   // The last thread in the queue (the owner if nobody is waiting), or nullptr when unlocked.
+  Node* m_owner;                                        // The node of the thread that has the lock (only accessed by that thread).
+  std::atomic<std::thread::id> m_id;                    // Must be atomic because of the access in is_self_locked().
+
+  // Called with a node that is at the end of the queue, behind predecessor.
+  static void wait_in_queue(Node* node, Node* predecessor)
+  {
+    predecessor->m_next.store(node, std::memory_order::release);
+    int spin_count = 0;
+    uint32_t state;
+    while ((state = node->m_state.load(std::memory_order::acquire)) != granted)
+    {
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else if (state == sleeping || node->m_state.compare_exchange_weak(state, sleeping, std::memory_order::relaxed, std::memory_order::relaxed))
+        node->m_state.wait(sleeping, std::memory_order::relaxed);
+    }
+  }
+
+  void locked(Node* node)
+  {
+    m_owner = node;
+    m_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  }
+
+ public:
+  AIMCSMutex() : m_tail(nullptr), m_owner(nullptr), m_id(std::thread::id{}) { }
+
+  void lock()
+  {
+    // AIMCSMutex is not recursive.
+    ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
+    Node* node = get_node();
+    node->m_next.store(nullptr, std::memory_order::relaxed);
+    node->m_state.store(waiting, std::memory_order::relaxed);
+    Node* predecessor = m_tail.exchange(node, std::memory_order::acq_rel);
+    if (AI_UNLIKELY(predecessor))
+      wait_in_queue(node, predecessor);
+    locked(node);
+  }
+
+  bool try_lock()
+  {
+    // AIMCSMutex is not recursive.
+    ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
+    if (m_tail.load(std::memory_order::relaxed))
+      return false;
+    Node* node = get_node();
+    node->m_next.store(nullptr, std::memory_order::relaxed);
+    Node* expected = nullptr;
+    if (!m_tail.compare_exchange_strong(expected, node, std::memory_order::acquire, std::memory_order::relaxed))
+    {
+      release_node(node);
+      return false;
+    }
+    locked(node);
+    return true;
+  }
+
+  void unlock()
+  {
+    Node* node = m_owner;
+    m_id.store(std::thread::id(), std::memory_order_relaxed);
+    Node* next = node->m_next.load(std::memory_order::acquire);
+    if (!next)
+    {
+      // Nobody is waiting, unless somebody is just adding itself to the queue.
+      Node* expected = node;
+      if (m_tail.compare_exchange_strong(expected, nullptr, std::memory_order::release, std::memory_order::relaxed))
+      {
+        release_node(node);
+        return;
+      }
+      // Wait until the new waiter linked itself behind us.
+      int spin_count = 0;
+      while (!(next = node->m_next.load(std::memory_order::acquire)))
+      {
+        if (++spin_count < max_spin_count)
+          cpu_relax();
+        else
+          std::this_thread::yield();    // The new waiter might have been descheduled.
+      }
+    }
+    // Hand over the lock; m_owner is set by the next owner.
+    if (next->m_state.exchange(granted, std::memory_order::release) == sleeping)
+      next->m_state.notify_one();
+    release_node(node);
+  }
+
+  bool is_self_locked() const
+  {
+    return m_id.load(std::memory_order_relaxed) == std::this_thread::get_id();
+  }
+};
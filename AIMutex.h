@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include "SingleThreadedPhase.h"
 #include "debug.h"
 #include <mutex>
 #include <atomic>
@@ -49,7 +50,8 @@ class AIMutex
   {
     // AIMutex is not recursive.
     ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
-    m_mutex.lock();
+    if (AI_LIKELY(!threadsafe::SingleThreadedPhase::elide_lock()))
+      m_mutex.lock();
     m_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
   }
 
@@ -57,7 +59,7 @@ class AIMutex
   {
     // AIMutex is not recursive.
     ASSERT(m_id.load(std::memory_order_relaxed) != std::this_thread::get_id());
-    bool success = m_mutex.try_lock();
+    bool success = threadsafe::SingleThreadedPhase::elide_lock() || m_mutex.try_lock();
     if (success)
       m_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
     return success;
@@ -66,7 +68,8 @@ class AIMutex
   void unlock()
   {
     m_id.store(std::thread::id(), std::memory_order_relaxed);
-    m_mutex.unlock();
+    if (AI_LIKELY(!threadsafe::SingleThreadedPhase::elide_unlock()))
+      m_mutex.unlock();
   }
 
   bool is_self_locked() const
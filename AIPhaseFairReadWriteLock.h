@@ -0,0 +1,195 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIPhaseFairReadWriteLock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <cstdint>
+
+// A phase-fair read/write lock.
+//
+// AIReadWriteMutex and AIReadWriteSpinLock prefer writers: as long as writers keep
+// coming, new readers are kept out, which can starve the readers. This lock alternates
+// between read phases and write phases instead: when a writer releases the lock, all
+// readers that arrived while it was waiting or holding the lock are let in (even when
+// another writer is already waiting), and a writer only has to wait for the readers
+// that were present when it started waiting. Hence a reader waits for at most one
+// writer and a writer waits for at most one read phase plus the writers before it.
+// Writers are served in FIFO order.
+//
+// This is the phase-fair ticket lock (PF-T) that was described by B. Brandenburg and
+// J. Anderson ("Spin-Based Reader-Writer Synchronization for Multiprocessor Real-Time Systems", 2010).
+//
+// This class has the same interface as AIReadWriteMutex and AIReadWriteSpinLock and
+// can be used with threadsafe::policy::ReadWrite unmodified, for example:
+//
+//   using queue_t = threadsafe::Unlocked<Queue, threadsafe::policy::ReadWrite<AIPhaseFairReadWriteLock>>;
+//
+// A thread that converts its read lock into a write lock (rd2wrlock) only succeeds
+// when no writer is waiting (that writer would be waiting for our read lock) and no
+// other reader is converting at the same time; otherwise it throws. Note that, unlike
+// with writer-preferring locks, read locks are never recursive when a writer is waiting.
+class AIPhaseFairReadWriteLock
+{
+ private:
+  // The layout of m_rin and m_rout: the number of readers that entered (respectively left)
+  // in the upper bits, and in m_rin the writer bits: present and the phase id of that writer.
+  static constexpr uint32_t reader_increment = 0x100;
+  static constexpr uint32_t writer_present = 0x2;
+  static constexpr uint32_t phase_id = 0x1;
+  static constexpr uint32_t writer_bits = writer_present | phase_id;
+
+  std::atomic<uint32_t> m_rin;          // Incremented by reader_increment for every reader that enters; also contains the writer bits.
+  std::atomic<uint32_t> m_rout;         // Incremented by reader_increment for every reader that leaves.
+  std::atomic<uint32_t> m_win;          // The next writer ticket.
+  std::atomic<uint32_t> m_wout;         // The ticket of the writer that is served.
+  uint32_t m_bits;                      // The writer bits that were set by the current writer (only accessed while holding the write lock).
+
+  static constexpr int max_spin_count = 128;
+
+  // Wait until pred(value of `atomic`) returns true.
+  // Readers and writers that wait for a writer go to sleep after a while, as the writer could be descheduled;
+  // those wait for a phase change (m_rin) or for their ticket (m_wout).
+  template<typename PRED>
+  static void wait_until(std::atomic<uint32_t> const& atomic, PRED pred)
+  {
+    int spin_count = 0;
+    uint32_t value;
+    while (!pred(value = atomic.load(std::memory_order::acquire)))
+    {
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else
+        atomic.wait(value, std::memory_order::relaxed);
+    }
+  }
+
+  // Wait until pred(value of m_rout) returns true.
+  // This is used by the writer that waits for the readers to leave; readers don't hold the lock
+  // for long, and waking up a sleeping writer would cost every rdunlock a call to notify.
+  template<typename PRED>
+  void wait_for_readers(PRED pred)
+  {
+    int spin_count = 0;
+    while (!pred(m_rout.load(std::memory_order::acquire)))
+    {
+      if (++spin_count < max_spin_count)
+        cpu_relax();
+      else
+        std::this_thread::yield();      // A reader might have been descheduled.
+    }
+  }
+
+  // Start a new read phase and serve the next writer ticket.
+  void end_write_phase(uint32_t rin_increment)
+  {
+    // The read phase starts when the writer bits are reset.
+    m_rin.fetch_add(rin_increment, std::memory_order::release);
+    m_rin.notify_all();
+    m_wout.fetch_add(1, std::memory_order::release);
+    m_wout.notify_all();
+  }
+
+  // Having writer ticket `ticket`, which is being served: wait for the readers of the current phase to leave.
+  void enter_write_phase(uint32_t ticket)
+  {
+    m_bits = writer_present | (ticket & phase_id);
+    // Readers that enter after this wait until the writer bits change.
+    uint32_t rticket = m_rin.fetch_add(m_bits, std::memory_order::seq_cst);
+    // The writer bits were zero, so rticket is the number of readers that entered before us.
+    wait_for_readers([=](uint32_t rout){ return rout == rticket; });
+  }
+
+ public:
+  AIPhaseFairReadWriteLock() : m_rin(0), m_rout(0), m_win(0), m_wout(0), m_bits(0) { }
+
+  void rdlock()
+  {
+    uint32_t bits = m_rin.fetch_add(reader_increment, std::memory_order::acquire) & writer_bits;
+    if (AI_UNLIKELY(bits != 0))
+    {
+      // A writer is present; wait till the end of its phase. The next writer has a
+      // different phase id, so this even works when that already entered its phase.
+      wait_until(m_rin, [=](uint32_t rin){ return (rin & writer_bits) != bits; });
+    }
+  }
+
+  void rdunlock()
+  {
+    m_rout.fetch_add(reader_increment, std::memory_order::release);
+  }
+
+  void wrlock()
+  {
+    uint32_t ticket = m_win.fetch_add(1, std::memory_order::relaxed);
+    wait_until(m_wout, [=](uint32_t wout){ return wout == ticket; });
+    enter_write_phase(ticket);
+  }
+
+  void wrunlock()
+  {
+    // Start a new read phase and let the next writer (if any) start waiting for it.
+    end_write_phase(-m_bits);
+  }
+
+  void rd2wrlock()
+  {
+    // Only take a writer ticket if it is served immediately: if a writer is waiting
+    // then it might be waiting for our own read lock.
+    uint32_t ticket = m_wout.load(std::memory_order::relaxed);
+    if (!m_win.compare_exchange_strong(ticket, ticket + 1, std::memory_order::acquire, std::memory_order::relaxed))
+    {
+      // It is impossible to recover from this: another thread has a read lock
+      // and requires to turn that into a write lock, or a writer is waiting for
+      // us. The only way out of this is to throw an exception and let the caller
+      // solve the mess. Call rdunlock() and then rd2wryield() before trying again.
+      throw std::exception();
+    }
+    // Leave as reader; no other writer can take over anymore now that we are being served.
+    m_rout.fetch_add(reader_increment, std::memory_order::relaxed);
+    enter_write_phase(ticket);
+  }
+
+  void wr2rdlock()
+  {
+    // Become a reader and start a new read phase in one go.
+    end_write_phase(reader_increment - m_bits);
+  }
+
+  // Called after rd2wrlock threw and the read lock was released.
+  // Wait until the writers that were waiting at that moment are done.
+  void rd2wryield()
+  {
+    std::this_thread::yield();
+    uint32_t ticket = m_win.load(std::memory_order::relaxed);
+    wait_until(m_wout, [=](uint32_t wout){ return static_cast<int32_t>(wout - ticket) >= 0; });
+  }
+};
@@ -0,0 +1,187 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIRCULock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <array>
+
+// Set THREADSAFE_RCU_TEST_HOOKS to 1 to let the tests stall a reader inside rdlock (see tests/snapshot_slow_reader.cxx).
+// When it is 0 (the default) the hooks are compiled out.
+#ifndef THREADSAFE_RCU_TEST_HOOKS
+#define THREADSAFE_RCU_TEST_HOOKS 0
+#endif
+
+#if THREADSAFE_RCU_TEST_HOOKS
+#define AIRCULOCK_TEST_HOOK(hook) do { if (AIRCULock::s_##hook) AIRCULock::s_##hook(); } while(0)
+#else
+#define AIRCULOCK_TEST_HOOK(hook) do { } while(0)
+#endif
+
+// The "mutex" of threadsafe::policy::RCU (read-copy-update).
+//
+// AIRCULock keeps a (type erased) pointer to the current version of the protected object.
+// Readers pin that version by incrementing one of two counters in their own reader slot
+// (each slot is on its own cache line, see AIShardedReadWriteLock), so they never block
+// and never write to a cache line that is shared with readers on other cores.
+//
+// Writers are serialized by a mutex. A writer makes its changes to a private copy
+// and then calls publish, which atomically replaces the current version, directs
+// new readers to the other counter of every slot and then waits until all readers
+// that still use the counter that was in use before are gone; at that point nobody
+// can be accessing the previous version anymore, which is then returned so that
+// the caller can delete it.
+//
+// A thread must not write to an object that it has pinned itself (other than
+// by converting the read access type that pinned it, which uses try_wrlock, see RCUAccess),
+// as that would wait forever.
+class AIRCULock
+{
+ public:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int number_of_slots = 64;
+
+  using deleter_type = void (*)(void*);
+
+ private:
+  struct alignas(cache_line_size) Slot
+  {
+    std::array<std::atomic<int>, 2> m_readers;    // The number of readers using this slot, for either value of the parity of m_index.
+    Slot() : m_readers{0, 0} { }
+  };
+
+  std::array<Slot, number_of_slots> m_slots;
+  alignas(cache_line_size) std::atomic<void*> m_current;        // The current version, or nullptr if that is still the version embedded in the Unlocked object.
+  std::atomic<unsigned int> m_index;                            // The parity of this selects the counter of each slot that new readers use.
+  deleter_type m_deleter;                                       // Function to delete m_current with, when this lock is destructed.
+  std::mutex m_writer_mutex;
+
+  inline static std::atomic<unsigned int> s_next_slot;
+
+#if THREADSAFE_RCU_TEST_HOOKS
+ public:
+  inline static void (*s_index_loaded_hook)();         // Called by rdlock after loading m_index.
+  inline static void (*s_version_loaded_hook)();       // Called by rdlock after loading the current version, while it is still pinned.
+
+ private:
+#endif
+
+  // Return the slot that is used by the current thread.
+  Slot& slot()
+  {
+    static thread_local unsigned int const slot_index = s_next_slot.fetch_add(1, std::memory_order::relaxed) % number_of_slots;
+    return m_slots[slot_index];
+  }
+
+  // Wait until no reader can be accessing the version that was current before the last call to publish.
+  void synchronize()
+  {
+    // Everyone who starts reading after this sees the new version, which was stored before
+    // this RMW, and everyone that started reading before this is counted in old_index
+    // (a reader that incremented the counter of old_index after this RMW sees that m_index
+    // changed, and tries again with the other counter; see rdlock).
+    unsigned int old_index = m_index.fetch_add(1, std::memory_order::seq_cst) & 1;
+    for (Slot const& s : m_slots)
+    {
+      int spin_count = 0;
+      while (s.m_readers[old_index].load(std::memory_order::seq_cst) != 0)
+      {
+        if (++spin_count < 1000)
+          cpu_relax();
+        else
+          std::this_thread::yield();    // A reader might have been descheduled.
+      }
+    }
+  }
+
+ public:
+  AIRCULock() : m_current(nullptr), m_index(0), m_deleter(nullptr) { }
+
+  ~AIRCULock()
+  {
+    void* current = m_current.load(std::memory_order::relaxed);
+    if (current)
+      m_deleter(current);
+  }
+
+  // Pin the current version. The returned counter must be passed to rdunlock.
+  // Returns nullptr if the current version is the one that is embedded in the Unlocked object.
+  void* rdlock(std::atomic<int>*& counter)
+  {
+    Slot& s = slot();
+    for (;;)
+    {
+      unsigned int index = m_index.load(std::memory_order::seq_cst);
+      AIRCULOCK_TEST_HOOK(index_loaded_hook);
+      counter = &s.m_readers[index & 1];
+      counter->fetch_add(1, std::memory_order::seq_cst);
+      // If m_index didn't change, then the next call to synchronize waits for us.
+      // Otherwise a writer might already have waited for this counter and deleted the version that we'd load.
+      if (AI_LIKELY(m_index.load(std::memory_order::seq_cst) == index))
+      {
+        void* version = m_current.load(std::memory_order::seq_cst);
+        AIRCULOCK_TEST_HOOK(version_loaded_hook);
+        return version;
+      }
+      counter->fetch_sub(1, std::memory_order::relaxed);
+    }
+  }
+
+  void rdunlock(std::atomic<int>* counter)
+  {
+    counter->fetch_sub(1, std::memory_order::release);
+  }
+
+  void wrlock() { m_writer_mutex.lock(); }
+  bool try_wrlock() { return m_writer_mutex.try_lock(); }
+  void wrunlock() { m_writer_mutex.unlock(); }
+
+  // The current version. Only call this while holding the write lock.
+  void* current() const { return m_current.load(std::memory_order::relaxed); }
+
+  // Make version the current version. Only call this while holding the write lock.
+  // Returns the previous version (or nullptr if that was the embedded version), which is no longer accessed by any reader.
+  void* publish(void* version, deleter_type deleter)
+  {
+    m_deleter = deleter;
+    void* previous = m_current.exchange(version, std::memory_order::seq_cst);
+    synchronize();
+    return previous;
+  }
+
+  // Called after a conversion from read to write access failed, when this thread no longer has anything pinned.
+  // Wait until the writer that caused the failure (if any) is done.
+  void rd2wryield()
+  {
+    std::this_thread::yield();
+    std::lock_guard<std::mutex> lk(m_writer_mutex);
+  }
+};
@@ -34,68 +34,260 @@
  *
  *   2016/12/17
  *   - Transfered copyright to Carlo Wood.
+ *
+ *   2026/10/14
+ *   - Moved the reader count and writer flag into a single atomic, so that
+ *     uncontended locking and unlocking is a single atomic RMW.
+ *   - Added try_rdlock, try_wrlock and their timed variants.
+ *   - Added the upgradable read lock (urdlock, urdunlock and urd2wrlock).
  */
 
 #pragma once
 
+#include "utils/macros.h"
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <thread>
 #include <exception>
+#include <chrono>
+#include <cstdint>
 
 class AIReadWriteMutex
 {
   public:
-    AIReadWriteMutex() : m_readers_count(0), m_waiting_writers(0), m_rd2wr_count(0) { }
+    AIReadWriteMutex() : m_state(0), m_waiting_writers(0), m_rd2wr_count(0), m_upgrading(false) { }
 
   private:
-    std::mutex m_state_mutex;					///< Guards all member variables below.
+    // The atomic m_state is divided into three fields:
+    //
+    //                                   K                     W                R
+    //                   ╭───────────────┴──────────────╮      ↓╭───────────────┴──────────────╮
+    // state (64 bits) = kkkkkkkkkkkkkkkkkkkkkkkkkkkkkkkwrrrrrrrrrrrrrrrrrrrrrrrrrrrrrrrr
+    //                   ↑                                ↑                               ↑
+    //                 bit 63                           bit 32                          bit 0
+    //
+    // R : the number of readers.
+    // W : set while a writer has the lock (this used to be m_readers_count == -1).
+    // K : the number of threads that wait, or are about to wait, on m_condition_unlocked, m_condition_no_writer_left or
+    //     m_condition_one_reader_left (all conditions that depend on R or W).
+    //
+    // As long as K is zero, rdlock, rdunlock, wrlock, rd2wrlock, wrunlock and wr2rdlock are a single atomic RMW
+    // and m_state_mutex is not touched at all. A thread increments K, while holding m_state_mutex, before it tests
+    // the condition that it waits for. Because K is part of the same atomic as R and W, every change of R or W
+    // after that sees that K is non-zero and then locks m_state_mutex before notifying the condition variable,
+    // which guarantees that the waiting thread can't miss the notification.
+    static constexpr uint64_t one_reader = 1;
+    static constexpr uint64_t writer = one_reader << 32;
+    static constexpr uint64_t one_waiter = writer << 1;
+    static constexpr uint64_t R_mask = writer - 1;
+    static constexpr uint64_t K_mask = ~(R_mask | writer);
+
+    std::atomic<uint64_t> m_state;				///< The R, W and K fields as described above.
+    std::mutex m_state_mutex;					///< Guards all member variables below, and modifications of K.
     std::condition_variable m_condition_unlocked;		///< Condition variable used to wait for no readers or writers left (to tell waiting writers).
     std::condition_variable m_condition_no_writer_left;		///< Condition variable used to wait for no writers left (to tell waiting readers).
     std::condition_variable m_condition_one_reader_left;	///< Condition variable used to wait for one reader left (to tell that reader that it can become a writer).
     std::condition_variable m_condition_rd2wr_count_zero;	///< Condition variable used to wait until m_rd2wr_count is zero.
-    int m_readers_count;					///< Number of readers or -1 if a writer locked this object.
     int m_waiting_writers;					///< Number of threads that are waiting for a write lock. Used to block readers from waking up.
     int m_rd2wr_count;						///< Number of threads that try to go from a read lock to a write lock.
+    bool m_upgrading;						///< Set while the upgradable reader waits for a thread in rd2wrlock to give up.
+    std::mutex m_upgrade_mutex;					///< Locked by the (one) thread that has the upgradable read lock.
 
   public:
     void rdlock()
     {
-      std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
-      m_condition_no_writer_left.wait(lk, [this]{return m_readers_count >= 0;});	// Wait till m_readers_count is no longer -1.
-      ++m_readers_count;								// One more reader.
+      if (AI_UNLIKELY(m_state.fetch_add(one_reader, std::memory_order::acquire) & writer))	// One more reader; unless there is a writer.
+        rdlock_blocked();
     }
 
     void rdunlock()
     {
+      uint64_t state = m_state.fetch_sub(one_reader, std::memory_order::release) - one_reader;	// Decrease reader count.
+      if (AI_UNLIKELY(state & K_mask) && (state & R_mask) <= 1)					// Was this the (second) last reader and is anyone waiting?
+        notify_reader_left(state);
+    }
+
+    void wrlock()
+    {
+      uint64_t unlocked = 0;
+      if (AI_UNLIKELY(!m_state.compare_exchange_strong(unlocked, writer, std::memory_order::acquire, std::memory_order::relaxed)))
+        wrlock_blocked();
+    }
+
+    void rd2wrlock()
+    {
+      uint64_t one_reader_left = one_reader;						// Only this thread has a read lock and nobody is waiting:
+      if (AI_UNLIKELY(!m_state.compare_exchange_strong(one_reader_left, writer,		// then no other thread can be calling rd2wrlock either.
+              std::memory_order::acquire, std::memory_order::relaxed)))
+        rd2wrlock_blocked();
+    }
+
+    void rd2wryield()
+    {
+      std::this_thread::yield();
       std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
-      if (--m_readers_count <= 1)							// Decrease reader count. Was this the (second) last reader?
+      m_condition_rd2wr_count_zero.wait(lk, [this]{return m_rd2wr_count == 0;});
+    }
+
+    // The upgradable read lock. Only one thread at a time can have it, but it coexists with normal read locks.
+    // Converting it into a write lock (urd2wrlock) never throws: if another thread is trying to convert its
+    // read lock at the same time then that thread throws (see rd2wrlock_blocked).
+    void urdlock()
+    {
+      m_upgrade_mutex.lock();
+      rdlock();
+    }
+
+    void urdunlock()
+    {
+      rdunlock();
+      m_upgrade_mutex.unlock();
+    }
+
+    // Convert the upgradable read lock of this thread into a write lock. Use wr2rdlock to convert it back.
+    void urd2wrlock()
+    {
+      uint64_t one_reader_left = one_reader;						// Only this thread has a read lock and nobody is waiting.
+      if (AI_UNLIKELY(!m_state.compare_exchange_strong(one_reader_left, writer,
+              std::memory_order::acquire, std::memory_order::relaxed)))
+        urd2wrlock_blocked();
+    }
+
+    void wrunlock()
+    {
+      uint64_t state = m_state.fetch_sub(writer, std::memory_order::release) - writer;	// We have no writer anymore.
+      if (AI_UNLIKELY(state & K_mask))							// Is anyone waiting?
       {
-	bool one_reader_left = m_readers_count == 1;
-	// In most practical cases there are no race conditions, so it is more efficient to first unlock m_state_mutex and only then kick waiting threads:
-	// if we did that the other way around then threads woken up would immediately block again on trying to obtain m_state_mutex before leaving wait().
-	// In the case that we try to wake up threads who can't be woken up because another thread now locked this object then the wait predicate will stop
-	// them from being woken up.
-	lk.unlock();
-
-	if (one_reader_left)								// Still one reader left, so only notify m_condition_one_reader_left.
-	  m_condition_one_reader_left.notify_one();
+	m_state_mutex.lock();								// Get exclusive access.
+	int waiting_writer = m_waiting_writers;
+	m_state_mutex.unlock();								// Release m_state_mutex so that threads can leave their respective wait() immediately.
+
+	if (waiting_writer)
+	  m_condition_unlocked.notify_one();						// Tell waiting writers.
 	else
-	  m_condition_unlocked.notify_one();						// No readers left, tell waiting writers.
+	  m_condition_no_writer_left.notify_all();					// Tell waiting readers.
       }
     }
 
-    void wrlock()
+    void wr2rdlock()
+    {
+      uint64_t state = m_state.fetch_add(one_reader - writer, std::memory_order::release) + (one_reader - writer);	// Turn writer into a reader.
+      if (AI_UNLIKELY(state & K_mask))							// Is anyone waiting?
+      {
+	m_state_mutex.lock();								// Get exclusive access.
+	int waiting_writer = m_waiting_writers;
+	m_state_mutex.unlock();								// Release m_state_mutex so that threads can leave their respective wait() immediately.
+
+	// Don't call m_condition_one_reader_left.notify_one() because it is impossible that any thread
+	// is waiting there: they'd need to have been a reader before and that is not allowed while
+	// we had the write lock.
+	if (!waiting_writer)
+	  m_condition_no_writer_left.notify_all();					// Tell waiting readers.
+      }
+    }
+
+    // Try to obtain a read lock without blocking. Fails when there is a writer.
+    bool try_rdlock() { return try_add_reader(); }
+
+    // Try to obtain a write lock without blocking. Fails when there are readers or a writer.
+    bool try_wrlock() { return try_add_writer(); }
+
+    template<typename Clock, typename Duration>
+    bool try_rdlock_until(std::chrono::time_point<Clock, Duration> const& deadline)
+    {
+      if (AI_LIKELY(try_add_reader()))
+	return true;
+      std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
+      m_state.fetch_add(one_waiter, std::memory_order::relaxed);
+      bool success = m_condition_no_writer_left.wait_until(lk, deadline, [this]{return try_add_reader();});
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
+      return success;
+    }
+
+    template<typename Clock, typename Duration>
+    bool try_wrlock_until(std::chrono::time_point<Clock, Duration> const& deadline)
     {
+      if (AI_LIKELY(try_add_writer()))
+	return true;
       std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
       ++m_waiting_writers;								// Stop readers from being woken up.
-      m_condition_unlocked.wait(lk, [this]{return m_readers_count == 0;});		// Wait until m_readers_count is 0 (nobody else has the lock).
+      m_state.fetch_add(one_waiter, std::memory_order::relaxed);
+      bool success = m_condition_unlocked.wait_until(lk, deadline, [this]{return try_add_writer();});
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
+      if (--m_waiting_writers == 0 && !success)
+	m_condition_no_writer_left.notify_all();					// Readers were not woken up because of us.
+      else if (!success)
+	m_condition_unlocked.notify_one();						// Pass on a notification that might have been meant for another writer.
+      return success;
+    }
+
+    template<typename Rep, typename Period>
+    bool try_rdlock_for(std::chrono::duration<Rep, Period> const& timeout)
+    {
+      return try_rdlock_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    template<typename Rep, typename Period>
+    bool try_wrlock_for(std::chrono::duration<Rep, Period> const& timeout)
+    {
+      return try_wrlock_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+  private:
+    // Returns true if a read lock was obtained.
+    bool try_add_reader()
+    {
+      uint64_t state = m_state.load(std::memory_order::relaxed);
+      while (!(state & writer))
+	if (m_state.compare_exchange_weak(state, state + one_reader, std::memory_order::acquire, std::memory_order::relaxed))
+	  return true;
+      return false;
+    }
+
+    // Returns true if a write lock was obtained.
+    bool try_add_writer()
+    {
+      uint64_t state = m_state.load(std::memory_order::relaxed);
+      while (!(state & (R_mask | writer)))						// Is m_readers_count 0 (nobody else has the lock)?
+	if (m_state.compare_exchange_weak(state, state + writer, std::memory_order::acquire, std::memory_order::relaxed))
+	  return true;
+      return false;
+    }
+
+    // Returns true if the read lock of this thread was converted into a write lock.
+    bool try_convert_reader()
+    {
+      uint64_t state = m_state.load(std::memory_order::relaxed);
+      while ((state & R_mask) == 1)							// Is m_readers_count 1 (only this thead has its read lock)?
+	if (m_state.compare_exchange_weak(state, state - one_reader + writer, std::memory_order::acquire, std::memory_order::relaxed))
+	  return true;
+      return false;
+    }
+
+    void rdlock_blocked()
+    {
+      std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
+      // Undo the increment of R and announce that we are going to wait.
+      uint64_t state = m_state.fetch_add(one_waiter - one_reader, std::memory_order::relaxed) + (one_waiter - one_reader);
+      // If the writer left in the meantime then a (converting) writer might have been waiting for our increment of R to be undone.
+      if (!(state & writer) && (state & R_mask) <= 1)
+	notify_last_reader(state);
+      m_condition_no_writer_left.wait(lk, [this]{return try_add_reader();});		// Wait till there is no writer and add one more reader.
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
+    }
+
+    void wrlock_blocked()
+    {
+      std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
+      ++m_waiting_writers;								// Stop readers from being woken up.
+      m_state.fetch_add(one_waiter, std::memory_order::relaxed);
+      m_condition_unlocked.wait(lk, [this]{return try_add_writer();});			// Wait until nobody else has the lock and become the writer.
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
       --m_waiting_writers;
-      m_readers_count = -1;								// We are a writer now.
     }
 
-    void rd2wrlock()
+    void rd2wrlock_blocked()
     {
       std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
       if (++m_rd2wr_count > 1)								// Only the first thread that calls rd2wrlock will get passed this.
@@ -111,44 +303,56 @@ class AIReadWriteMutex
 	throw std::exception();
       }
       ++m_waiting_writers;								// Stop readers from being woken up.
-      m_condition_one_reader_left.wait(lk, [this]{return m_readers_count == 1;});	// Wait till m_readers_count is 1 (only this thead has its read lock).
+      m_state.fetch_add(one_waiter, std::memory_order::relaxed);
+      bool converted = false;
+      m_condition_one_reader_left.wait(lk, [this, &converted]{					// Wait till only this thead has its read lock and become the writer,
+          return (converted = try_convert_reader()) || m_upgrading;});			// or until the upgradable reader wants to upgrade.
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
       --m_waiting_writers;
-      m_readers_count = -1;								// We are a writer now.
       if (--m_rd2wr_count == 0)
-	m_condition_rd2wr_count_zero.notify_one();					// Allow additional calls to rd2wrlock().
+	m_condition_rd2wr_count_zero.notify_all();					// Allow additional calls to rd2wrlock() (and urd2wrlock()).
+      // The upgradable reader has a read lock too, so we'd wait forever. Let the caller release its read lock.
+      if (!converted)
+	throw std::exception();
     }
 
-    void rd2wryield()
+    void urd2wrlock_blocked()
     {
-      std::this_thread::yield();
       std::unique_lock<std::mutex> lk(m_state_mutex);					// Get exclusive access.
-      m_condition_rd2wr_count_zero.wait(lk, [this]{return m_rd2wr_count == 0;});
+      if (m_rd2wr_count > 0)								// Is another thread waiting in rd2wrlock_blocked?
+      {
+	m_upgrading = true;								// Make it throw.
+	m_condition_one_reader_left.notify_all();
+	m_condition_rd2wr_count_zero.wait(lk, [this]{return m_rd2wr_count == 0;});
+	m_upgrading = false;
+      }
+      ++m_rd2wr_count;									// From now on calls to rd2wrlock() throw.
+      ++m_waiting_writers;								// Stop readers from being woken up.
+      m_state.fetch_add(one_waiter, std::memory_order::relaxed);
+      m_condition_one_reader_left.wait(lk, [this]{return try_convert_reader();});	// Wait till only this thead has its read lock and become the writer.
+      m_state.fetch_sub(one_waiter, std::memory_order::relaxed);
+      --m_waiting_writers;
+      if (--m_rd2wr_count == 0)
+	m_condition_rd2wr_count_zero.notify_all();					// Allow additional calls to rd2wrlock().
     }
 
-    void wrunlock()
+    // Called after R was decremented to one or zero (resulting in state) while K was non-zero.
+    void notify_reader_left(uint64_t state)
     {
-      m_state_mutex.lock();								// Get exclusive access.
-      m_readers_count = 0;								// We have no writer anymore.
-      int waiting_writer = m_waiting_writers;
-      m_state_mutex.unlock();								// Release m_state_mutex so that threads can leave their respective wait() immediately.
-
-      if (waiting_writer)
-	m_condition_unlocked.notify_one();						// Tell waiting writers.
-      else
-	m_condition_no_writer_left.notify_all();					// Tell waiting readers.
+      // In most practical cases there are no race conditions, so it is more efficient to first unlock m_state_mutex and only then kick waiting threads:
+      // if we did that the other way around then threads woken up would immediately block again on trying to obtain m_state_mutex before leaving wait().
+      // In the case that we try to wake up threads who can't be woken up because another thread now locked this object then the wait predicate will stop
+      // them from being woken up.
+      m_state_mutex.lock();
+      m_state_mutex.unlock();
+      notify_last_reader(state);
     }
 
-    void wr2rdlock()
+    void notify_last_reader(uint64_t state)
     {
-      m_state_mutex.lock();								// Get exclusive access.
-      m_readers_count = 1;								// Turn writer into a reader.
-      int waiting_writer = m_waiting_writers;
-      m_state_mutex.unlock();								// Release m_state_mutex so that threads can leave their respective wait() immediately.
-
-      // Don't call m_condition_one_reader_left.notify_one() because it is impossible that any thread
-      // is waiting there: they'd need to have been a reader before and that is not allowed while
-      // we had the write lock.
-      if (!waiting_writer)
-	m_condition_no_writer_left.notify_all();					// Tell waiting readers.
+      if ((state & R_mask) == 1)							// Still one reader left, so only notify m_condition_one_reader_left.
+	m_condition_one_reader_left.notify_one();
+      else
+	m_condition_unlocked.notify_one();						// No readers left, tell waiting writers.
     }
 };
@@ -38,12 +38,17 @@
 #include "utils/cpu_relax.h"
 #include "utils/macros.h"
 #include "debug.h"
+#include "LockTrace.h"
+#include "SingleThreadedPhase.h"
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <thread>
 #include <exception>
 #include <array>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 
 #if (defined(__clang__) && __clang_major__ <= 14) || (defined(CWDEBUG) && defined(DEBUG_STATIC_ASSERTS))
 // Broken compiler - or we're debugging the static_asserts.
@@ -83,6 +88,26 @@
 #define TPP
 #endif // DEBUG_RWSPINLOCK_THREADPERMUTER
 
+// Set RWSPINLOCK_USE_ATOMIC_WAIT to 0 to park blocked threads on a std::mutex / std::condition_variable pair,
+// instead of waiting directly on a 32-bit word with std::atomic<>::wait (which is a futex on linux).
+#ifndef RWSPINLOCK_USE_ATOMIC_WAIT
+#ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
+#define RWSPINLOCK_USE_ATOMIC_WAIT 0    // The ThreadPermuter must be able to intercept every wait.
+#else
+#define RWSPINLOCK_USE_ATOMIC_WAIT 1
+#endif
+#endif
+#if RWSPINLOCK_USE_ATOMIC_WAIT && defined(DEBUG_RWSPINLOCK_THREADPERMUTER)
+#error "DEBUG_RWSPINLOCK_THREADPERMUTER requires RWSPINLOCK_USE_ATOMIC_WAIT to be 0."
+#endif
+
+// The maximum number of times that wrlock and rd2wrlock call cpu_relax() while waiting for readers to release
+// their lock, before they park the thread (see AIReadWriteSpinLock::wait_for_readers). The actual number is
+// tuned at run time, per lock, from how long it took the readers to leave in the past.
+#ifndef RWSPINLOCK_MAX_SPIN
+#define RWSPINLOCK_MAX_SPIN 4096
+#endif
+
 class AIReadWriteSpinLock
 {
  private:
@@ -166,6 +191,54 @@ class AIReadWriteSpinLock
   }
 #endif
 
+  std::atomic<int64_t> m_state;
+
+  // The number of threads that are blocked, or about to block, in rdlock_blocked (P) and in the wait of wrlock, rd2wrlock
+  // or rd2wryield (Q). A thread increments its counter before (re)testing m_state for the last time prior to going to sleep,
+  // and every transition that removes a writer reads m_parked after updating m_state. Both use std::memory_order::seq_cst,
+  // so that at least one of them sees the change of the other: either the transition sees that it has to wake up the
+  // waiting thread, or the waiting thread sees the new m_state and doesn't go to sleep at all.
+  //
+  //                            Q               P
+  //                    ╭───────┴──────╮╭───────┴──────╮
+  // parked (32 bits) = qqqqqqqqqqqqqqqqpppppppppppppppp
+  //
+  // As a result, when nobody is parked, wrunlock and wr2rdlock are a single RMW (plus a load of the same cache line).
+  std::atomic<uint32_t> m_parked;
+  static constexpr uint32_t parked_reader = 1;
+  static constexpr uint32_t parked_writer = parked_reader << shift;
+  static constexpr uint32_t P_mask = parked_writer - 1;
+  static constexpr uint32_t Q_mask = P_mask << shift;
+
+  // The number of writers that are parked in wait_for_readers, because the readers did not leave within the spin budget.
+  // This pairs with every transition that removes a reader in the same way as m_parked, see readers_left.
+  std::atomic<uint32_t> m_draining;
+
+  // The number of times that wait_for_readers calls cpu_relax() before it parks the thread.
+  static constexpr uint32_t min_spin = std::min<uint32_t>(32, RWSPINLOCK_MAX_SPIN);
+  static constexpr uint32_t max_spin = RWSPINLOCK_MAX_SPIN;
+  static constexpr uint32_t max_backoff = 64;   // The maximum number of cpu_relax() calls between two loads of m_state.
+  std::atomic<uint32_t> m_spin_budget;
+
+  // The upgradable read lock: m_upgradable is not upgradable_free while a (the one) thread has it.
+  // Other threads that try to convert their read-lock into a write-lock throw when they see that (see rd2wrlock);
+  // that way the upgradable reader never has to throw. It is upgradable_contended when other threads might be
+  // waiting (with std::atomic<>::wait) for it to become free, in urdlock or rd2wryield.
+  // This is a single word, rather than a std::mutex, because most locks never use it.
+  static constexpr uint32_t upgradable_free = 0;
+  static constexpr uint32_t upgradable_locked = 1;
+  static constexpr uint32_t upgradable_contended = 2;
+  std::atomic<uint32_t> m_upgradable;
+
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+  // Each time that a transition might allow a thread that is blocked in rdlock_blocked to continue, m_readers_wakeup
+  // is incremented and notified. Likewise, m_writers_wakeup replaces m_writers_cv (see the #else branch below).
+  // A waiting thread reads the wakeup word *before* testing m_state and then waits for the word to change;
+  // therefore it is impossible to miss a wake up.
+  std::atomic<uint32_t> m_readers_wakeup;
+  std::atomic<uint32_t> m_writers_wakeup;
+  std::atomic<uint32_t> m_draining_wakeup;
+#else
 #ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
   using mutex_t = thread_permuter::Mutex;
   using condition_variable_t = thread_permuter::ConditionVariable;
@@ -174,11 +247,13 @@ class AIReadWriteSpinLock
   using condition_variable_t = std::condition_variable;
 #endif
 
-  std::atomic<int64_t> m_state;
   mutex_t m_readers_cv_mutex;
   condition_variable_t m_readers_cv;
   mutex_t m_writers_cv_mutex;
   condition_variable_t m_writers_cv;
+  mutex_t m_draining_cv_mutex;
+  condition_variable_t m_draining_cv;
+#endif
 
   // This condition is used to detect if a reader is allowed to grab a read-lock.
   //
@@ -305,6 +380,13 @@ class AIReadWriteSpinLock
     return i[2] < 0;
   }
 
+  // Returns true if R < 0.
+  static consteval bool removes_reader(int64_t increment)
+  {
+    std::array<int, 4> i = decode_increment(increment);
+    return i[3] < 0;
+  }
+
 #if DEBUG_RWSPINLOCK
   // Works for state and increment.
   static consteval int64_t make_state(std::array<int, 4> const& s)
@@ -492,8 +574,8 @@ class AIReadWriteSpinLock
                     if (!(s[0] + i[0] <= -(s[1] + i[1] + s[2] + i[2]))) // Also the resulting state must always have V <= -(C + W).
                       continue;
                     int64_t increment = make_state(i);
-                    bool converting_writer_present_becomes_false = converting_writer_present(state) && !converting_writer_present(state + increment);
-                    if (converting_writer_present_becomes_false && !removes_converting_writer(increment))
+                    bool actual_writer_present_becomes_false = actual_writer_present(state) && !actual_writer_present(state + increment);
+                    if (actual_writer_present_becomes_false && !removes_actual_writer(increment))
                     {
 #ifdef DEBUG_STATIC_ASSERTS
                       std::cout << "Error: " << std::dec << "pure_waiting = " << pure_waiting << ", converting = " <<
@@ -501,7 +583,7 @@ class AIReadWriteSpinLock
                         std::hex << std::setfill('0') << std::setw(16) << state << std::dec << std::endl;
                       std::cout << "v = " << v << ", c = " << c << ", w = " << w << ", r = " << r << "; increment = " <<
                         std::hex << std::setfill('0') << std::setw(16) << increment << std::dec << std::endl;
-                      std::cout << "converting_writer_present_becomes_false = " << std::boolalpha << converting_writer_present_becomes_false <<
+                      std::cout << "actual_writer_present_becomes_false = " << std::boolalpha << actual_writer_present_becomes_false <<
                         "; state + increment = " << std::hex << std::setfill('0') << std::setw(16) << (state + increment) << std::dec << std::endl;
 #endif
                       return false;     // Logic error.
@@ -596,87 +678,297 @@ class AIReadWriteSpinLock
     return true;  // Success.
   }
 
+  static consteval bool test_wake_up_required()
+  {
+    // Test that skipping the wake up when nobody is parked, or when removes_writer(increment) is false, never loses a wake up;
+    // and that a wake up of parked writers is only required when removes_converting_or_actual_writer(increment),
+    // removes_converting_writer(increment) or removes_actual_writer(increment) is true.
+    constexpr std::array<uint32_t, 4> parked_values = { 0, parked_reader, parked_writer, parked_reader + 2 * parked_writer };
+    for (int pure_waiting = 0; pure_waiting <= 2; ++pure_waiting)
+      for (int converting = 0; converting <= 3; ++converting)
+        for (int writing = 0; writing <= 2; ++writing)
+          for (int reading = 0; reading <= 2; ++reading)
+          {
+            std::array<int, 4> s = { -pure_waiting - converting - writing, converting, writing, reading };
+            int64_t state = make_state(s);
+            // Counters may never become negative (or v positive).
+            for (int v = -1; v <= 1; ++v)
+              for (int c = std::max(-2, -converting); c <= 2; ++c)      // c + converting >= 0 --> c >= -converting.
+                for (int w = std::max(-2, -writing); w <= 2; ++w)
+                  for (int r = std::max(-2, -reading); r <= 2; ++r)
+                  {
+                    std::array<int, 4> i = { v - c - w, c, w, r };
+                    if (!(s[0] + i[0] <= -(s[1] + i[1] + s[2] + i[2]))) // Also the resulting state must always have V <= -(C + W).
+                      continue;
+                    int64_t increment = make_state(i);
+                    for (uint32_t parked : parked_values)
+                    {
+                      int wake_up = wake_up_required(state, increment, parked);
+                      bool error =
+                        (parked == 0 && wake_up != 0) ||
+                        (!removes_writer(increment) && wake_up != 0) ||
+                        ((parked & P_mask) == 0 && (wake_up & wake_up_readers)) ||
+                        ((parked & Q_mask) == 0 && (wake_up & (wake_up_writers | wake_up_one_writer))) ||
+                        ((wake_up & (wake_up_writers | wake_up_one_writer)) &&
+                         !(removes_converting_or_actual_writer(increment) || removes_converting_writer(increment) || removes_actual_writer(increment)));
+                      // Conversely, if there are parked threads and one of the conditions that they wait for becomes false, they must be woken up.
+                      bool readers_must_wake_up = (parked & P_mask) && writer_present(state) && !writer_present(state + increment);
+                      bool writers_must_wake_up = (parked & Q_mask) &&
+                        ((converting_writer_present(state) && !converting_writer_present(state + increment)) ||
+                         (converting_or_actual_writer_present(state) && !converting_or_actual_writer_present(state + increment)) ||
+                         (actual_writer_present(state) && !actual_writer_present(state + increment)));
+                      error = error ||
+                        (readers_must_wake_up && !(wake_up & wake_up_readers)) ||
+                        (writers_must_wake_up && !(wake_up & (wake_up_writers | wake_up_one_writer)));
+                      if (error)
+                      {
+#ifdef DEBUG_STATIC_ASSERTS
+                        std::cout << "Error: " << std::dec << "pure_waiting = " << pure_waiting << ", converting = " <<
+                          converting << ", writing = " << writing << ", reading = " << reading << "; state = " <<
+                          std::hex << std::setfill('0') << std::setw(16) << state << std::dec << std::endl;
+                        std::cout << "v = " << v << ", c = " << c << ", w = " << w << ", r = " << r << "; increment = " <<
+                          std::hex << std::setfill('0') << std::setw(16) << increment << "; parked = " << std::setw(8) << parked << std::dec <<
+                          "; wake_up_required() = " << wake_up << std::endl;
+#endif
+                        return false;     // Logic error.
+                      }
+                    }
+                  }
+          }
+    return true;  // Success.
+  }
+
   // The sanity of all of the above is tested in AIReadWriteSpinLock_static_assert, see at the bottom of this file.
   friend struct AIReadWriteSpinLock_static_assert;
 #endif // DEBUG_RWSPINLOCK
 
-  template<int64_t increment>
-  [[gnu::always_inline]] int64_t do_transition()
+  // Values that can be or-ed together and are returned by wake_up_required.
+  static constexpr int wake_up_readers = 1;     // Wake up all threads that are blocked in rdlock_blocked.
+  static constexpr int wake_up_writers = 2;     // Wake up all threads that are waiting in wrlock, rd2wrlock or rd2wryield.
+  static constexpr int wake_up_one_writer = 4;  // Wake up one thread that is waiting in wrlock, rd2wrlock or rd2wryield.
+
+  // Returns which of the parked threads must be woken up after adding increment to previous_state.
+  static constexpr int wake_up_required(int64_t previous_state, int64_t increment, uint32_t parked)
   {
-    RWSLDoutEntering(dc::notice|continued_cf, "do_transition<" << get_counters_as_increment(increment) << ">() ");
-    // `increment == 0` is a no-op. The return value in that case should not be used; but since we can't check that,
-    // just don't allow the function to be called at all (since that doesn't make sense anyway).
-    static_assert(increment != 0, "Don't call do_transition<0>()");
-    // If the result of `writer_present` might change from true to false, we should wake up possible threads that are waiting for that.
-    if constexpr (removes_writer(increment))
+    int64_t const new_state = previous_state + increment;
+    int wake_up = 0;
+    // If writer_present changed from true to false, wake up all threads that are waiting for a read-lock.
+    if ((parked & P_mask) && writer_present(previous_state) && !writer_present(new_state))
+      wake_up |= wake_up_readers;
+    if ((parked & Q_mask))
+    {
+      // If converting_writer_present changed from true to false, wake up all threads that are possibly waiting in rd2wryield.
+      if (converting_writer_present(previous_state) && !converting_writer_present(new_state))
+        wake_up |= wake_up_writers;
+      // Otherwise, if converting_or_actual_writer_present or actual_writer_present changed from true to false, wake up one waiting thread.
+      else if ((converting_or_actual_writer_present(previous_state) && !converting_or_actual_writer_present(new_state)) ||
+               (actual_writer_present(previous_state) && !actual_writer_present(new_state)))
+        wake_up |= wake_up_one_writer;
+    }
+    return wake_up;
+  }
+
+  // Called before a thread tests m_state for the last time prior to waiting.
+  void park(uint32_t parked_unit)
+  {
+    m_parked.fetch_add(parked_unit, std::memory_order::seq_cst);
+  }
+
+  // Called after a thread left its wait loop.
+  void unpark(uint32_t parked_unit)
+  {
+    m_parked.fetch_sub(parked_unit, std::memory_order::relaxed);
+  }
+
+  void wake_up_parked(int wake_up)
+  {
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    if ((wake_up & wake_up_readers))
+    {
+      RWSLDout(dc::notice, "Calling m_readers_wakeup.notify_all()");
+      m_readers_wakeup.fetch_add(1, std::memory_order::release);
+      m_readers_wakeup.notify_all();
+    }
+    if ((wake_up & (wake_up_writers | wake_up_one_writer)))
+    {
+      m_writers_wakeup.fetch_add(1, std::memory_order::release);
+      if ((wake_up & wake_up_writers))
+      {
+        RWSLDout(dc::notice, "Calling m_writers_wakeup.notify_all()");
+        m_writers_wakeup.notify_all();
+      }
+      else
+      {
+        RWSLDout(dc::notice, "Calling m_writers_wakeup.notify_one()");
+        m_writers_wakeup.notify_one();
+      }
+    }
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
+    // m_state was already changed; locking and unlocking the mutex guarantees that a thread
+    // that tested the old m_state while holding that mutex is now inside wait().
+    if ((wake_up & wake_up_readers))
     {
-#if CW_DEBUG
-      bool m_writers_cv_mutex_was_locked = false;
-#endif
-      int64_t previous_state;
       {
         std::lock_guard<mutex_t> lk(m_readers_cv_mutex);
-        RWSLDout(dc::notice, "m_readers_cv_mutex is locked.");
-        if constexpr (removes_converting_or_actual_writer(increment) ||
-                      removes_converting_writer(increment) ||
-                      removes_actual_writer(increment))
-        {
-          {
-            std::lock_guard<mutex_t> lk(m_writers_cv_mutex);
-#if CW_DEBUG
-            m_writers_cv_mutex_was_locked = true;
-#endif
-            RWSLDout(dc::notice, "m_writers_cv_mutex is locked.");
-            previous_state = m_state.fetch_add(increment, std::memory_order::release);  // Synchronize with rdunlock.
-            // Trying to remove a reader, writer or converting writer that isn't there!
-            // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
-            ASSERT(((previous_state + increment) & sign_bits_rwc) == 0);
-            RWSLDout(dc::finish, get_counters(previous_state) <<  " --> " << get_counters(previous_state + increment));
-            TPY;
-            RWSLDout(dc::notice, "Unlocking m_writers_cv_mutex...");
-          }
-          TPY;
-        }
-        else
-        {
-          // Remove a waiting writer.
-          previous_state = m_state.fetch_add(increment, std::memory_order::relaxed);
-          // Trying to remove a reader, writer or converting writer that isn't there!
-          // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
-          ASSERT(((previous_state + increment) & sign_bits_rwc) == 0);
-          RWSLDout(dc::finish, get_counters(previous_state) << " --> " << get_counters(previous_state + increment));
-          TPY;
-        }
-        RWSLDout(dc::notice, "Unlocking m_readers_cv_mutex...");
+        TPY;
       }
       TPY;
-
-      // If writer_present changed from true to false, wake up all threads that are waiting for a read-lock.
-      if (writer_present(previous_state) && !writer_present(previous_state + increment))
+      RWSLDout(dc::notice, "Calling m_readers_cv.notify_all()");
+      m_readers_cv.notify_all();
+    }
+    if ((wake_up & (wake_up_writers | wake_up_one_writer)))
+    {
       {
-        RWSLDout(dc::notice, "Calling m_readers_cv.notify_all()");
-        m_readers_cv.notify_all();
+        std::lock_guard<mutex_t> lk(m_writers_cv_mutex);
+        TPY;
       }
-      else
-        RWSLDout(dc::notice, "Not calling m_readers_cv.notify_all() because writer_present() didn't change.");
-
-      // If converting_writer_present changed from true to false, wake up all threads that are possibly waiting in rd2wryield.
-      if (converting_writer_present(previous_state) && !converting_writer_present(previous_state + increment))
+      TPY;
+      if ((wake_up & wake_up_writers))
       {
-        ASSERT(m_writers_cv_mutex_was_locked);
         RWSLDout(dc::notice, "Calling m_writers_cv.notify_all()");
         m_writers_cv.notify_all();
       }
-      // Otherwise, if converting_or_actual_writer_present or actual_writer_present changed from true to false, wake up one thread waiting on m_writers_cv.
-      else if ((converting_or_actual_writer_present(previous_state) && !converting_or_actual_writer_present(previous_state + increment)) ||
-               (actual_writer_present(previous_state) && !actual_writer_present(previous_state + increment)))
+      else
       {
-        ASSERT(m_writers_cv_mutex_was_locked);
         RWSLDout(dc::notice, "Calling m_writers_cv.notify_one()");
         m_writers_cv.notify_one();
       }
+    }
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+  }
+
+  // Called after a transition that removed a reader, with the state before and after that transition.
+  [[gnu::always_inline]] void readers_left(int64_t previous_state, int64_t new_state)
+  {
+    // Writers only wait for readers while V is negative; wrlock waits for R == 0 and rd2wrlock for R == 1.
+    if (AI_UNLIKELY(writer_present(previous_state) && (new_state & R_mask) <= 1) &&
+        m_draining.load(std::memory_order::seq_cst) != 0)
+      wake_up_draining();
+  }
+
+  void wake_up_draining()
+  {
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    RWSLDout(dc::notice, "Calling m_draining_wakeup.notify_all()");
+    m_draining_wakeup.fetch_add(1, std::memory_order::release);
+    m_draining_wakeup.notify_all();
+#else
+    {
+      std::lock_guard<mutex_t> lk(m_draining_cv_mutex);
+      TPY;
+    }
+    TPY;
+    RWSLDout(dc::notice, "Calling m_draining_cv.notify_all()");
+    m_draining_cv.notify_all();
+#endif
+  }
+
+  // Wait until R <= max_readers; used by wrlock (max_readers = 0) and rd2wrlock (max_readers = 1, its own read-lock).
+  //
+  // At this point V is negative, so no new reader will succeed: the existing readers are typically gone
+  // after a short while. Therefore first spin, reading m_state with an exponentially increasing number of
+  // calls to cpu_relax() in between, but only up to the spin budget; if the readers still didn't
+  // leave then (for example because one of them got descheduled or hit a page fault) park the thread
+  // until a transition that removes a reader wakes it up (see readers_left).
+  //
+  // The spin budget is a running average, per lock, of twice the time it took readers to leave before
+  // (when that happened while spinning), decaying towards min_spin each time the thread had to be parked.
+  // Returns the last read value of m_state.
+  int64_t wait_for_readers(int64_t max_readers)
+  {
+    RWSLDout(dc::notice|continued_cf|flush_cf, "spinning... ");
+    THREADSAFE_TRACE(spinning, this);
+    int64_t state;
+    uint32_t const budget = m_spin_budget.load(std::memory_order::relaxed);
+    uint32_t spins = 0;
+    uint32_t backoff = 1;
+    while (((state = m_state.load(std::memory_order::relaxed)) & R_mask) > max_readers)
+    {
+      if (AI_UNLIKELY(spins >= budget))
+        break;
+      for (uint32_t i = 0; i < backoff; ++i)
+        cpu_relax();
+      spins += backoff;
+      if (backoff < max_backoff)
+        backoff <<= 1;
+      TPB;
+    }
+    if (AI_LIKELY((state & R_mask) <= max_readers))
+    {
+      RWSLDout(dc::finish, "done (state = " << get_counters(state) << ")");
+      uint32_t target = std::min(max_spin, std::max(min_spin, 2 * spins));
+      m_spin_budget.store(budget + (static_cast<int32_t>(target - budget) >> 3), std::memory_order::relaxed);
+      return state;
+    }
+    RWSLDout(dc::finish, "parking (state = " << get_counters(state) << ")");
+    THREADSAFE_TRACE(parked, this);
+    m_spin_budget.store(budget - ((budget - min_spin) >> 3), std::memory_order::relaxed);
+    m_draining.fetch_add(1, std::memory_order::seq_cst);
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    for (;;)
+    {
+      // Read the wakeup word before testing m_state, see do_transition.
+      uint32_t wakeup = m_draining_wakeup.load(std::memory_order::acquire);
+      if (((state = m_state.load(std::memory_order::seq_cst)) & R_mask) <= max_readers)
+        break;
+      m_draining_wakeup.wait(wakeup, std::memory_order::relaxed);
+    }
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
+    {
+      std::unique_lock<mutex_t> lk(m_draining_cv_mutex);
+      TPY;
+      m_draining_cv.wait(lk, [this, &state, max_readers](){
+        // Since this returns false while there are too many readers, readers_left must lock
+        // m_draining_cv_mutex after every transition that removes a reader - and do a notify_all after that.
+        bool exit_wait = ((state = m_state.load(std::memory_order::seq_cst)) & R_mask) <= max_readers;
+#ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
+        if (!exit_wait)
+          TPP;    // For the unlock of m_draining_cv_mutex.
+#endif
+        return exit_wait;
+      });
+    }
+    TPY; // Because we left the scope of the std::unique_lock.
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+    m_draining.fetch_sub(1, std::memory_order::relaxed);
+    THREADSAFE_TRACE(unparked, this);
+    RWSLDout(dc::notice, "Unparked (state = " << get_counters(state) << ")");
+    return state;
+  }
+
+  template<int64_t increment>
+  [[gnu::always_inline]] int64_t do_transition()
+  {
+    RWSLDoutEntering(dc::notice|continued_cf, "do_transition<" << get_counters_as_increment(increment) << ">() ");
+    // `increment == 0` is a no-op. The return value in that case should not be used; but since we can't check that,
+    // just don't allow the function to be called at all (since that doesn't make sense anyway).
+    static_assert(increment != 0, "Don't call do_transition<0>()");
+    // If the result of `writer_present` might change from true to false, we should wake up possible threads that are waiting for that.
+    if constexpr (removes_writer(increment))
+    {
+      // Synchronize with rdunlock and the acquire of the waiting threads.
+      // This must be seq_cst because it pairs with the increment of m_parked by threads that are about to wait (see park()).
+      int64_t previous_state = m_state.fetch_add(increment, std::memory_order::seq_cst);
+      // Trying to remove a reader, writer or converting writer that isn't there!
+      // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
+      ASSERT(((previous_state + increment) & sign_bits_rwc) == 0);
+      RWSLDout(dc::finish, get_counters(previous_state) <<  " --> " << get_counters(previous_state + increment));
+      TPY;
+
+      // Only threads that are parked need to be woken up.
+      uint32_t parked = m_parked.load(std::memory_order::seq_cst);
+      if (AI_UNLIKELY(parked != 0))
+      {
+        int wake_up = wake_up_required(previous_state, increment, parked);
+        if (wake_up)
+          wake_up_parked(wake_up);
+        else
+          RWSLDout(dc::notice, "Not waking up anyone because writer_present, converting_writer_present, converting_or_actual_writer_present and actual_writer_present all didn't change.");
+      }
       else
-        RWSLDout(dc::notice, "Not calling m_writers_cv.notify_all() because converting_writer_present, converting_or_actual_writer_present and actual_writer_present all didn't change.");
+        RWSLDout(dc::notice, "Not waking up anyone because no thread is parked.");
+      if constexpr (removes_reader(increment))
+        readers_left(previous_state, previous_state + increment);
 
       return previous_state;
     }
@@ -695,6 +987,18 @@ class AIReadWriteSpinLock
         // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
         ASSERT(((previous_state + increment) & sign_bits_rwc) == 0);
       }
+      else if constexpr (removes_reader(increment))
+      {
+        // This must be seq_cst because it pairs with the increment of m_draining by writers that are about to park (see wait_for_readers).
+        previous_state = m_state.fetch_add(increment, std::memory_order::seq_cst);
+        // Trying to remove a reader, writer or converting writer that isn't there!
+        // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
+        ASSERT(((previous_state + increment) & sign_bits_rwc) == 0);
+        RWSLDout(dc::finish, get_counters(previous_state) << " --> " << get_counters(previous_state + increment));
+        TPY;
+        readers_left(previous_state, previous_state + increment);
+        return previous_state;
+      }
       else
       {
         // This change might cause threads to leave their spin-loop, but no notify_one is required.
@@ -710,12 +1014,18 @@ class AIReadWriteSpinLock
   }
 
  public:
-  AIReadWriteSpinLock() : m_state(0) { }
+  AIReadWriteSpinLock() : m_state(0), m_parked(0), m_draining(0), m_spin_budget(max_spin), m_upgradable(upgradable_free)
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    , m_readers_wakeup(0), m_writers_wakeup(0), m_draining_wakeup(0)
+#endif
+  { }
 
   // Fast path. Implement taking a read-lock with a single RMW operation.
   void rdlock()
   {
     RWSLDoutEntering(dc::notice, "rdlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_lock()))
+      return;
     // Write locks have a higher priority in this class, therefore back-off any new read-lock
     // even when there are waiting writers (but no real succeeded write-lock yet).
 #if DEBUG_RWSPINLOCK
@@ -732,7 +1042,10 @@ class AIReadWriteSpinLock
   void rdunlock()
   {
     RWSLDoutEntering(dc::notice, "rdunlock()");
-    // If this results in R == 0 and there are waiting writers, then those have to pick that up by reading m_state in a spin loop.
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_unlock()))
+      return;
+    // If this results in R == 0 (or R == 1) and there are waiting writers, then those pick that up by reading m_state
+    // in their spin loop, or they are woken up by this transition if they are parked (see wait_for_readers).
     do_transition<one_rdunlock>();
   }
 
@@ -744,6 +1057,7 @@ private:
 #endif
   {
     RWSLDoutEntering(dc::notice, "rdlock_blocked(" << get_counters(state) << ")");
+    THREADSAFE_TRACE(rdlock_blocked, this);
     do
     {
       RWSLDout(dc::notice, "Top of do/while loop.");
@@ -753,6 +1067,22 @@ private:
 
       // Next we're going to wait until m_state becomes positive again.
       bool read_locked = false;
+      park(parked_reader);
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+      for (;;)
+      {
+        // Read the wakeup word before testing m_state, see do_transition.
+        uint32_t wakeup = m_readers_wakeup.load(std::memory_order::acquire);
+        int64_t state = 0; // If m_state is in the "unlocked" state (0), then replace it with one_rdlock (1).
+        read_locked = m_state.compare_exchange_weak(state, one_rdlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
+        RWSLDout(dc::notice, "compare_exchange_weak(0, 1, ...) = " << read_locked << " (state was " << get_counters(state) << ")");
+        // If V is still negative, then m_readers_wakeup is guaranteed to be incremented once writer_present becomes false,
+        // because we are parked.
+        if (read_locked || !writer_present(state))
+          break;
+        m_readers_wakeup.wait(wakeup, std::memory_order::relaxed);
+      }
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
       {
         std::unique_lock<mutex_t> lk(m_readers_cv_mutex);
         TPY;
@@ -760,14 +1090,14 @@ private:
         m_readers_cv.wait(lk, [this, &read_locked](){
           RWSLDout(dc::notice, "Inside m_readers_cv.wait()'s lambda; m_readers_cv_mutex is locked.");
           int64_t state = 0; // If m_state is in the "unlocked" state (0), then replace it with one_rdlock (1).
-          read_locked = m_state.compare_exchange_weak(state, one_rdlock, std::memory_order::relaxed, std::memory_order::relaxed);
+          read_locked = m_state.compare_exchange_weak(state, one_rdlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
           RWSLDout(dc::notice|continued_cf, "compare_exchange_weak(0, 1, ...) = " << read_locked << "... ");
           TPY;
           // If this returned true, then m_state was 0 and is now 1,
           // which means we successfully obtained a read lock.
           //
           // If it returned false and at the moment V is negative then we are still write locked
-          // and it is safe to enter wait() again because we have the lock on m_readers_cv_mutex
+          // and it is safe to enter wait() again because we are parked and have the lock on m_readers_cv_mutex
           // and therefore the condition variable is guaranteed to be notified again.
 #if DEBUG_RWSPINLOCK
           if (read_locked)
@@ -776,8 +1106,8 @@ private:
             RWSLDout(dc::finish, "state was " << get_counters(state));
 #endif
           // In other words: since the following returns false when there were writers present,
-          // we must have m_readers_cv_mutex locked whenever we do a transition that causes
-          // writer_present to become false - and do a notify_all after that.
+          // we must lock m_readers_cv_mutex after every transition that causes writer_present
+          // to become false (if any reader is parked) - and do a notify_all after that.
           RWSLDout(dc::notice|flush_cf, "Returning " << std::boolalpha << (read_locked || !writer_present(state)) << "; unlocking m_readers_cv_mutex...");
           bool exit_wait = read_locked || !writer_present(state);
 #ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
@@ -789,6 +1119,8 @@ private:
         RWSLDout(dc::notice, "Left m_readers_cv.wait() with read_locked = " << read_locked << "; m_readers_cv_mutex is locked. Unlocking it...");
       }
       TPY; // Because we left the scope of the std::unique_lock.
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+      unpark(parked_reader);
       // If read_locked was set, then we effectively added one_rdlock to m_state and we're done.
       if (read_locked)
         break;
@@ -801,6 +1133,8 @@ private:
   void wrlock()
   {
     RWSLDoutEntering(dc::notice, "wrlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_lock()))
+      return;
     // Taking a write lock should succeed only when no other thread has a read-lock or a write-lock.
     //
     // We also fail when nobody has a write-lock but there are (other) threads waiting on a write lock;
@@ -812,6 +1146,7 @@ private:
       return; // Success.
     }
 
+    THREADSAFE_TRACE(wrlock_blocked, this);
     do
     {
       // Transition into `waiting_writer`.
@@ -823,15 +1158,10 @@ private:
       // Note that because this only reads, without trying to write anything -- because of the widespread use
       // of MESI caching protocols -- this should cause the cache line for the lock to become "Shared" with no bus
       // traffic while the CPU waits for the lock (on architectures with a cache per CPU).
-      // Nevertheless, we add a call to cpu_relax() in the loop because that is common practise and highly
+      // Nevertheless, we add calls to cpu_relax() in the loop because that is common practise and highly
       // recommended anyway (by the intel user manual) for performance reasons.
-      RWSLDout(dc::notice|continued_cf|flush_cf, "spinning... ");
-      while (reader_present(state = m_state.load(std::memory_order::relaxed)))
-      {
-        cpu_relax();
-        TPB;
-      }
-      RWSLDout(dc::finish, "done (state = " << get_counters(state) << ")");
+      // If this takes too long, the thread is parked until the last reader left.
+      state = wait_for_readers(0);
 
       // Even though a call to rdlock() might still shortly increment R, this is no longer
       // our concern: they will fail and subtract 1 again.
@@ -848,6 +1178,21 @@ private:
 
       // Note that m_writers_cv is notified each time W or C is decremented.
       bool write_locked = false;
+      park(parked_writer);
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+      for (;;)
+      {
+        // Read the wakeup word before testing m_state, see do_transition.
+        uint32_t wakeup = m_writers_wakeup.load(std::memory_order::acquire);
+        state &= V_mask;        // Demand C = W = R = 0.
+        write_locked = m_state.compare_exchange_weak(state, state + finalize_wrlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
+        RWSLDout(dc::notice, "compare_exchange_weak(..., " << get_counters(state + finalize_wrlock) << ", ...) = " << write_locked << " (state is " << get_counters(state) << ")");
+        // If converting or actual writers are still present, then m_writers_wakeup is guaranteed to be incremented once that changes.
+        if (write_locked || !converting_or_actual_writer_present(state))
+          break;
+        m_writers_wakeup.wait(wakeup, std::memory_order::relaxed);
+      }
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
       {
         std::unique_lock<mutex_t> lk(m_writers_cv_mutex);
         TPY;
@@ -855,14 +1200,14 @@ private:
         m_writers_cv.wait(lk, [this, state, &write_locked]() mutable {
           RWSLDout(dc::notice, "Inside m_writers_cv.wait()'s lambda; m_writers_cv_mutex is locked.");
           state &= V_mask;        // Demand C = W = R = 0.
-          write_locked = m_state.compare_exchange_weak(state, state + finalize_wrlock, std::memory_order::relaxed, std::memory_order::relaxed);
+          write_locked = m_state.compare_exchange_weak(state, state + finalize_wrlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
           RWSLDout(dc::notice|continued_cf, "compare_exchange_weak(" << get_counters(state) << ", " << get_counters(state + finalize_wrlock) << ", ...) = " << write_locked << "... ");
           TPY;
           // If this returned true, then m_state was state (C == W == R == 0) and is now state + finalize_wrlock,
           // which means we successfully obtained a write lock.
           //
           // If it returned false and at the moment W or C are larger than zero, then it is
-          // safe to enter wait() again because we have the lock on m_writers_cv_mutex
+          // safe to enter wait() again because we are parked and have the lock on m_writers_cv_mutex
           // and therefore it is guaranteed that the condition variable will be notified again when
           // either changes towards zero.
 #if DEBUG_RWSPINLOCK
@@ -872,8 +1217,8 @@ private:
             RWSLDout(dc::finish, "state was " << get_counters(state));
 #endif
           // In other words: since the following returns false when there were converting/actual writers present,
-          // we must have m_writers_cv_mutex locked whenever we do a transition that causes
-          // converting_or_actual_writer_present to become false - and do a notify_one after that.
+          // we must lock m_writers_cv_mutex after every transition that causes converting_or_actual_writer_present
+          // to become false (if any writer is parked) - and do a notify_one after that.
           RWSLDout(dc::notice|flush_cf, "Returning " << std::boolalpha << (write_locked || !converting_or_actual_writer_present(state)) << "; unlocking m_writers_cv_mutex...");
           bool exit_wait = write_locked || !converting_or_actual_writer_present(state);
 #ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
@@ -885,6 +1230,8 @@ private:
         RWSLDout(dc::notice, "Left m_writers_cv.wait() with write_locked = " << write_locked << "; m_writers_cv_mutex is locked. Unlocking it...");
       }
       TPY; // Because we left the scope of the std::unique_lock.
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+      unpark(parked_writer);
       // If write_locked was set, then we effectively added one_wrlock to m_state and we're done.
       if (write_locked)
         break;
@@ -902,6 +1249,8 @@ private:
   void rd2wrlock()
   {
     RWSLDoutEntering(dc::notice, "rd2wrlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::active()))
+      return;
     int64_t state;
 
     // Converting a read- to write-lock should only immediately succeed if
@@ -915,7 +1264,8 @@ private:
     }
 
     // If another thread tried to convert their read-lock into a write-lock at the same time, we have a dead-lock and must throw an exception.
-    if (converting_writer_present(state))
+    // The same holds when another thread has the upgradable read-lock, because that one is not allowed to throw (see urd2wrlock).
+    if (converting_writer_present(state) || upgradable_reader_present())
     {
       // Revert what we just did.
       do_transition<-one_rd2wrlock>();
@@ -923,18 +1273,111 @@ private:
       throw std::exception();
     }
 
+    finish_rd2wrlock(state);
+  }
+
+  // The upgradable read-lock. Only one thread at a time can have it, but it coexists with normal read-locks.
+  void urdlock()
+  {
+    RWSLDoutEntering(dc::notice, "urdlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_lock()))
+      return;
+    uint32_t upgradable = upgradable_free;
+    if (AI_UNLIKELY(!m_upgradable.compare_exchange_strong(upgradable, upgradable_locked, std::memory_order::acquire, std::memory_order::relaxed)))
+    {
+      // Another thread has the upgradable read-lock. Mark it contended, so that urdunlock wakes us up.
+      while (m_upgradable.exchange(upgradable_contended, std::memory_order::acquire) != upgradable_free)
+        m_upgradable.wait(upgradable_contended, std::memory_order::relaxed);
+    }
+    // Pairs with the fence in upgradable_reader_present: either a converting thread sees m_upgradable,
+    // or the rdlock below sees its converting writer (and blocks until that is done).
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+    rdlock();
+  }
+
+  void urdunlock()
+  {
+    RWSLDoutEntering(dc::notice, "urdunlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_unlock()))
+      return;
+    rdunlock();
+    if (AI_UNLIKELY(m_upgradable.exchange(upgradable_free, std::memory_order::release) == upgradable_contended))
+      m_upgradable.notify_all();
+  }
+
+  // Convert the upgradable read-lock of this thread into a write-lock; this never throws. Use wr2rdlock to convert it back.
+  void urd2wrlock()
+  {
+    RWSLDoutEntering(dc::notice, "urd2wrlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::active()))
+      return;
+    int64_t state = m_state.load(std::memory_order::relaxed);
+    for (;;)
+    {
+      // Any other converting writer sees m_upgradable and reverts its increment of C immediately.
+      if (AI_UNLIKELY(converting_writer_present(state)))
+      {
+        cpu_relax();
+        state = m_state.load(std::memory_order::relaxed);
+        continue;
+      }
+      if (m_state.compare_exchange_weak(state, state + one_rd2wrlock, std::memory_order::relaxed, std::memory_order::relaxed))
+        break;
+    }
+    finish_rd2wrlock(state);
+  }
+
+ private:
+  bool upgradable_reader_present() const
+  {
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+    return m_upgradable.load(std::memory_order::relaxed) != upgradable_free;
+  }
+
+  // The part of rd2wrlock after it successfully added one_rd2wrlock to m_state, which resulted in state.
+  void finish_rd2wrlock(int64_t state)
+  {
     // failed_rd2wrlock is a no-op and not necessary (otherwise it would be done here).
     TPP;
 
-    // From now on no new reader or writer will succeed. Begin with spinning until all, other, current readers are gone.
-    RWSLDout(dc::notice|continued_cf|flush_cf, "spinning... ");
-    while (other_readers_present(state = m_state.load(std::memory_order::relaxed)))
+    // From now on no new reader or writer will succeed. Begin with spinning until all, other, current readers are gone
+    // (or parking, if that takes too long).
+    state = wait_for_readers(1);
+
+    park(parked_writer);
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    // Finally, wait until a possible actual writer released their write-lock.
+    for (;;)
     {
-      cpu_relax();
-      TPB;
+      // Read the wakeup word before testing m_state, see do_transition.
+      uint32_t wakeup = m_writers_wakeup.load(std::memory_order::acquire);
+      bool write_locked;
+      do
+      {
+        state &= ~W_mask;       // Demand W = 0.
+        // Trying to remove a reader and converting writer that aren't both there!
+        // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
+        ASSERT(((state + successful_rd2wrlock) & sign_bits_rwc) == 0);
+        write_locked = m_state.compare_exchange_weak(state, state + successful_rd2wrlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
+        RWSLDout(dc::notice, "compare_exchange_weak(..., " << get_counters(state + successful_rd2wrlock) << ", ...) = " << write_locked << " (state is " << get_counters(state) << ")");
+        // This simulated a do_transition<successful_rd2wrlock>() which requires a notify_all if C became zero.
+        if (write_locked && !converting_writer_present(state + successful_rd2wrlock))
+        {
+          // Wake up all threads that are potentially waiting in rd2wryield().
+          m_writers_wakeup.fetch_add(1, std::memory_order::release);
+          m_writers_wakeup.notify_all();
+        }
+        // It also removed our read-lock.
+        if (write_locked)
+          readers_left(state, state + successful_rd2wrlock);
+      }
+      while (!write_locked && !actual_writer_present(state)); // Only exit this loop if we succeeded to get the write-lock, or when there are no actual writers present.
+      if (write_locked)
+        break;
+      // An actual writer is present; it will increment and notify m_writers_wakeup when it leaves.
+      m_writers_wakeup.wait(wakeup, std::memory_order::relaxed);
     }
-    RWSLDout(dc::finish, "done (state = " << get_counters(state) << ")");
-
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
     {
       std::unique_lock<mutex_t> lk(m_writers_cv_mutex);
       TPY;
@@ -951,7 +1394,7 @@ private:
           // Trying to remove a reader and converting writer that aren't both there!
           // Do not call rdunlock or rd2wrlock without having a read-lock; nor call wrunlock or wr2rdlock without having a write-lock.
           ASSERT(((state + successful_rd2wrlock) & sign_bits_rwc) == 0);
-          write_locked = m_state.compare_exchange_weak(state, state + successful_rd2wrlock, std::memory_order::relaxed, std::memory_order::relaxed);
+          write_locked = m_state.compare_exchange_weak(state, state + successful_rd2wrlock, std::memory_order::seq_cst, std::memory_order::seq_cst);
           RWSLDout(dc::notice|continued_cf, "compare_exchange_weak(" << get_counters(state) << ", " << get_counters(state + successful_rd2wrlock) << ", ...) = " << write_locked << "... ");
 #if DEBUG_RWSPINLOCK
           if (write_locked)
@@ -968,6 +1411,8 @@ private:
               // Wake up all threads that are potentially waiting in rd2wryield().
               m_writers_cv.notify_all();
             }
+            // It also removed our read-lock.
+            readers_left(state, state + successful_rd2wrlock);
           }
         }
         while (!write_locked && !actual_writer_present(state)); // Only exit this loop if we succeeded to get the write-lock, or when there are no actual writers present.
@@ -975,8 +1420,8 @@ private:
         // Here, either `write_locked` is true and we succeeded (and will leave this function), or
         // actual_writer_present(state) is true. In that case it is safe to return false and continue
         // to wait for m_writers_cv because that actual writer will call notify_one.
-        // Of course that means, again, that we must have m_writers_cv_mutex locked whenever we do a
-        // transition that causes actual_writer_present to become false - and do a notify_one after that.
+        // Of course that means, again, that we must lock m_writers_cv_mutex after every transition
+        // that causes actual_writer_present to become false - and do a notify_one after that.
         RWSLDout(dc::notice|flush_cf, "Returning " << std::boolalpha << write_locked << "; unlocking m_writers_cv_mutex...");
         bool exit_wait = write_locked;
 #ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
@@ -988,16 +1433,43 @@ private:
       RWSLDout(dc::notice, "Left m_writers_cv.wait(); m_writers_cv_mutex is locked. Unlocking it...");
     }
     TPY; // Because we left the scope of the std::unique_lock.
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+    unpark(parked_writer);
     RWSLDout(dc::notice, "Leaving rd2wrlock()");
   }
 
+ public:
   void rd2wryield()
   {
     RWSLDoutEntering(dc::notice, "rd2wryield()");
 #ifndef DEBUG_RWSPINLOCK_THREADPERMUTER
     std::this_thread::yield();
 #endif
+    // If rd2wrlock threw because of an upgradable reader, wait until that released its lock.
+    if (upgradable_reader_present())
+    {
+      uint32_t upgradable = m_upgradable.load(std::memory_order::acquire);
+      while (upgradable != upgradable_free)
+      {
+        // Mark it contended, so that urdunlock wakes us up.
+        if (upgradable == upgradable_contended ||
+            m_upgradable.compare_exchange_weak(upgradable, upgradable_contended, std::memory_order::relaxed, std::memory_order::relaxed))
+          m_upgradable.wait(upgradable_contended, std::memory_order::relaxed);
+        upgradable = m_upgradable.load(std::memory_order::acquire);
+      }
+    }
     // Wait until C became zero again.
+    park(parked_writer);
+#if RWSPINLOCK_USE_ATOMIC_WAIT
+    for (;;)
+    {
+      // Read the wakeup word before testing m_state, see do_transition.
+      uint32_t wakeup = m_writers_wakeup.load(std::memory_order::acquire);
+      if (!converting_writer_present(m_state.load(std::memory_order::seq_cst)))
+        break;
+      m_writers_wakeup.wait(wakeup, std::memory_order::relaxed);
+    }
+#else // RWSPINLOCK_USE_ATOMIC_WAIT
     {
       std::unique_lock<mutex_t> lk(m_writers_cv_mutex);
       TPY;
@@ -1006,10 +1478,10 @@ private:
         RWSLDout(dc::notice, "Inside m_writers_cv.wait()'s lambda; m_writers_cv_mutex is locked.");
 #if DEBUG_RWSPINLOCK
         int64_t state;
-        bool leave_rd2wryield = !converting_writer_present(state = m_state.load(std::memory_order::relaxed));
+        bool leave_rd2wryield = !converting_writer_present(state = m_state.load(std::memory_order::seq_cst));
         RWSLDout(dc::notice, "converting_writer_present(" << std::hex << std::setfill('0') << std::setw(16) << state << std::dec << ") = " << std::boolalpha << !leave_rd2wryield);
 #else
-        bool leave_rd2wryield = !converting_writer_present(m_state.load(std::memory_order::relaxed));
+        bool leave_rd2wryield = !converting_writer_present(m_state.load(std::memory_order::seq_cst));
 #endif
         bool exit_wait = leave_rd2wryield;
 #ifdef DEBUG_RWSPINLOCK_THREADPERMUTER
@@ -1017,25 +1489,106 @@ private:
           TPP;    // For the unlock of m_writers_cv_mutex.
 #endif
         // Since this returns false when there were converting writers present,
-        // we must have m_writers_cv_mutex locked whenever we do a transition that causes
+        // we must lock m_writers_cv_mutex after every transition that causes
         // converting_writer_present to become false - and do a notify_all after that.
         return exit_wait;
       });
     }
     TPY; // Because we left the scope of the std::unique_lock.
+#endif // RWSPINLOCK_USE_ATOMIC_WAIT
+    unpark(parked_writer);
   }
 
   void wrunlock()
   {
     RWSLDoutEntering(dc::notice, "wrunlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_unlock()))
+      return;
     do_transition<one_wrunlock>();
   }
 
   void wr2rdlock()
   {
     RWSLDoutEntering(dc::notice, "wr2rdlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::active()))
+      return;
     do_transition<one_wr2rdlock>();
   }
+
+  // Try to obtain a read-lock without blocking. Fails when a writer has the lock or is waiting for it.
+  bool try_rdlock()
+  {
+    RWSLDoutEntering(dc::notice, "try_rdlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_lock()))
+      return true;
+    int64_t state = m_state.load(std::memory_order::relaxed);
+    while (!writer_present(state))
+      if (m_state.compare_exchange_weak(state, state + one_rdlock, std::memory_order::acquire, std::memory_order::relaxed))
+        return true;
+    return false;
+  }
+
+  // Try to obtain a write-lock without blocking. Fails unless the lock is completely unlocked and nobody is waiting for it.
+  bool try_wrlock()
+  {
+    RWSLDoutEntering(dc::notice, "try_wrlock()");
+    if (AI_UNLIKELY(threadsafe::SingleThreadedPhase::elide_lock()))
+      return true;
+    int64_t unlocked = 0;
+    return m_state.compare_exchange_strong(unlocked, one_wrlock, std::memory_order::acquire, std::memory_order::relaxed);
+  }
+
+  // The timed variants poll try_rdlock and try_wrlock respectively: std::atomic<>::wait can't time out.
+  // Since the waiting thread is not registered as a waiting writer, a timed wrlock does not stop new readers.
+  template<typename Clock, typename Duration>
+  bool try_rdlock_until(std::chrono::time_point<Clock, Duration> const& deadline)
+  {
+    return poll_until(deadline, [this](){ return try_rdlock(); });
+  }
+
+  template<typename Clock, typename Duration>
+  bool try_wrlock_until(std::chrono::time_point<Clock, Duration> const& deadline)
+  {
+    return poll_until(deadline, [this](){ return try_wrlock(); });
+  }
+
+  template<typename Rep, typename Period>
+  bool try_rdlock_for(std::chrono::duration<Rep, Period> const& timeout)
+  {
+    return try_rdlock_until(std::chrono::steady_clock::now() + timeout);
+  }
+
+  template<typename Rep, typename Period>
+  bool try_wrlock_for(std::chrono::duration<Rep, Period> const& timeout)
+  {
+    return try_wrlock_until(std::chrono::steady_clock::now() + timeout);
+  }
+
+ private:
+  // Call try_lock until it succeeds or deadline passed. Spin with an exponential backoff first,
+  // then sleep in steps of at most max_poll_interval.
+  static constexpr std::chrono::microseconds max_poll_interval{50};
+
+  template<typename Clock, typename Duration, typename TryLock>
+  static bool poll_until(std::chrono::time_point<Clock, Duration> const& deadline, TryLock try_lock)
+  {
+    uint32_t backoff = 1;
+    while (!try_lock())
+    {
+      auto const now = Clock::now();
+      if (now >= deadline)
+        return false;
+      if (backoff < max_backoff)
+      {
+        for (uint32_t i = 0; i < backoff; ++i)
+          cpu_relax();
+        backoff <<= 1;
+      }
+      else
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(deadline - now, max_poll_interval));
+    }
+    return true;
+  }
 };
 
 #if DEBUG_RWSPINLOCK
@@ -1151,10 +1704,14 @@ struct AIReadWriteSpinLock_static_assert : AIReadWriteSpinLock
   static_assert(test_removes_converting_or_actual_writer(), "removes_converting_or_actual_writer is broken!");
   static_assert(test_removes_writer(), "removes_writer is broken!");
   static_assert(test_removes_converting_writer(), "removes_converting_writer is broken!");
+  static_assert(test_removes_actual_writer(), "removes_actual_writer is broken!");
+  static_assert(test_wake_up_required(), "wake_up_required is broken!");
 #else
   static void run_test_removes_converting_or_actual_writer() { test_removes_converting_or_actual_writer(); }
   static void run_test_removes_writer() { test_removes_writer(); }
   static void run_test_removes_converting_writer() { test_removes_converting_writer(); }
+  static void run_test_removes_actual_writer() { test_removes_actual_writer(); }
+  static void run_test_wake_up_required() { test_wake_up_required(); }
 #endif
 };
 
@@ -1167,6 +1724,8 @@ int main()
   AIReadWriteSpinLock_static_assert::run_test_removes_converting_or_actual_writer();
   AIReadWriteSpinLock_static_assert::run_test_removes_writer();
   AIReadWriteSpinLock_static_assert::run_test_removes_converting_writer();
+  AIReadWriteSpinLock_static_assert::run_test_removes_actual_writer();
+  AIReadWriteSpinLock_static_assert::run_test_wake_up_required();
 }
 #endif
 
@@ -0,0 +1,113 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AISeqLock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+
+// A sequence lock.
+//
+// The sequence is even while the protected data is not being written to, and odd while a writer has the lock.
+// Readers never write to the cache line of the lock: they copy the data and retry when the sequence changed
+// in the meantime. Writers exclude each other by making the sequence odd.
+//
+// This is the mutex used by threadsafe::policy::SeqLock; it can only protect trivially copyable data.
+class AISeqLock
+{
+ private:
+  std::atomic<uint32_t> m_sequence;
+
+ public:
+  AISeqLock() : m_sequence(0) { }
+
+  // Copy size bytes from src to dst, where src is protected by this lock.
+  // Returns the (even) sequence number that the copy corresponds with.
+  uint32_t read(void* dst, void const* src, size_t size) const
+  {
+    for (;;)
+    {
+      uint32_t sequence = m_sequence.load(std::memory_order::acquire);
+      if (AI_UNLIKELY(sequence & 1))
+      {
+        cpu_relax();    // A writer is busy.
+        continue;
+      }
+      // This copy races with a possible writer, but the result is thrown away in that case.
+      std::memcpy(dst, src, size);
+      // Stop the loads of the copy from being reordered with the load of the sequence below.
+      std::atomic_thread_fence(std::memory_order::acquire);
+      if (AI_LIKELY(m_sequence.load(std::memory_order::relaxed) == sequence))
+        return sequence;
+    }
+  }
+
+  // Obtain the write lock. Returns the (odd) sequence number while the lock is held.
+  uint32_t wrlock()
+  {
+    uint32_t sequence = m_sequence.load(std::memory_order::relaxed);
+    for (;;)
+    {
+      if (AI_LIKELY(!(sequence & 1)) &&
+          m_sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order::acquire, std::memory_order::relaxed))
+        break;
+      if ((sequence & 1))
+      {
+        cpu_relax();    // Another writer is busy.
+        sequence = m_sequence.load(std::memory_order::relaxed);
+      }
+    }
+    // Stop the stores to the protected data from being reordered with the store of the odd sequence.
+    std::atomic_thread_fence(std::memory_order::release);
+    return sequence + 1;
+  }
+
+  // Obtain the write lock, but only if the sequence number is still `sequence` (as returned by read).
+  // Returns false if the data was changed since the copy was made (or a writer is busy).
+  bool try_wrlock(uint32_t sequence)
+  {
+    if (!m_sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order::acquire, std::memory_order::relaxed))
+      return false;
+    std::atomic_thread_fence(std::memory_order::release);
+    return true;
+  }
+
+  void wrunlock()
+  {
+    m_sequence.fetch_add(1, std::memory_order::release);
+  }
+
+  // Called after try_wrlock failed and the (now stale) copy was destroyed.
+  void rd2wryield()
+  {
+    std::this_thread::yield();
+  }
+};
@@ -0,0 +1,212 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AIShardedReadWriteLock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <array>
+#include <cstdint>
+
+// A read/write lock for objects that are read very often, by many threads, and only rarely written.
+//
+// Each thread is assigned one of `number_of_slots` reader slots, each on its own cache line;
+// a read lock only touches the slot of the calling thread and (read-only) the cache line
+// of m_writer, so that readers running on different cores do not bounce a shared cache line
+// between them. The price is paid by the writers, that have to scan all slots, and by
+// the memory footprint (number_of_slots cache lines per lock), so only use this for hot
+// objects that are predominantly read.
+//
+// This class has the same interface as AIReadWriteMutex and AIReadWriteSpinLock and
+// can be used with threadsafe::policy::ReadWrite unmodified, for example:
+//
+//   using routing_table_t = threadsafe::Unlocked<RoutingTable, threadsafe::policy::ReadWrite<AIShardedReadWriteLock>>;
+//
+// Writers are preferred over new readers, and a thread that converts its read lock
+// into a write lock (rd2wrlock) is preferred over writers.
+//
+// Note that rdunlock must be called by the same thread that called rdlock (which is
+// the case for ConstReadAccess / ReadAccess that are used the normal way, and is also
+// a requirement of std::shared_mutex), and that read locks are not recursive when
+// a writer is waiting (just like with the other read/write locks).
+class AIShardedReadWriteLock
+{
+ public:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int number_of_slots = 64;
+
+ private:
+  // The bits of m_writer.
+  static constexpr uint32_t writer = 1;       // Set by wrlock, while waiting for the readers to leave and while holding the write lock.
+  static constexpr uint32_t converter = 2;    // Set by rd2wrlock, while waiting for the other readers to leave and while holding the write lock.
+
+  struct alignas(cache_line_size) Slot
+  {
+    std::atomic<int> m_readers;               // The number of read locks held by the threads that use this slot.
+    Slot() : m_readers(0) { }
+  };
+
+  std::array<Slot, number_of_slots> m_slots;
+  alignas(cache_line_size) std::atomic<uint32_t> m_writer;     // Non-zero while new readers must wait.
+
+  inline static std::atomic<unsigned int> s_next_slot;
+
+  // Return the slot that is used by the current thread.
+  // Slots are handed out round-robin, so that the first number_of_slots threads each have their own slot.
+  Slot& slot()
+  {
+    static thread_local unsigned int const slot_index = s_next_slot.fetch_add(1, std::memory_order::relaxed) % number_of_slots;
+    return m_slots[slot_index];
+  }
+
+  // Spin until all read locks, other than the one counted in `own` (if not nullptr), have been released.
+  // If `own` is nullptr (called from wrlock) then give up and return false as soon as a converter shows up.
+  bool wait_for_readers(Slot const* own)
+  {
+    // New readers are blocked by a non-zero m_writer; a reader that increments its slot
+    // after we set a bit in m_writer will see that bit (both are seq_cst) and undo its increment.
+    // Hence, once a slot was observed to be "empty" it will only be non-empty again transiently.
+    for (Slot const& s : m_slots)
+    {
+      int const expected = &s == own ? 1 : 0;
+      while (s.m_readers.load(std::memory_order::seq_cst) != expected)
+      {
+        if (!own && (m_writer.load(std::memory_order::relaxed) & converter))
+          return false;
+        cpu_relax();
+      }
+    }
+    return true;
+  }
+
+  void notify_waiters()
+  {
+    m_writer.notify_all();
+  }
+
+ public:
+  AIShardedReadWriteLock() : m_writer(0) { }
+
+  void rdlock()
+  {
+    std::atomic<int>& readers = slot().m_readers;
+    for (;;)
+    {
+      readers.fetch_add(1, std::memory_order::seq_cst);
+      uint32_t state = m_writer.load(std::memory_order::seq_cst);
+      if (AI_LIKELY(state == 0))
+        return;
+      // A writer is waiting, active or a reader is converting to a writer. Undo our increment and wait.
+      readers.fetch_sub(1, std::memory_order::relaxed);
+      do
+      {
+        m_writer.wait(state, std::memory_order::relaxed);
+        state = m_writer.load(std::memory_order::relaxed);
+      }
+      while (state != 0);
+    }
+  }
+
+  void rdunlock()
+  {
+    slot().m_readers.fetch_sub(1, std::memory_order::release);
+  }
+
+  void wrlock()
+  {
+    // Become the only thread that has the writer bit set.
+    for (;;)
+    {
+      uint32_t state = 0;
+      if (m_writer.compare_exchange_weak(state, writer, std::memory_order::seq_cst, std::memory_order::relaxed))
+        break;
+      if (state != 0)
+        m_writer.wait(state, std::memory_order::relaxed);
+    }
+    // From here on no new readers are admitted. Wait for the existing ones to leave,
+    // but give priority to a thread that is converting its read lock into a write lock.
+    for (;;)
+    {
+      uint32_t state;
+      while (((state = m_writer.load(std::memory_order::seq_cst)) & converter))
+        m_writer.wait(state, std::memory_order::relaxed);
+      // A converter holds a read lock until it calls wrunlock, so it can't exist (anymore) when all slots are empty.
+      if (AI_LIKELY(wait_for_readers(nullptr)))
+        break;
+    }
+  }
+
+  void wrunlock()
+  {
+    if (m_writer.load(std::memory_order::relaxed) & converter)
+    {
+      // We got the write lock through rd2wrlock; release the read lock that we still held.
+      slot().m_readers.fetch_sub(1, std::memory_order::release);
+      m_writer.fetch_and(~converter, std::memory_order::release);
+    }
+    else
+      m_writer.fetch_and(~writer, std::memory_order::release);
+    notify_waiters();
+  }
+
+  void rd2wrlock()
+  {
+    if (m_writer.fetch_or(converter, std::memory_order::seq_cst) & converter)
+    {
+      // It is impossible to recover from this: two threads have a read lock
+      // and require to turn that into a write lock. The only way out of this
+      // is to throw an exception and let the caller solve the mess.
+      // Call rdunlock() and then rd2wryield() before trying again.
+      throw std::exception();
+    }
+    // Keep our own read lock until wrunlock (or wr2rdlock), which stops writers from taking over.
+    wait_for_readers(&slot());
+  }
+
+  void wr2rdlock()
+  {
+    if (m_writer.load(std::memory_order::relaxed) & converter)
+      m_writer.fetch_and(~converter, std::memory_order::release);  // We still have our read lock.
+    else
+    {
+      slot().m_readers.fetch_add(1, std::memory_order::relaxed);   // Become a reader before we let anyone else in.
+      m_writer.fetch_and(~writer, std::memory_order::release);
+    }
+    notify_waiters();
+  }
+
+  void rd2wryield()
+  {
+    std::this_thread::yield();
+    uint32_t state;
+    while (((state = m_writer.load(std::memory_order::acquire)) & converter))
+      m_writer.wait(state, std::memory_order::relaxed);
+  }
+};
@@ -0,0 +1,89 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Implementation of AISnapshotLock.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "AIRCULock.h"
+#include "utils/AIRefCount.h"
+
+// The "mutex" of threadsafe::policy::Snapshot.
+//
+// AISnapshotLock keeps a reference to the current version (snapshot) of the protected object,
+// which is reference counted with AIRefCount. Readers obtain a reference of their own to the
+// current version (see acquire) and then keep that for as long as they like, without holding
+// any lock. A snapshot is deleted when the last reference to it is released.
+//
+// Between loading the current version and incrementing its reference count, a reader must
+// stop writers from releasing the last reference to that version; it does that by pinning the
+// version with an AIRCULock, for just those two instructions. Hence publish (which waits for
+// those readers) never waits for a thread that holds a snapshot, and a thread may write to
+// the object while holding a snapshot of it itself.
+//
+// Writers are serialized by the mutex of the AIRCULock.
+class AISnapshotLock
+{
+ private:
+  AIRCULock m_rcu_lock;
+
+  static void release(void* version)
+  {
+    intrusive_ptr_release(static_cast<AIRefCount const*>(version));
+  }
+
+ public:
+  // Return a new reference to the current version, or nullptr if nothing was published yet.
+  AIRefCount const* acquire()
+  {
+    std::atomic<int>* counter;
+    AIRefCount const* version = static_cast<AIRefCount const*>(m_rcu_lock.rdlock(counter));
+    if (version)
+      intrusive_ptr_add_ref(version);
+    m_rcu_lock.rdunlock(counter);
+    return version;
+  }
+
+  void wrlock() { m_rcu_lock.wrlock(); }
+  bool try_wrlock() { return m_rcu_lock.try_wrlock(); }
+  void wrunlock() { m_rcu_lock.wrunlock(); }
+
+  // The current version, or nullptr if nothing was published yet. Only call this while holding the write lock.
+  AIRefCount const* current() const { return static_cast<AIRefCount const*>(m_rcu_lock.current()); }
+
+  // Make version the current version. Only call this while holding the write lock.
+  // This adds a reference to version and releases the reference to the previous version.
+  void publish(AIRefCount const* version)
+  {
+    intrusive_ptr_add_ref(version);
+    void* previous = m_rcu_lock.publish(const_cast<AIRefCount*>(version), &release);
+    if (previous)
+      release(previous);
+  }
+
+  // Called after a conversion from read to write access failed.
+  // Wait until the writer that caused the failure (if any) is done.
+  void rd2wryield() { m_rcu_lock.rd2wryield(); }
+};
@@ -0,0 +1,124 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of async_wat and async_rat.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "threadsafe.h"
+#include "AIAsyncReadWriteMutex.h"
+#include <coroutine>
+#include <type_traits>
+
+namespace threadsafe {
+
+// The default executor of async_wat and async_rat: resume the coroutine in the thread that released the lock.
+struct InlineExecutor
+{
+  void operator()(std::coroutine_handle<> handle) const { handle.resume(); }
+};
+
+/**
+ * @brief The awaitable that is returned by async_wat and async_rat.
+ *
+ * If the lock can be obtained without waiting then the coroutine isn't suspended at all
+ * (this uses the same single RMW as a normal wat or rat). Otherwise the coroutine is queued
+ * on the mutex and suspended; it is resumed by the thread that hands the lock over
+ * to it, by calling executor(handle).
+ */
+template<typename UNLOCKED, typename ACCESS, typename EXECUTOR>
+class AsyncAccessAwaiter : public AIAsyncReadWriteMutex::Waiter
+{
+  static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::declval<UNLOCKED&>().UNLOCKED::policy_type::mutex())>, AIAsyncReadWriteMutex>,
+      "async_wat and async_rat require threadsafe::policy::ReadWrite<AIAsyncReadWriteMutex>.");
+
+ private:
+  static constexpr bool is_writer = std::is_same_v<ACCESS, typename UNLOCKED::wat>;
+
+  UNLOCKED& m_unlocked;
+  [[no_unique_address]] EXECUTOR m_executor;
+  std::coroutine_handle<> m_handle;
+
+  AIAsyncReadWriteMutex& mutex() const { return m_unlocked.UNLOCKED::policy_type::mutex(); }
+
+  void wake() override { m_executor(m_handle); }
+
+ public:
+  AsyncAccessAwaiter(UNLOCKED& unlocked, EXECUTOR executor) : Waiter(is_writer), m_unlocked(unlocked), m_executor(std::move(executor)) { }
+
+  bool await_ready()
+  {
+    if constexpr (is_writer)
+      return mutex().try_wrlock();
+    else
+      return mutex().try_rdlock();
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle)
+  {
+    m_handle = handle;
+    // After this returns true, *this might already have been resumed (by another thread).
+    return mutex().async_lock(*this);
+  }
+
+  ACCESS await_resume() { return ACCESS(m_unlocked, std::adopt_lock); }
+};
+
+/**
+ * @brief Obtain write (or read) access to an Unlocked object from a coroutine, without blocking the thread.
+ *
+ * For example,
+ *
+ * <code>
+ * using foo_t = threadsafe::Unlocked<Foo, threadsafe::policy::ReadWrite<AIAsyncReadWriteMutex>>;
+ *
+ * task update(foo_t& foo)
+ * {
+ *   foo_t::wat foo_w = co_await threadsafe::async_wat(foo, [&scheduler](std::coroutine_handle<> h){ scheduler.post(h); });
+ *   foo_w->modify();
+ * }
+ * </code>
+ *
+ * Without an executor, the coroutine is resumed by the thread that released the lock, while
+ * that thread is still in the destructor of its access object; which is fine as long as the
+ * coroutine doesn't block and does not run for long.
+ *
+ * The normal (blocking) access types can be used for the same object at the same time.
+ */
+template<typename UNLOCKED, typename EXECUTOR = InlineExecutor>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+AsyncAccessAwaiter<UNLOCKED, typename UNLOCKED::wat, EXECUTOR> async_wat(UNLOCKED& unlocked, EXECUTOR executor = {})
+{
+  return {unlocked, std::move(executor)};
+}
+
+template<typename UNLOCKED, typename EXECUTOR = InlineExecutor>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+AsyncAccessAwaiter<UNLOCKED, typename UNLOCKED::rat, EXECUTOR> async_rat(UNLOCKED& unlocked, EXECUTOR executor = {})
+{
+  return {unlocked, std::move(executor)};
+}
+
+} // namespace threadsafe
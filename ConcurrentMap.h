@@ -0,0 +1,194 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class ConcurrentMap.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "StripedUnlocked.h"
+#include "AIReadWriteSpinLock.h"
+#include <unordered_map>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace threadsafe {
+
+// A hash map whose keys are divided over N independently locked shards.
+//
+// Each shard is an Unlocked<std::unordered_map<K, V, HASH, KEY_EQUAL>, policy::CacheLineIsolated<POLICY>>
+// (see StripedUnlocked), so that threads that use keys in different shards never wait for each other,
+// nor share a cache line. Since every shard has its own unordered_map, growing the map rehashes one
+// shard at a time, while holding the write lock of only that shard.
+//
+// The shard of a key is accessed with the normal access types, for example
+//
+//   using map_t = threadsafe::ConcurrentMap<std::string, Client>;
+//   map_t clients;
+//
+//   {
+//     map_t::wat clients_w(clients.shard(name));
+//     (*clients_w)[name].connect();
+//   }
+//
+//   {
+//     map_t::rat clients_r(clients.shard(name));
+//     auto iter = clients_r->find(name);
+//     if (iter != clients_r->end())
+//     {
+//       ...   // Convert to a write lock with map_t::wat clients_w(clients_r), as usual.
+//     }
+//   }
+//
+// Note that an access object only gives access to the keys of the same shard.
+// For simple cases there are insert_or_assign, erase, find (that returns a copy) and contains.
+//
+// The whole map can be visited with for_each_shard, or in parallel by giving each thread
+// its own range of shard indices (see shard_at). Functions that involve every shard, like
+// size(), lock the shards one by one and therefore do not return a consistent snapshot
+// when other threads are changing the map at the same time.
+template<typename K, typename V, typename POLICY = policy::ReadWrite<AIReadWriteSpinLock>, size_t N = 16,
+         typename HASH = std::hash<K>, typename KEY_EQUAL = std::equal_to<K>>
+class ConcurrentMap
+{
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using map_type = std::unordered_map<K, V, HASH, KEY_EQUAL>;
+  using shards_type = StripedUnlocked<map_type, POLICY, N>;
+  using unlocked_type = typename shards_type::unlocked_type;
+  using crat = typename unlocked_type::crat;
+  using rat = typename unlocked_type::rat;
+  using wat = typename unlocked_type::wat;
+
+  static constexpr size_t number_of_shards = N;
+
+ private:
+  shards_type m_shards;
+  [[no_unique_address]] HASH m_hash;
+
+ public:
+  ConcurrentMap() = default;
+
+  // Return the index of the shard that key belongs to.
+  size_t shard_index(K const& key) const
+  {
+    // Mix the hash, because the unordered_map of a shard uses the low bits of that same hash;
+    // those should not be (nearly) equal for all keys of one shard.
+    uint64_t hash = static_cast<uint64_t>(m_hash(key)) * 0x9E3779B97F4A7C15ULL;
+    return (hash >> 32) % N;
+  }
+
+  // Return the shard that key belongs to.
+  unlocked_type& shard(K const& key) { return m_shards[shard_index(key)]; }
+  unlocked_type const& shard(K const& key) const { return m_shards[shard_index(key)]; }
+
+  // Return shard number index (0 <= index < number_of_shards).
+  unlocked_type& shard_at(size_t index) { return m_shards[index]; }
+  unlocked_type const& shard_at(size_t index) const { return m_shards[index]; }
+
+  // Call func(unlocked_type&) for every shard, in order.
+  template<typename FUNC>
+  void for_each_shard(FUNC&& func)
+  {
+    for (unlocked_type& shard : m_shards)
+      func(shard);
+  }
+
+  template<typename FUNC>
+  void for_each_shard(FUNC&& func) const
+  {
+    for (unlocked_type const& shard : m_shards)
+      func(shard);
+  }
+
+  // Insert or replace the value of key. Returns true if key was inserted.
+  template<typename M>
+  bool insert_or_assign(K const& key, M&& obj)
+  {
+    wat shard_w(shard(key));
+    return shard_w->insert_or_assign(key, std::forward<M>(obj)).second;
+  }
+
+  // Insert key with a value constructed from args, unless key already exists. Returns true if key was inserted.
+  template<typename... ARGS>
+  bool try_emplace(K const& key, ARGS&&... args)
+  {
+    wat shard_w(shard(key));
+    return shard_w->try_emplace(key, std::forward<ARGS>(args)...).second;
+  }
+
+  // Remove key. Returns true if key existed.
+  bool erase(K const& key)
+  {
+    wat shard_w(shard(key));
+    return shard_w->erase(key) > 0;
+  }
+
+  // Return a copy of the value of key, if it exists.
+  std::optional<V> find(K const& key) const
+  {
+    crat shard_r(shard(key));
+    auto iter = shard_r->find(key);
+    if (iter == shard_r->end())
+      return std::nullopt;
+    return iter->second;
+  }
+
+  bool contains(K const& key) const
+  {
+    crat shard_r(shard(key));
+    return shard_r->find(key) != shard_r->end();
+  }
+
+  // Reserve room for count elements in total. This locks one shard at a time.
+  void reserve(size_t count)
+  {
+    for_each_shard([count](unlocked_type& shard){ wat(shard)->reserve((count + N - 1) / N); });
+  }
+
+  void clear()
+  {
+    for_each_shard([](unlocked_type& shard){ wat(shard)->clear(); });
+  }
+
+  size_t size() const
+  {
+    size_t sum = 0;
+    for_each_shard([&sum](unlocked_type const& shard){ sum += crat(shard)->size(); });
+    return sum;
+  }
+
+  bool empty() const
+  {
+    bool empty = true;
+    for_each_shard([&empty](unlocked_type const& shard){ empty = empty && crat(shard)->empty(); });
+    return empty;
+  }
+};
+
+} // namespace threadsafe
@@ -28,12 +28,15 @@
 #pragma once
 
 #include "AIMutex.h"
-#include <condition_variable>
+#include "Parking.h"
+#include <atomic>
+#include <chrono>
+#include <type_traits>
 
 namespace threadsafe
 {
 
-// Like std::condition_variable but derived from AIMutex and using that as mutex.
+// Like std::condition_variable but derived from a mutex (AIMutex or AIMCSMutex) and using that as mutex.
 //
 // Usage:
 //
@@ -47,18 +50,40 @@ namespace threadsafe
 // foo_type::wat foo_w(foo_cv);
 // foo_w.wait([&](){ return foo_w->done(); });
 //
+// or with a timeout:
+//
+// if (!foo_w.wait_for(std::chrono::milliseconds(100), [&](){ return foo_w->done(); }))
+//   timed_out();
+//
 // Notifying:
 //
 // foo_type::wat foo_w(foo_cv);
 // foo_w->set_done();
-// foo_w.notify_one();
+// foo_w.notify_one();          // Or notify_all().
+//
+// Waiting threads sleep on a futex (see Parking): a sequence number that is incremented by every notify.
+// A waiter reads the sequence number while it still has the lock; a notification that happens after
+// it released the lock therefore changes the value and the waiter can't miss it.
 //
-class ConditionVariable : public AIMutex
+// ConditionVariable uses AIMutex; use BasicConditionVariable<AIMCSMutex> for a queue-based mutex.
+template<typename MUTEX>
+class BasicConditionVariable : public MUTEX
 {
  private:
-  std::condition_variable_any m_condition_variable;
+  Parking m_parking;
+
+  // Release the lock, sleep until notified (or spuriously, or until deadline), and obtain the lock again.
+  void wait_for_notification(std::chrono::steady_clock::time_point const* deadline)
+  {
+    uint32_t sequence = m_parking.prepare_wait();
+    this->unlock();
+    m_parking.wait(sequence, deadline);
+    this->lock();
+  }
 
  public:
+  BasicConditionVariable() = default;
+
   template<typename Predicate>
   void wait(Predicate pred)
   {
@@ -71,14 +96,48 @@ class ConditionVariable : public AIMutex
     //   cv.unlock();
     //
     // For prefered usage, see above.
-    ASSERT(is_self_locked());
-    m_condition_variable.wait(*this, pred);
+    ASSERT(this->is_self_locked());
+    while (!pred())
+      wait_for_notification(nullptr);
+  }
+
+  // Like wait, but give up when deadline passed. Returns the value of pred() (false upon a time out).
+  template<typename Clock, typename Duration, typename Predicate>
+  bool wait_until(std::chrono::time_point<Clock, Duration> const& deadline, Predicate pred)
+  {
+    ASSERT(this->is_self_locked());
+    std::chrono::steady_clock::time_point steady_deadline;
+    if constexpr (std::is_same_v<Clock, std::chrono::steady_clock>)
+      steady_deadline = std::chrono::time_point_cast<std::chrono::steady_clock::duration>(deadline);
+    else
+      steady_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(deadline - Clock::now());
+    while (!pred())
+    {
+      if (std::chrono::steady_clock::now() >= steady_deadline)
+        return false;
+      wait_for_notification(&steady_deadline);
+    }
+    return true;
+  }
+
+  // Like wait, but give up after timeout. Returns the value of pred() (false upon a time out).
+  template<typename Rep, typename Period, typename Predicate>
+  bool wait_for(std::chrono::duration<Rep, Period> const& timeout, Predicate pred)
+  {
+    return wait_until(std::chrono::steady_clock::now() + timeout, pred);
   }
 
   void notify_one()
   {
-    m_condition_variable.notify_one();
+    m_parking.notify(false);
+  }
+
+  void notify_all()
+  {
+    m_parking.notify(true);
   }
 };
 
+using ConditionVariable = BasicConditionVariable<AIMutex>;
+
 } // namespace threadsafe
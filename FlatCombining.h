@@ -0,0 +1,191 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of policy::FlatCombining.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "threadsafe.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <array>
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace threadsafe {
+namespace policy {
+
+/**
+ * @brief A decorator for the ReadWrite and Primitive policies that adds flat combining.
+ *
+ * Small updates of a heavily contended object are dominated by the cost of moving the cache
+ * lines of the mutex and of the data from core to core for every wat. With flat combining a
+ * thread publishes its update, as a closure, in a publication slot; whichever thread obtains the
+ * (write) lock then executes all published updates in one batch, while the data stays in its cache,
+ * and the other threads only have to wait for the slot of their own update to be marked done.
+ *
+ * For example,
+ *
+ * <code>
+ * using stats_t = threadsafe::Unlocked<Stats, threadsafe::policy::FlatCombining<threadsafe::policy::Primitive<AIMutex>>>;
+ * stats_t stats;
+ *
+ * stats.combine([key](Stats& s){ s.increment(key); });
+ * </code>
+ *
+ * combine returns after the closure was executed (by this or by another thread) and rethrows
+ * the exception that it threw, if any. The closure is executed while holding the write lock,
+ * by an arbitrary thread, so it must not lock the same object and should not block. The normal
+ * access types can be used at the same time: combining is done while holding a normal wat.
+ *
+ * Every thread uses its own slot as long as there are no more than SLOTS threads calling
+ * combine for objects of this type (slots are handed out round-robin); a thread that finds
+ * its slot in use by another thread falls back to taking a wat itself. The slots are on their
+ * own cache line each, which makes the Unlocked object SLOTS + 1 cache lines large.
+ *
+ * This requires the try_wrlock function of the RWMUTEX of a ReadWrite policy, or the try_lock
+ * function of the MUTEX of a Primitive policy; for example AIReadWriteSpinLock or AIMutex.
+ */
+template<class POLICY, size_t SLOTS = 16>
+class FlatCombining : public POLICY
+{
+  static_assert(utils::is_specialization_of_v<POLICY, ReadWrite> || utils::is_specialization_of_v<POLICY, Primitive> ||
+      utils::is_specialization_of_v<POLICY, Instrumented>,
+      "policy::FlatCombining can only be used with the ReadWrite and Primitive (or an Instrumented) policies.");
+
+ public:
+  static constexpr bool is_flat_combining = true;
+  static constexpr size_t number_of_slots = SLOTS;
+
+ private:
+  // The states of a publication slot.
+  static constexpr uint32_t free = 0;           // Not in use.
+  static constexpr uint32_t claimed = 1;        // The owner is filling in the operation.
+  static constexpr uint32_t pending = 2;        // The operation was published and waits for a combiner.
+  static constexpr uint32_t done = 3;           // The operation was executed; the owner can pick up the result.
+
+  struct alignas(64) Slot
+  {
+    std::atomic<uint32_t> m_state{free};
+    void (*m_invoke)(void* op, void* data);     // Calls *op with the data (T&), with the type of T and the operation erased.
+    void* m_op;
+    std::exception_ptr m_exception;             // The exception that the operation threw, if any.
+  };
+
+  static constexpr int max_spin_count = 128;
+  static constexpr int max_combine_passes = 3;
+
+  std::array<Slot, SLOTS> m_slots;
+
+  inline static std::atomic<unsigned int> s_next_slot;
+
+  static Slot& local_slot(FlatCombining& self)
+  {
+    static thread_local unsigned int const slot_index = s_next_slot.fetch_add(1, std::memory_order::relaxed) % SLOTS;
+    return self.m_slots[slot_index];
+  }
+
+  // Execute all pending operations. Must be called while holding the write lock.
+  void combine_pending(void* data)
+  {
+    for (int pass = 0; pass < max_combine_passes; ++pass)
+    {
+      bool found = false;
+      for (Slot& slot : m_slots)
+      {
+        if (slot.m_state.load(std::memory_order::acquire) != pending)
+          continue;
+        try
+        {
+          slot.m_invoke(slot.m_op, data);
+        }
+        catch (...)
+        {
+          slot.m_exception = std::current_exception();
+        }
+        // After this the owner of the slot may return (and destroy the operation).
+        slot.m_state.store(done, std::memory_order::release);
+        found = true;
+      }
+      if (!found)
+        break;
+    }
+  }
+
+ public:
+  // Execute op(T&) while holding the write lock of unlocked; called by Unlocked::combine.
+  template<typename UNLOCKED, typename OP>
+  void combine(UNLOCKED& unlocked, OP& op)
+  {
+    using data_type = typename UNLOCKED::data_type;
+    Slot& slot = local_slot(*this);
+    uint32_t expected = free;
+    if (AI_UNLIKELY(!slot.m_state.compare_exchange_strong(expected, claimed, std::memory_order::acquire, std::memory_order::relaxed)))
+    {
+      // Another thread is using this slot.
+      typename UNLOCKED::wat unlocked_w(unlocked);
+      op(*unlocked_w);
+      return;
+    }
+    slot.m_invoke = [](void* op_ptr, void* data_ptr){ (*static_cast<OP*>(op_ptr))(*static_cast<data_type*>(data_ptr)); };
+    slot.m_op = const_cast<std::remove_const_t<OP>*>(&op);
+    slot.m_state.store(pending, std::memory_order::release);
+
+    // Become the combiner if the lock is free; otherwise wait a while for the current lock holder to execute op.
+    if (auto unlocked_w = try_wat(unlocked))
+      combine_pending(&**unlocked_w);
+    else
+    {
+      int spin_count = 0;
+      while (slot.m_state.load(std::memory_order::acquire) != done && ++spin_count < max_spin_count)
+        cpu_relax();
+      if (spin_count == max_spin_count)
+      {
+        // Still not done: block on the lock. Once we have it, nobody else can be executing op.
+        typename UNLOCKED::wat unlocked_w(unlocked);
+        combine_pending(&*unlocked_w);
+      }
+    }
+
+    // Our operation was executed.
+    ASSERT(slot.m_state.load(std::memory_order::relaxed) == done);
+    std::exception_ptr exception = std::move(slot.m_exception);
+    slot.m_exception = nullptr;
+    slot.m_state.store(free, std::memory_order::release);
+    if (AI_UNLIKELY(exception))
+      std::rethrow_exception(exception);
+  }
+};
+
+} // namespace policy
+
+template<class POLICY, size_t SLOTS> struct supports_lock_all<policy::FlatCombining<POLICY, SLOTS>> : supports_lock_all<POLICY> { };
+
+} // namespace threadsafe
@@ -0,0 +1,108 @@
+#include "sys.h"
+#include "LockStats.h"
+#include <algorithm>
+#include <mutex>
+#include <iostream>
+#include <iomanip>
+
+namespace threadsafe {
+
+namespace {
+
+// The registry of all LockStats objects.
+struct Registry
+{
+  std::mutex m_mutex;
+  LockStats* m_head = nullptr;
+};
+
+Registry& registry()
+{
+  // Never destructed, because LockStats objects with static storage duration might be destructed later.
+  static Registry* s_registry = new Registry;
+  return *s_registry;
+}
+
+} // namespace
+
+std::atomic<unsigned int> LockStats::s_next_slot;
+
+uint64_t LockStats::Totals::total_acquisitions() const
+{
+  uint64_t sum = 0;
+  for (uint64_t count : acquisitions)
+    sum += count;
+  return sum;
+}
+
+LockStats::LockStats() : m_name(nullptr), m_prev(nullptr)
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lk(r.m_mutex);
+  m_next = r.m_head;
+  if (m_next)
+    m_next->m_prev = this;
+  r.m_head = this;
+}
+
+LockStats::~LockStats()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lk(r.m_mutex);
+  if (m_prev)
+    m_prev->m_next = m_next;
+  else
+    r.m_head = m_next;
+  if (m_next)
+    m_next->m_prev = m_prev;
+}
+
+LockStats::Totals LockStats::totals() const
+{
+  Totals totals{};
+  totals.name = m_name.load(std::memory_order::relaxed);
+  for (Slot const& s : m_slots)
+  {
+    for (int type = 0; type < number_of_access_types; ++type)
+      totals.acquisitions[type] += s.m_acquisitions[type].load(std::memory_order::relaxed);
+    totals.wait_ns += s.m_wait_ns.load(std::memory_order::relaxed);
+    totals.hold_ns += s.m_hold_ns.load(std::memory_order::relaxed);
+    totals.rd2wrlock_exceptions += s.m_rd2wrlock_exceptions.load(std::memory_order::relaxed);
+    totals.rd2wryield_calls += s.m_rd2wryield_calls.load(std::memory_order::relaxed);
+  }
+  return totals;
+}
+
+//static
+std::vector<LockStats::Totals> LockStats::all()
+{
+  std::vector<Totals> result;
+  {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m_mutex);
+    for (LockStats const* stats = r.m_head; stats; stats = stats->m_next)
+      result.push_back(stats->totals());
+  }
+  std::sort(result.begin(), result.end(), [](Totals const& t1, Totals const& t2){ return t1.wait_ns > t2.wait_ns; });
+  return result;
+}
+
+//static
+void LockStats::report(std::ostream& os, size_t max_entries)
+{
+  std::vector<Totals> totals = all();
+  if (totals.size() > max_entries)
+    totals.resize(max_entries);
+  os << std::setw(12) << "wait [ms]" << std::setw(12) << "hold [ms]" <<
+    std::setw(10) << "crat" << std::setw(10) << "rat" << std::setw(10) << "urat" << std::setw(10) << "wat" << std::setw(10) << "w2rCarry" <<
+    std::setw(10) << "rd2wr exc" << std::setw(10) << "yields" << "  type\n";
+  for (Totals const& t : totals)
+    os << std::fixed << std::setprecision(3) <<
+      std::setw(12) << t.wait_ns * 1e-6 << std::setw(12) << t.hold_ns * 1e-6 <<
+      std::setw(10) << t.acquisitions[crat] << std::setw(10) << t.acquisitions[rat] <<
+      std::setw(10) << t.acquisitions[urat] << std::setw(10) << t.acquisitions[wat] << std::setw(10) << t.acquisitions[w2rCarry] <<
+      std::setw(10) << t.rd2wrlock_exceptions << std::setw(10) << t.rd2wryield_calls <<
+      "  " << (t.name ? t.name : "<unused>") << '\n';
+}
+
+} // namespace threadsafe
@@ -0,0 +1,139 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class LockStats.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+
+namespace threadsafe {
+
+// Lock contention statistics of a single object.
+//
+// This is the member of threadsafe::policy::Instrumented, that is updated by the access types
+// of Unlocked objects that use that policy. For example,
+//
+//   using foo_t = threadsafe::Unlocked<Foo, threadsafe::policy::Instrumented<threadsafe::policy::ReadWrite<AIReadWriteSpinLock>>>;
+//
+// All existing LockStats objects are registered, so that LockStats::report can list the most contended objects.
+//
+// In order to avoid adding contention of its own, the counters are spread over a few cache lines;
+// each thread only updates the counters of one of them (with relaxed atomic operations).
+class LockStats
+{
+ public:
+  // The type of the access object that obtained the lock.
+  enum access_type
+  {
+    crat,
+    rat,
+    urat,
+    wat,                // Also used when a rat or urat is converted to a wat.
+    w2rCarry,           // A wat constructed from a w2rCarry.
+    number_of_access_types
+  };
+
+  // The sums of all counters.
+  struct Totals
+  {
+    char const* name;                   // The name of the Unlocked type (or nullptr if the object was never locked).
+    std::array<uint64_t, number_of_access_types> acquisitions;
+    uint64_t wait_ns;                   // Total time spent waiting for the lock, in nanoseconds.
+    uint64_t hold_ns;                   // Total time that the lock was held, in nanoseconds.
+    uint64_t rd2wrlock_exceptions;      // The number of times that converting a rat to a wat threw.
+    uint64_t rd2wryield_calls;          // The number of calls to rd2wryield.
+
+    uint64_t total_acquisitions() const;
+  };
+
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int number_of_slots = 16;
+
+ private:
+  struct alignas(cache_line_size) Slot
+  {
+    std::array<std::atomic<uint64_t>, number_of_access_types> m_acquisitions{};
+    std::atomic<uint64_t> m_wait_ns{};
+    std::atomic<uint64_t> m_hold_ns{};
+    std::atomic<uint64_t> m_rd2wrlock_exceptions{};
+    std::atomic<uint64_t> m_rd2wryield_calls{};
+  };
+
+  std::array<Slot, number_of_slots> m_slots;
+  std::atomic<char const*> m_name;
+  // The registry is an intrusive list of all LockStats objects.
+  LockStats* m_prev;
+  LockStats* m_next;
+
+  static std::atomic<unsigned int> s_next_slot;
+
+  // Return the slot that is used by the current thread.
+  Slot& slot()
+  {
+    static thread_local unsigned int const slot_index = s_next_slot.fetch_add(1, std::memory_order::relaxed) % number_of_slots;
+    return m_slots[slot_index];
+  }
+
+ public:
+  LockStats();
+  ~LockStats();
+
+  LockStats(LockStats const&) = delete;
+  LockStats& operator=(LockStats const&) = delete;
+
+  void add_acquisition(access_type type, uint64_t wait_ns)
+  {
+    Slot& s = slot();
+    s.m_acquisitions[type].fetch_add(1, std::memory_order::relaxed);
+    s.m_wait_ns.fetch_add(wait_ns, std::memory_order::relaxed);
+  }
+
+  void add_hold(uint64_t hold_ns) { slot().m_hold_ns.fetch_add(hold_ns, std::memory_order::relaxed); }
+  void add_rd2wrlock_exception() { slot().m_rd2wrlock_exceptions.fetch_add(1, std::memory_order::relaxed); }
+  void add_rd2wryield() { slot().m_rd2wryield_calls.fetch_add(1, std::memory_order::relaxed); }
+
+  void set_name(char const* name)
+  {
+    if (!m_name.load(std::memory_order::relaxed))
+      m_name.store(name, std::memory_order::relaxed);
+  }
+
+  // Return the sum of the counters of all threads.
+  Totals totals() const;
+
+  // Return the totals of all existing LockStats objects, sorted by decreasing wait time.
+  static std::vector<Totals> all();
+
+  // Write the max_entries objects with the largest wait time to os.
+  static void report(std::ostream& os, size_t max_entries = 10);
+};
+
+} // namespace threadsafe
@@ -0,0 +1,237 @@
+#include "sys.h"
+#include "LockTrace.h"
+#include "LockStats.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <iostream>
+#include <iomanip>
+
+namespace threadsafe {
+
+// The list of the buffers of all threads.
+struct LockTrace::Registry
+{
+  std::mutex m_mutex;
+  Buffer* m_head = nullptr;
+  int m_next_thread_index = 0;
+};
+
+//static
+LockTrace::Registry& LockTrace::registry()
+{
+  // Never destructed, because threads might still record events after main() returned.
+  static Registry* s_registry = new Registry;
+  return *s_registry;
+}
+
+//static
+LockTrace::Buffer* LockTrace::register_thread()
+{
+  Buffer* b = new Buffer;
+  b->m_reserved.store(0, std::memory_order::relaxed);
+  b->m_written.store(0, std::memory_order::relaxed);
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lk(r.m_mutex);
+  b->m_thread_index = r.m_next_thread_index++;
+  b->m_next = r.m_head;
+  r.m_head = b;
+  return b;
+}
+
+namespace {
+
+struct EventCopy
+{
+  uint64_t m_time;
+  void const* m_object;
+  char const* m_name;
+  uint32_t m_info;
+
+  LockTrace::event_type type() const { return static_cast<LockTrace::event_type>(m_info & 0xff); }
+  int access() const { return m_info >> 8; }
+};
+
+char const* event_name(LockTrace::event_type type)
+{
+  switch (type)
+  {
+    case LockTrace::acquire_start:
+      return "acquire_start";
+    case LockTrace::acquire_end:
+      return "acquire_end";
+    case LockTrace::release:
+      return "release";
+    case LockTrace::rd2wrlock_exception:
+      return "rd2wrlock_exception";
+    case LockTrace::rdlock_blocked:
+      return "rdlock_blocked";
+    case LockTrace::wrlock_blocked:
+      return "wrlock_blocked";
+    case LockTrace::spinning:
+      return "spinning";
+    case LockTrace::parked:
+      return "parked";
+    case LockTrace::unparked:
+      return "unparked";
+  }
+  return "unknown";
+}
+
+char const* access_name(int access)
+{
+  static char const* const names[LockStats::number_of_access_types] = { "crat", "rat", "urat", "wat", "w2rCarry" };
+  return access >= 0 && access < LockStats::number_of_access_types ? names[access] : "?";
+}
+
+// Write s as a JSON string.
+void write_string(std::ostream& os, char const* s)
+{
+  os << '"';
+  for (; s && *s; ++s)
+  {
+    if (*s == '"' || *s == '\\')
+      os << '\\' << *s;
+    else if (static_cast<unsigned char>(*s) < 0x20)
+      os << ' ';
+    else
+      os << *s;
+  }
+  os << '"';
+}
+
+} // namespace
+
+//static
+void LockTrace::write_chrome_json(std::ostream& os)
+{
+  // Copy the events of all threads.
+  std::vector<std::pair<int, std::vector<EventCopy>>> threads;
+  {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m_mutex);
+    for (Buffer const* b = r.m_head; b; b = b->m_next)
+    {
+      uint64_t end = b->m_written.load(std::memory_order::acquire);
+      uint64_t begin = end > buffer_size ? end - buffer_size : 0;
+      std::vector<EventCopy> events;
+      events.reserve(end - begin);
+      for (uint64_t index = begin; index < end; ++index)
+      {
+        Event const& event = b->m_events[index & (buffer_size - 1)];
+        events.push_back({ event.m_time.load(std::memory_order::relaxed), event.m_object.load(std::memory_order::relaxed),
+            event.m_name.load(std::memory_order::relaxed), event.m_info.load(std::memory_order::relaxed) });
+      }
+      // Drop the events that might have been overwritten by the owner thread while we were copying them.
+      std::atomic_thread_fence(std::memory_order::acquire);
+      uint64_t reserved = b->m_reserved.load(std::memory_order::relaxed);
+      if (reserved > begin + buffer_size)
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(reserved - begin - buffer_size, events.size()));
+      threads.emplace_back(b->m_thread_index, std::move(events));
+    }
+  }
+
+  // Only acquire_end events carry the name of the Unlocked type.
+  std::unordered_map<void const*, char const*> names;
+  uint64_t epoch = UINT64_MAX;
+  uint64_t now = 0;
+  for (auto const& thread : threads)
+    for (EventCopy const& event : thread.second)
+    {
+      if (event.m_name)
+        names[event.m_object] = event.m_name;
+      epoch = std::min(epoch, event.m_time);
+      now = std::max(now, event.m_time);
+    }
+  auto name_of = [&](void const* object) -> char const* { auto it = names.find(object); return it == names.end() ? "<unknown>" : it->second; };
+  auto write_common = [&](int tid, uint64_t time, void const* object){
+    os << ",\"ts\":" << std::fixed << std::setprecision(3) << (time - epoch) * 1e-3 << ",\"pid\":1,\"tid\":" << tid <<
+      ",\"args\":{\"object\":\"" << object << "\",\"unlocked\":";
+    write_string(os, name_of(object));
+    os << "}}";
+  };
+  auto write_complete = [&](int tid, std::string const& name, uint64_t start, uint64_t end, void const* object){
+    os << ",\n{\"name\":";
+    write_string(os, name.c_str());
+    os << ",\"cat\":\"lock\",\"ph\":\"X\",\"dur\":" << std::fixed << std::setprecision(3) << (end - start) * 1e-3;
+    write_common(tid, start, object);
+  };
+
+  std::ios_base::fmtflags const flags = os.flags();
+  std::streamsize const precision = os.precision();
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"threadsafe locks\"}}";
+  for (auto const& thread : threads)
+  {
+    int const tid = thread.first;
+    os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+
+    // The locks that this thread is waiting for or holding.
+    struct Open
+    {
+      void const* m_object;
+      uint64_t m_start;
+      int m_access;                     // -1 while waiting.
+    };
+    std::vector<Open> open;
+    auto find = [&](void const* object, bool waiting){
+      return std::find_if(open.rbegin(), open.rend(), [=](Open const& o){ return o.m_object == object && (o.m_access == -1) == waiting; });
+    };
+    auto label = [&](char const* prefix, int access, void const* object){ return std::string(prefix) + access_name(access) + ' ' + name_of(object); };
+
+    for (EventCopy const& event : thread.second)
+    {
+      switch (event.type())
+      {
+        case acquire_start:
+          open.push_back({ event.m_object, event.m_time, -1 });
+          break;
+        case acquire_end:
+        {
+          auto o = find(event.m_object, true);
+          if (o != open.rend())
+          {
+            write_complete(tid, label("wait ", event.access(), event.m_object), o->m_start, event.m_time, event.m_object);
+            o->m_start = event.m_time;
+            o->m_access = event.access();
+          }
+          else  // The acquire_start event was overwritten.
+            open.push_back({ event.m_object, event.m_time, event.access() });
+          break;
+        }
+        case release:
+        {
+          auto o = find(event.m_object, false);
+          if (o != open.rend())
+          {
+            write_complete(tid, label("", o->m_access, event.m_object), o->m_start, event.m_time, event.m_object);
+            open.erase(std::next(o).base());
+          }
+          break;
+        }
+        case rd2wrlock_exception:
+        {
+          // The wait for the conversion ends here.
+          auto o = find(event.m_object, true);
+          if (o != open.rend())
+            open.erase(std::next(o).base());
+          [[fallthrough]];
+        }
+        default:
+          os << ",\n{\"name\":\"" << event_name(event.type()) << "\",\"cat\":\"lock\",\"ph\":\"i\",\"s\":\"t\"";
+          write_common(tid, event.m_time, event.m_object);
+          break;
+      }
+    }
+    // Locks that are still being waited for or held are shown up till the last event.
+    for (Open const& o : open)
+      write_complete(tid, o.m_access == -1 ? std::string("wait ") + name_of(o.m_object) : label("", o.m_access, o.m_object), o.m_start, now, o.m_object);
+  }
+  os << "\n]}\n";
+  os.flags(flags);
+  os.precision(precision);
+}
+
+} // namespace threadsafe
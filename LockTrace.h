@@ -0,0 +1,143 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class LockTrace.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+
+// Set THREADSAFE_TRACE_LOCKS to 1 (for example with the cmake option of the same name) to record
+// every lock event of the access types, and of the slow paths of AIReadWriteSpinLock, in a LockTrace.
+// When it is 0 (the default) all tracing code is compiled out.
+#ifndef THREADSAFE_TRACE_LOCKS
+#define THREADSAFE_TRACE_LOCKS 0
+#endif
+
+// The number of events that are kept per thread (must be a power of two); older events are overwritten.
+#ifndef THREADSAFE_TRACE_BUFFER_SIZE
+#define THREADSAFE_TRACE_BUFFER_SIZE 16384
+#endif
+
+#if THREADSAFE_TRACE_LOCKS
+#define THREADSAFE_TRACE(type, object) ::threadsafe::LockTrace::record(::threadsafe::LockTrace::type, object)
+#else
+#define THREADSAFE_TRACE(type, object) do { } while(0)
+#endif
+
+namespace threadsafe {
+
+// A timeline of lock events, that can be written as a Chrome trace (JSON), which can be
+// loaded in chrome://tracing or https://ui.perfetto.dev to see which thread held which
+// Unlocked object while others were waiting for it.
+//
+// Every thread writes its events into a ring buffer of its own, without locking; the buffers
+// of all threads (also those that already exited) are read by write_chrome_json, which may
+// be called at any moment (for example after a latency spike was detected). For example,
+//
+//   // Compiled with -DTHREADSAFE_TRACE_LOCKS=1.
+//   std::ofstream trace("locks.json");
+//   threadsafe::LockTrace::write_chrome_json(trace);
+//
+// Objects are identified by the address of their mutex and named after their Unlocked type.
+// The buffer of a thread is never freed, so that its events can still be written after the
+// thread exited.
+class LockTrace
+{
+ public:
+  enum event_type : uint8_t
+  {
+    acquire_start,              // An access type started to lock an object.
+    acquire_end,                // The lock was obtained.
+    release,                    // The access type released the lock.
+    rd2wrlock_exception,        // Converting a rat to a wat threw.
+    rdlock_blocked,             // AIReadWriteSpinLock: a reader has to wait for a writer.
+    wrlock_blocked,             // AIReadWriteSpinLock: a writer has to wait for other readers or writers.
+    spinning,                   // AIReadWriteSpinLock: a (converting) writer starts spinning until the readers are gone.
+    parked,                     // AIReadWriteSpinLock: the spin budget was exhausted; the writer goes to sleep.
+    unparked                    // AIReadWriteSpinLock: the writer woke up.
+  };
+
+  static constexpr size_t buffer_size = THREADSAFE_TRACE_BUFFER_SIZE;
+  static_assert((buffer_size & (buffer_size - 1)) == 0, "THREADSAFE_TRACE_BUFFER_SIZE must be a power of two.");
+
+ private:
+  // The fields are atomic because write_chrome_json reads them while the owner thread might be overwriting them.
+  struct Event
+  {
+    std::atomic<uint64_t> m_time;               // Nanoseconds since the epoch of std::chrono::steady_clock.
+    std::atomic<void const*> m_object;          // The address of the mutex.
+    std::atomic<char const*> m_name;            // The name of the Unlocked type, or nullptr.
+    std::atomic<uint32_t> m_info;               // The event_type in the lowest byte, the LockStats::access_type in the next.
+  };
+
+  // The ring buffer of a single thread.
+  struct Buffer
+  {
+    std::array<Event, buffer_size> m_events;
+    std::atomic<uint64_t> m_reserved;           // The number of events that were started to be written.
+    std::atomic<uint64_t> m_written;            // The number of events that were completely written.
+    int m_thread_index;                         // Threads are numbered in the order of their first event.
+    Buffer* m_next;                             // The list of all buffers, see register_thread.
+  };
+
+  struct Registry;
+  static Registry& registry();
+  static Buffer* register_thread();
+
+  static Buffer& buffer()
+  {
+    static thread_local Buffer* const s_buffer = register_thread();
+    return *s_buffer;
+  }
+
+ public:
+  // Add an event to the buffer of the current thread.
+  static void record(event_type type, void const* object, char const* name = nullptr, int access = 0)
+  {
+    Buffer& b = buffer();
+    uint64_t index = b.m_written.load(std::memory_order::relaxed);
+    // Mark the event that is going to be overwritten as invalid before overwriting it (see write_chrome_json).
+    b.m_reserved.store(index + 1, std::memory_order::relaxed);
+    std::atomic_thread_fence(std::memory_order::release);
+    Event& event = b.m_events[index & (buffer_size - 1)];
+    event.m_time.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order::relaxed);
+    event.m_object.store(object, std::memory_order::relaxed);
+    event.m_name.store(name, std::memory_order::relaxed);
+    event.m_info.store(type | (access << 8), std::memory_order::relaxed);
+    b.m_written.store(index + 1, std::memory_order::release);
+  }
+
+  // Write the events of all threads to os, in the Chrome trace event format.
+  // Waiting for and holding a lock are written as complete events; the other events as instant events.
+  static void write_chrome_json(std::ostream& os);
+};
+
+} // namespace threadsafe
@@ -0,0 +1,314 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class MPSCQueue.
+ *
+ * @Copyright (C) 2017  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Parking.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+
+namespace threadsafe {
+
+// A bounded, lock-free queue for any number of producer threads and one consumer thread.
+//
+// This has the same interface as SPSCQueue, except that push (and friends) may be called
+// by several threads at the same time.
+//
+// Every slot has a sequence number, that tells the producers when it is free again and the
+// consumer when it was filled (D. Vyukov's bounded MPMC queue, with a single consumer).
+// A producer claims one or more consecutive slots with a single CAS on m_tail and then fills them;
+// the consumer pops the elements in the order in which the slots were claimed, waiting (when
+// blocking, and only then) for a producer that claimed a slot but didn't finish filling it yet.
+//
+// As with SPSCQueue, only a producer that finds the queue full or the consumer that finds it
+// empty spins a little and then sleeps on a Parking.
+template<typename T, size_t CAPACITY>
+class MPSCQueue
+{
+  static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two.");
+  static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T>, "T must be nothrow move constructible.");
+
+ public:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr size_t capacity = CAPACITY;
+
+ private:
+  static constexpr size_t mask = CAPACITY - 1;
+  static constexpr int max_spin_count = 128;
+
+  struct Slot
+  {
+    // Equal to `position` when the slot is free to be filled with the element at position,
+    // and to `position + 1` once that element was stored.
+    std::atomic<size_t> m_sequence;
+    alignas(T) unsigned char m_storage[sizeof(T)];
+
+    T* data() { return std::launder(reinterpret_cast<T*>(m_storage)); }
+  };
+
+  alignas(cache_line_size) std::atomic<size_t> m_tail;  // The number of slots that were claimed by producers.
+  alignas(cache_line_size) size_t m_head;               // The number of elements that were popped (only accessed by the consumer).
+  // Only written by threads that are about to sleep.
+  alignas(cache_line_size) Parking m_not_empty;         // The consumer waits here while the queue is empty.
+  Parking m_not_full;                                   // The producers wait here while the queue is full.
+  alignas(cache_line_size) Slot m_slots[CAPACITY];
+
+  bool is_free(size_t position, std::memory_order order = std::memory_order::acquire) const
+  {
+    return m_slots[position & mask].m_sequence.load(order) == position;
+  }
+
+  bool is_filled(size_t position, std::memory_order order = std::memory_order::acquire) const
+  {
+    return m_slots[position & mask].m_sequence.load(order) == position + 1;
+  }
+
+  // Claim the free slots at the end of the queue, but no more than n. Returns the position of the first
+  // claimed slot in `tail` and the number of slots claimed. The consumer frees the slots in order, hence
+  // the free slots at the end are consecutive.
+  size_t claim(size_t& tail, size_t n)
+  {
+    tail = m_tail.load(std::memory_order::relaxed);
+    for (;;)
+    {
+      size_t count = 0;
+      while (count < n && is_free(tail + count))
+        ++count;
+      if (AI_UNLIKELY(count == 0))
+      {
+        // Full, or another producer claimed slot `tail` already and we read a stale m_tail.
+        size_t current = m_tail.load(std::memory_order::relaxed);
+        if (current == tail)
+          return 0;
+        tail = current;
+        continue;
+      }
+      if (m_tail.compare_exchange_weak(tail, tail + count, std::memory_order::relaxed, std::memory_order::relaxed))
+        return count;
+    }
+  }
+
+  // Make the claimed slot at `position` available to the consumer.
+  void publish(size_t position)
+  {
+    m_slots[position & mask].m_sequence.store(position + 1, std::memory_order::release);
+  }
+
+  // Spin for a while, then sleep on parking, until pred() returns true.
+  template<typename PRED>
+  static void block_until(Parking& parking, PRED pred)
+  {
+    for (int spin_count = 0; spin_count < max_spin_count; ++spin_count)
+    {
+      if (pred())
+        return;
+      cpu_relax();
+    }
+    parking.wait_until(pred);
+  }
+
+  void block_while_full()
+  {
+    size_t tail = m_tail.load(std::memory_order::relaxed);
+    block_until(m_not_full, [this, tail](){ return is_free(tail, std::memory_order::seq_cst) || m_tail.load(std::memory_order::relaxed) != tail; });
+  }
+
+  void block_while_empty()
+  {
+    block_until(m_not_empty, [this](){ return is_filled(m_head, std::memory_order::seq_cst); });
+  }
+
+ public:
+  MPSCQueue() : m_tail(0), m_head(0)
+  {
+    for (size_t position = 0; position < CAPACITY; ++position)
+      m_slots[position].m_sequence.store(position, std::memory_order::relaxed);
+  }
+  MPSCQueue(MPSCQueue const&) = delete;
+
+  ~MPSCQueue()
+  {
+    for (size_t head = m_head; is_filled(head, std::memory_order::relaxed); ++head)
+      m_slots[head & mask].data()->~T();
+  }
+
+  //---------------------------------------------------------------------------
+  // Producers.
+
+  // Construct an element at the end of the queue from args. Returns false if the queue is full.
+  template<typename... ARGS>
+  bool try_emplace(ARGS&&... args)
+  {
+    // A claimed slot must be published, or the consumer would wait for it forever.
+    // Therefore construct the element before claiming a slot when that can throw.
+    if constexpr (!std::is_nothrow_constructible_v<T, ARGS&&...>)
+      return try_emplace(T(std::forward<ARGS>(args)...));
+    else
+    {
+      size_t tail;
+      if (AI_UNLIKELY(claim(tail, 1) == 0))
+        return false;
+      new (m_slots[tail & mask].m_storage) T(std::forward<ARGS>(args)...);
+      publish(tail);
+      m_not_empty.notify_waiters();
+      return true;
+    }
+  }
+
+  bool try_push(T const& value) { return try_emplace(value); }
+  bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+  // Like try_emplace, but block while the queue is full.
+  template<typename... ARGS>
+  void emplace(ARGS&&... args)
+  {
+    while (AI_UNLIKELY(!try_emplace(std::forward<ARGS>(args)...)))
+      block_while_full();
+  }
+
+  void push(T const& value) { emplace(value); }
+  void push(T&& value) { emplace(std::move(value)); }
+
+  // Push the elements first, first + 1, ..., as long as there is room, but no more than n. Returns the number of elements pushed.
+  // The elements of one batch are consecutive in the queue, unless constructing T from *first can throw.
+  // Use std::make_move_iterator to move the elements into the queue.
+  template<typename ITER>
+  size_t try_push_n(ITER first, size_t n)
+  {
+    if constexpr (!std::is_nothrow_constructible_v<T, decltype(*first)>)
+    {
+      // See try_emplace; push the elements one by one.
+      size_t count = 0;
+      for (; count < n && try_emplace(*first); ++first)
+        ++count;
+      return count;
+    }
+    else
+    {
+      size_t tail;
+      size_t count = claim(tail, n);
+      if (AI_UNLIKELY(count == 0))
+        return 0;
+      for (size_t i = 0; i < count; ++i, ++first)
+      {
+        new (m_slots[(tail + i) & mask].m_storage) T(*first);
+        publish(tail + i);
+      }
+      m_not_empty.notify_waiters();
+      return count;
+    }
+  }
+
+  // Push n elements, blocking whenever the queue is full.
+  template<typename ITER>
+  void push_n(ITER first, size_t n)
+  {
+    for (;;)
+    {
+      size_t count = try_push_n(first, n);
+      if ((n -= count) == 0)
+        return;
+      std::advance(first, count);
+      block_while_full();
+    }
+  }
+
+  //---------------------------------------------------------------------------
+  // Consumer.
+
+  // Remove the first element from the queue. Returns std::nullopt if the queue is empty
+  // (or when the producer of the first element is still busy storing it).
+  std::optional<T> try_pop()
+  {
+    if (AI_UNLIKELY(!is_filled(m_head)))
+      return std::nullopt;
+    Slot& slot = m_slots[m_head & mask];
+    T* element = slot.data();
+    std::optional<T> result(std::move(*element));
+    element->~T();
+    slot.m_sequence.store(m_head + CAPACITY, std::memory_order::release);
+    ++m_head;
+    m_not_full.notify_waiters(true);
+    return result;
+  }
+
+  // Like try_pop, but block while the queue is empty.
+  T pop()
+  {
+    for (;;)
+    {
+      if (std::optional<T> result = try_pop(); AI_LIKELY(result))
+        return std::move(*result);
+      block_while_empty();
+    }
+  }
+
+  // Move at most n elements from the queue to *out, *(out + 1), ... Returns the number of elements popped.
+  template<typename OUT>
+  size_t try_pop_n(OUT out, size_t n)
+  {
+    size_t count = 0;
+    for (; count < n && is_filled(m_head); ++count, ++out)
+    {
+      Slot& slot = m_slots[m_head & mask];
+      T* element = slot.data();
+      *out = std::move(*element);
+      element->~T();
+      slot.m_sequence.store(m_head + CAPACITY, std::memory_order::release);
+      ++m_head;
+    }
+    if (count > 0)
+      m_not_full.notify_waiters(true);
+    return count;
+  }
+
+  // Like try_pop_n, but block while the queue is empty. Returns the number of elements popped (at least one).
+  template<typename OUT>
+  size_t pop_n(OUT out, size_t n)
+  {
+    for (;;)
+    {
+      if (size_t count = try_pop_n(out, n); AI_LIKELY(count > 0))
+        return count;
+      block_while_empty();
+    }
+  }
+
+  //---------------------------------------------------------------------------
+  // Consumer; only a snapshot when producers are active.
+
+  bool empty() const { return !is_filled(m_head); }
+};
+
+} // namespace threadsafe
@@ -4,10 +4,14 @@
 #include "AIReadWriteSpinLock.h"
 #include "utils/Badge.h"
 #include "utils/is_complete.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
 #include <type_traits>
 #include <utility>
 #include <memory>
 #include <atomic>
+#include <array>
+#include <thread>
 #include "debug.h"
 
 // Let ObjectTracker.inl.h know that it is needed.
@@ -42,6 +46,8 @@ class Node;
 #if TRACKER_IS_TYPEDEF
 //   Either also as a typedef:
 using NodeTracker = threadsafe::ObjectTracker<Node, locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>>;
+//   Or, to resolve the tracker without locking anything but the Node itself:
+//using NodeTracker = threadsafe::ObjectTracker<Node, locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>, threadsafe::tracking::LockFree>;
 #else
 //   Or derived from ObjectTracker:
 //
@@ -102,6 +108,38 @@ int main()
 
 namespace threadsafe {
 
+namespace detail {
+
+// The type of the tracked pointer of ObjectTracker: an UnlockedBase that provides
+// both, the data pointer and the data mutex pointer. This class is used to get
+// access to the protected m_base.
+template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX>
+class UnlockedBaseTrackedObject : public UnlockedBase<TrackedLockedType, POLICY_MUTEX>
+{
+ public:
+  using UnlockedBase<TrackedLockedType, POLICY_MUTEX>::UnlockedBase;
+  using wat = typename UnlockedBase<TrackedLockedType, POLICY_MUTEX>::wat;
+
+  void set_tracked_unlocked(TrackedLockedType* base)
+  {
+    this->m_base = base;
+  }
+
+  void update_mutex_pointer(auto* mutex_ptr)
+  {
+    if constexpr (std::is_same_v<wat, WriteAccess<UnlockedBase<TrackedLockedType, POLICY_MUTEX>>>)
+      this->m_read_write_mutex_ptr = mutex_ptr;
+    else if constexpr (std::is_same_v<wat, Access<UnlockedBase<TrackedLockedType, POLICY_MUTEX>>>)
+      this->m_primitive_mutex_ptr = mutex_ptr;
+    else
+      static_assert(!sizeof(mutex_ptr), "Unsupported policy.");
+  }
+
+  auto* mutex_pointer() const { return &this->mutex(); }
+};
+
+} // namespace detail
+
 // ObjectTracker
 //
 // The type of the tracker returned by the above class (UnlockedTrackedObject).
@@ -115,7 +153,11 @@ namespace threadsafe {
 // Note that it is allowed to derive from ObjectTracker, but a typical usage
 // will be to use it as-is for your tracker type.
 //
-template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX>
+// The last template parameter selects how the tracked pointer is protected:
+// tracking::Locked (the default) uses a read/write spin lock, see below for
+// tracking::LockFree.
+//
+template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX, typename TRACKING>
 class ObjectTracker
 {
  public:
@@ -129,26 +171,10 @@ class ObjectTracker
   using wat = typename unlocked_type::wat;
   using w2rCarry = typename unlocked_type::w2rCarry;
 
- private:
-  // This class is used to get access to the protected m_base.
-  class UnlockedBaseTrackedObject : public UnlockedBase<tracked_locked_type, policy_type>
-  {
-   public:
-    using UnlockedBase<tracked_locked_type, policy_type>::UnlockedBase;
-
-    void set_tracked_unlocked(tracked_locked_type* base)
-    {
-      this->m_base = base;
-    }
+  static constexpr bool is_lock_free = false;
 
-    void update_mutex_pointer(auto* mutex_ptr)
-    {
-      if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<tracked_type, policy_type>>>)
-        this->m_read_write_mutex_ptr = mutex_ptr;
-      else if constexpr (std::is_same_v<wat, Access<Unlocked<tracked_type, policy_type>>>)
-        this->m_primitive_mutex_ptr = mutex_ptr;
-    }
-  };
+ private:
+  using UnlockedBaseTrackedObject = detail::UnlockedBaseTrackedObject<tracked_type, tracked_locked_type, policy_type>;
 
  protected:
   using tracked_unlocked_ptr_type = Unlocked<UnlockedBaseTrackedObject, policy::ReadWrite<AIReadWriteSpinLock>>;
@@ -208,6 +234,263 @@ class ObjectTracker
 #endif
 };
 
+// ObjectTracker<..., tracking::LockFree>
+//
+// A tracker that does not lock anything but the tracked object itself.
+//
+// The tracked pointer and mutex pointer are stored in one of two snapshots, and
+// the current snapshot is published with a single atomic pointer store (from
+// update_mutex_pointer, which is called while the moved object is write locked).
+// Resolving the tracker (tracked_rat / tracked_wat) loads that pointer, locks the
+// mutex that it points to and checks that the snapshot is still current (the object
+// can't be moved while we have it locked).
+//
+// The danger is that the tracked object is moved, and the moved-from object (and
+// thus its mutex) destroyed, while a reader is still using that mutex: between
+// loading the snapshot and locking the mutex, but also while unlocking it (the
+// unlock of for example AIReadWriteMutex still reads the mutex after the RMW that
+// lets the next thread in). Therefore every access stores the snapshot that it uses
+// in an entry of a per-thread slot, and keeps it there until after its unlock
+// returned (see TrackedAccess). The move constructor of UnlockedTrackedObject
+// unlocks the moved-from object and then waits (synchronize) until no entry of
+// any slot points to the previous snapshot anymore.
+//
+// Apart from locking the tracked object, an access costs a compare-and-swap and a
+// store on the cache line of the slot of the current thread, which is not written
+// by other threads unless there are more threads than slots. No cache line that is
+// shared between threads is written, unlike tracking::Locked that read locks the
+// tracker twice per access. Only when all entries of a slot are in use (more than
+// entries_per_slot nested accesses by the threads of that slot) an access is counted
+// in the tracker itself instead. Moving the object, on the other hand, reads all
+// slots.
+//
+// The rat and wat of this tracker are therefore TrackedAccess types, derived from the
+// rat and wat of the tracked object. Do not slice them: the entry is released when
+// the TrackedAccess is destructed. A wat can be constructed from a rat, as usual.
+//
+template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX>
+class ObjectTracker<TrackedType, TrackedLockedType, POLICY_MUTEX, tracking::LockFree>
+{
+ public:
+  using tracked_type = TrackedType;
+  using tracked_locked_type = TrackedLockedType;
+  using policy_type = POLICY_MUTEX;
+  using unlocked_type = UnlockedBase<tracked_locked_type, policy_type>;
+
+  using crat = typename unlocked_type::crat;
+  using w2rCarry = typename unlocked_type::w2rCarry;
+
+  static constexpr bool is_lock_free = true;
+
+ private:
+  using UnlockedBaseTrackedObject = detail::UnlockedBaseTrackedObject<tracked_type, tracked_locked_type, policy_type>;
+
+  // Keeps the snapshot that an access was obtained through in use.
+  class ActiveAccess
+  {
+   protected:
+    std::atomic<UnlockedBaseTrackedObject*>* m_entry;   // The entry of a slot that points to the snapshot, or
+    std::atomic<int>* m_overflow_accesses;              // the overflow counter of that snapshot, or nullptr.
+
+    void release()
+    {
+      if (m_entry)
+        m_entry->store(nullptr, std::memory_order::release);
+      else if (m_overflow_accesses)
+        m_overflow_accesses->fetch_sub(1, std::memory_order::release);
+    }
+
+   public:
+    ActiveAccess() : m_entry(nullptr), m_overflow_accesses(nullptr) { }
+    ActiveAccess(std::atomic<UnlockedBaseTrackedObject*>* entry, std::atomic<int>* overflow_accesses) :
+      m_entry(entry), m_overflow_accesses(overflow_accesses) { }
+    ActiveAccess(ActiveAccess&& rvalue) : m_entry(rvalue.m_entry), m_overflow_accesses(rvalue.m_overflow_accesses)
+    {
+      rvalue.m_entry = nullptr;
+      rvalue.m_overflow_accesses = nullptr;
+    }
+    ~ActiveAccess() { release(); }
+  };
+
+ public:
+  // An access type that is returned by tracked_rat and tracked_wat.
+  //
+  // ActiveAccess is the first base class, so it is destructed after ACCESS unlocked the mutex.
+  template<typename ACCESS>
+  class TrackedAccess : private ActiveAccess, public ACCESS
+  {
+   public:
+    TrackedAccess(ActiveAccess&& active_access, ACCESS&& access) : ActiveAccess(std::move(active_access)), ACCESS(std::move(access)) { }
+    TrackedAccess(TrackedAccess&& rvalue) = default;
+
+    // Convert another TrackedAccess (e.g. promote a rat to a wat). That one must outlive this one; it keeps the snapshot in use.
+    template<typename ACCESS2>
+    requires (!std::is_same_v<ACCESS2, TrackedAccess> && std::is_constructible_v<ACCESS, ACCESS2&>)
+    explicit TrackedAccess(TrackedAccess<ACCESS2>& access) : ActiveAccess(), ACCESS(access) { }
+  };
+
+  using rat = TrackedAccess<typename unlocked_type::rat>;
+  using wat = TrackedAccess<typename unlocked_type::wat>;
+
+ private:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int number_of_slots = 64;
+  static constexpr int entries_per_slot = cache_line_size / sizeof(std::atomic<UnlockedBaseTrackedObject*>);
+
+  struct alignas(cache_line_size) Slot
+  {
+    std::array<std::atomic<UnlockedBaseTrackedObject*>, entries_per_slot> m_entries;    // The snapshots that are in use by the threads of this slot.
+    Slot() { for (auto& entry : m_entries) entry.store(nullptr, std::memory_order::relaxed); }
+  };
+
+  // The slots are shared by all trackers of this type; snapshots are unique per tracker.
+  inline static std::array<Slot, number_of_slots> s_slots;
+  inline static std::atomic<unsigned int> s_next_slot;
+
+  std::array<UnlockedBaseTrackedObject, 2> m_snapshots;
+  std::atomic<UnlockedBaseTrackedObject*> m_current;            // Points to one of m_snapshots.
+  std::array<std::atomic<int>, 2> m_overflow_accesses;          // The number of accesses of each snapshot that didn't find a free entry.
+  tracked_locked_type* m_pending_base;                          // The tracked object that is published by the next call to update_mutex_pointer.
+
+  // Return the slot that is used by the current thread.
+  static Slot& slot()
+  {
+    static thread_local unsigned int const slot_index = s_next_slot.fetch_add(1, std::memory_order::relaxed) % number_of_slots;
+    return s_slots[slot_index];
+  }
+
+  // Mark snapshot as being in use by the current thread.
+  ActiveAccess use(UnlockedBaseTrackedObject* snapshot)
+  {
+    for (std::atomic<UnlockedBaseTrackedObject*>& entry : slot().m_entries)
+    {
+      UnlockedBaseTrackedObject* expected = nullptr;
+      if (entry.load(std::memory_order::relaxed) == nullptr &&
+          AI_LIKELY(entry.compare_exchange_strong(expected, snapshot, std::memory_order::seq_cst, std::memory_order::relaxed)))
+        return {&entry, nullptr};
+    }
+    // All entries of our slot are in use.
+    std::atomic<int>* overflow_accesses = &m_overflow_accesses[snapshot - m_snapshots.data()];
+    overflow_accesses->fetch_add(1, std::memory_order::seq_cst);
+    return {nullptr, overflow_accesses};
+  }
+
+  template<typename PRED>
+  static void spin_until(PRED pred)
+  {
+    int spin_count = 0;
+    while (!pred())
+    {
+      if (++spin_count < 1000)
+        cpu_relax();
+      else
+        std::this_thread::yield();      // A reader might have been descheduled.
+    }
+  }
+
+  // Make a snapshot of base and mutex_ptr the current snapshot.
+  void publish(tracked_locked_type* base, auto* mutex_ptr)
+  {
+    UnlockedBaseTrackedObject* next = &m_snapshots[m_current.load(std::memory_order::relaxed) == &m_snapshots[0] ? 1 : 0];
+    // No reader is using next anymore since the last call to synchronize.
+    next->set_tracked_unlocked(base);
+    next->update_mutex_pointer(mutex_ptr);
+    m_current.store(next, std::memory_order::seq_cst);
+  }
+
+  template<typename ACCESS>
+  TrackedAccess<ACCESS> resolve()
+  {
+    for (;;)
+    {
+      UnlockedBaseTrackedObject* current = m_current.load(std::memory_order::acquire);
+      ActiveAccess active_access = use(current);
+      // If the snapshot is still current then the next call to synchronize sees that we use it.
+      if (AI_UNLIKELY(m_current.load(std::memory_order::seq_cst) != current))
+        continue;
+      ACCESS access{*current};
+      // The tracked object can not be moved while we have it locked.
+      if (AI_LIKELY(m_current.load(std::memory_order::relaxed) == current))
+        return {std::move(active_access), std::move(access)};
+      // It was moved; access is destructed (unlocked) before active_access.
+    }
+  }
+
+ protected:
+  // Used by trackers that are derived from ObjectTracker.
+  ObjectTracker(tracked_type& tracked_unlocked) :
+    m_snapshots{{UnlockedBaseTrackedObject{tracked_unlocked}, UnlockedBaseTrackedObject{tracked_unlocked}}},
+    m_current(&m_snapshots[0]), m_overflow_accesses{0, 0}, m_pending_base(nullptr) { }
+
+ public:
+  // Construct a new ObjectTracker that tracks tracked_unlocked.
+  template<typename TrackerType>
+  ObjectTracker(utils::Badge<TrackedObject<tracked_type, TrackerType>>, tracked_type const& tracked_unlocked) :
+    m_snapshots{{UnlockedBaseTrackedObject{tracked_unlocked}, UnlockedBaseTrackedObject{tracked_unlocked}}},
+    m_current(&m_snapshots[0]), m_overflow_accesses{0, 0}, m_pending_base(nullptr) { }
+
+  // This is called when the object is moved in memory, see below.
+  template<typename TrackerType>
+  void set_tracked_unlocked(utils::Badge<TrackedObject<tracked_type, TrackerType>>, tracked_type* tracked_unlocked_ptr)
+  {
+    // This function should not be called while the tracker is being constructed!
+    ASSERT(debug_initialized_);
+    // This is called while the mutex of the tracked_type is locked.
+    if (tracked_unlocked_ptr)
+    {
+      // Published together with the new mutex, by update_mutex_pointer.
+      m_pending_base = tracked_unlocked_ptr;
+      return;
+    }
+    // The tracked object is being destructed.
+    publish(nullptr, m_current.load(std::memory_order::relaxed)->mutex_pointer());
+  }
+
+  void update_mutex_pointer(auto* mutex_ptr)
+  {
+    // This function should not be called while the tracker is being constructed!
+    ASSERT(debug_initialized_);
+    ASSERT(m_pending_base);
+    publish(m_pending_base, mutex_ptr);
+    m_pending_base = nullptr;
+  }
+
+  // Called by the move constructor of UnlockedTrackedObject after unlocking the moved-from object.
+  // Wait until no reader can be using the previous snapshot (and thus the mutex of the moved-from object) anymore.
+  void synchronize()
+  {
+    UnlockedBaseTrackedObject* previous = &m_snapshots[m_current.load(std::memory_order::relaxed) == &m_snapshots[0] ? 1 : 0];
+    // Readers that start using previous after we read their entry see the new snapshot (stored before these loads) and retry.
+    for (Slot const& s : s_slots)
+      for (std::atomic<UnlockedBaseTrackedObject*> const& entry : s.m_entries)
+        spin_until([&]{ return entry.load(std::memory_order::seq_cst) != previous; });
+    std::atomic<int> const& overflow_accesses = m_overflow_accesses[previous - m_snapshots.data()];
+    spin_until([&]{ return overflow_accesses.load(std::memory_order::seq_cst) == 0; });
+  }
+
+  // Accessors.
+  rat tracked_rat()
+  {
+    // This function should not be called while the tracker is being constructed!
+    ASSERT(debug_initialized_);
+    return resolve<typename unlocked_type::rat>();
+  }
+  wat tracked_wat()
+  {
+    // This function should not be called while the tracker is being constructed!
+    ASSERT(debug_initialized_);
+    return resolve<typename unlocked_type::wat>();
+  }
+
+#if CW_DEBUG
+ private:
+  bool debug_initialized_ = false;
+
+ public:
+  void set_is_initialized() { debug_initialized_ = true; }
+#endif
+};
+
 // TrackedObject
 //
 // Base class of the unlocked data type.
@@ -308,7 +591,8 @@ class UnlockedTrackedObject :
   // data object, but creating a new policy mutex). This also updates the pointer of the
   // tracker that points to that data object. Finally, in the body of the constructor,
   // the tracker is updated to point to the newly created mutex. At the end of the constructor
-  // of the final object, other is unlocked.
+  // of the final object, other is unlocked (for a lock-free tracker, at the end of the body
+  // of this constructor).
   template<typename... ARGS>
   requires ((!std::is_base_of_v<Unlocked<TrackedLockedType, POLICY_MUTEX>, std::decay_t<ARGS>> &&
         !std::is_convertible_v<std::decay_t<ARGS>, LockFinalCopy<Unlocked<TrackedLockedType, POLICY_MUTEX>>> &&
@@ -318,6 +602,13 @@ class UnlockedTrackedObject :
   {
     auto& mutex = this->mutex();
     this->tracker_->update_mutex_pointer(&mutex);
+    if constexpr (TrackedLockedType::tracker_type::is_lock_free)
+    {
+      // Readers of a lock-free tracker might still use the mutex of other; they might even
+      // be about to lock it. Unlock it and wait till they're gone, before other can be destroyed.
+      other.unlock();
+      this->tracker_->synchronize();
+    }
   }
 
   // Make sure that the normal move constructor also uses the above.
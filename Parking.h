@@ -0,0 +1,169 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class Parking.
+ *
+ * @Copyright (C) 2017  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/macros.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#else
+#include <algorithm>
+#include <thread>
+#endif
+
+namespace threadsafe {
+
+// A place where threads can sleep until another thread notifies them.
+//
+// Waiting threads sleep on a futex: the sequence number m_sequence, that is incremented by every notify.
+// A waiter first registers itself (prepare_wait) which returns the current sequence number, then tests
+// its condition once more and, if that is still false, goes to sleep (wait) as long as the sequence
+// number didn't change. The number of waiting threads is kept too, so that notifying nobody doesn't
+// make a system call.
+//
+// This is used by ConditionVariable, where the condition is protected by a mutex, and by SPSCQueue
+// and MPSCQueue, where it isn't (see notify_waiters).
+//
+// On other operating systems than linux, std::atomic<>::wait is used instead of a futex, and timed waits poll.
+class Parking
+{
+ private:
+  std::atomic<uint32_t> m_sequence;     // Incremented by every notify.
+  std::atomic<uint32_t> m_waiters;      // The number of threads that are (about to) sleep on m_sequence.
+
+#ifdef __linux__
+  // Sleep until m_sequence is no longer equal to `sequence`, a wake up, or until the (absolute, steady_clock) deadline if not nullptr.
+  void futex_wait(uint32_t sequence, struct timespec const* deadline)
+  {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_sequence), FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, sequence, deadline, nullptr, FUTEX_BITSET_MATCH_ANY);
+  }
+
+  void futex_wake(int count)
+  {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_sequence), FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, nullptr, nullptr, 0);
+  }
+#endif
+
+ public:
+  Parking() : m_sequence(0), m_waiters(0) { }
+
+  // Register the current thread as waiter. Returns the sequence number that must be passed to wait.
+  // The condition that is waited for must be tested after calling this (with a seq_cst load if it is not protected by a mutex).
+  uint32_t prepare_wait()
+  {
+    m_waiters.fetch_add(1, std::memory_order::seq_cst);
+    return m_sequence.load(std::memory_order::seq_cst);
+  }
+
+  // Undo prepare_wait, because the condition turned out to be true already.
+  void cancel_wait()
+  {
+    m_waiters.fetch_sub(1, std::memory_order::relaxed);
+  }
+
+  // Sleep until notified (or spuriously, or until deadline if not nullptr), unless a notify happened since prepare_wait.
+  void wait(uint32_t sequence, std::chrono::steady_clock::time_point const* deadline = nullptr)
+  {
+#ifdef __linux__
+    if (deadline)
+    {
+      // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC time, which is what steady_clock uses.
+      auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline->time_since_epoch()).count();
+      struct timespec ts;
+      ts.tv_sec = since_epoch / 1000000000;
+      ts.tv_nsec = since_epoch % 1000000000;
+      futex_wait(sequence, &ts);
+    }
+    else
+      futex_wait(sequence, nullptr);
+#else
+    if (deadline)
+    {
+      auto remaining = *deadline - std::chrono::steady_clock::now();
+      if (m_sequence.load(std::memory_order::relaxed) == sequence && remaining > std::chrono::steady_clock::duration::zero())
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(remaining, std::chrono::milliseconds(1)));
+    }
+    else
+      m_sequence.wait(sequence, std::memory_order::relaxed);
+#endif
+    m_waiters.fetch_sub(1, std::memory_order::relaxed);
+  }
+
+  // Block until pred() returns true. pred must use seq_cst loads, unless what it tests is protected by a mutex.
+  template<typename PRED>
+  void wait_until(PRED pred)
+  {
+    while (!pred())
+    {
+      uint32_t sequence = prepare_wait();
+      if (pred())
+      {
+        cancel_wait();
+        return;
+      }
+      wait(sequence);
+    }
+  }
+
+  // Wake up one (or all) waiting threads.
+  void notify(bool all)
+  {
+    m_sequence.fetch_add(1, std::memory_order::seq_cst);
+    if (m_waiters.load(std::memory_order::seq_cst) == 0)
+      return;
+#ifdef __linux__
+    futex_wake(all ? INT_MAX : 1);
+#else
+    if (all)
+      m_sequence.notify_all();
+    else
+      m_sequence.notify_one();
+#endif
+  }
+
+  // Like notify, but cheaper when there are no waiters: only a fence and a load (no RMW).
+  //
+  // To be called after the condition of a waiter was made true by a store that is not protected
+  // by a mutex. The fence pairs with the RMW in prepare_wait: either the waiter sees the store
+  // when it tests its condition again, or we see the waiter.
+  void notify_waiters(bool all = false)
+  {
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+    if (AI_LIKELY(m_waiters.load(std::memory_order::relaxed) == 0))
+      return;
+    notify(all);
+  }
+};
+
+} // namespace threadsafe
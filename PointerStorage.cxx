@@ -4,56 +4,90 @@
 
 namespace threadsafe {
 
-void VoidPointerStorage::increase_size(uint32_t initial_size)
+VoidPointerStorage::VoidPointerStorage(uint32_t initial_size) :
+  m_first_segment_shift(std::max(static_cast<int>(std::bit_width(std::max(initial_size, uint32_t{1}) - 1)), min_first_segment_shift)),
+  m_size(0), m_number_of_segments(0), m_free_indices(0)
 {
-  m_rwlock.rd2wrlock(); // This might throw if another thread is already trying to convert its read lock into a write lock.
-
-  index_type size = m_size;
-  m_size = std::max(static_cast<index_type>(initial_size), static_cast<index_type>(memory_grow_factor * size));
-  if (AI_UNLIKELY(m_size == size))
-    m_size += 1;
-
-  m_storage.reserve(m_size);
-  m_storage.resize(m_size);
-
-  std::vector<index_type> tmp;
-  m_free_indices.consume_all([&tmp](index_type index){
-    tmp.push_back(index);
-  });
-  m_free_indices.reserve(m_size);
-
-  ASSERT(m_free_indices.empty());
-  index_type index = m_size;
-//  Dout(dc::notice|continued_cf, "Pushing:");
-  while (index > size)
+  for (int n = 0; n < max_segments; ++n)
   {
-//    Dout(dc::continued, ' ' << (index - 1));
-    m_free_indices.bounded_push(--index);
+    m_segments[n].store(nullptr, std::memory_order::relaxed);
+    m_occupancy[n].store(nullptr, std::memory_order::relaxed);
   }
-  for (auto iter = tmp.rbegin(); iter != tmp.rend(); ++iter)
+  increase_size();
+}
+
+VoidPointerStorage::~VoidPointerStorage()
+{
+  for (int n = 0; n < max_segments; ++n)
+  {
+    delete [] m_segments[n].load(std::memory_order::relaxed);
+    delete [] m_occupancy[n].load(std::memory_order::relaxed);
+  }
+}
+
+void VoidPointerStorage::increase_size(index_type required)
+{
+  std::lock_guard<std::mutex> lock(m_increase_size_mutex);
+  // If another thread added a segment while we were waiting for the lock, then try to pop an index again first.
+  if (!m_free_indices.empty())
+    return;
+  index_type const size = m_size.load(std::memory_order::relaxed);
+
+  index_type new_size = size;
+  do
   {
-//    Dout(dc::continued, ' ' << *iter);
-    m_free_indices.bounded_push(*iter);
+    int n = m_number_of_segments;
+    // Running out of indices is not going to happen: that would require 2^32 pointers.
+    ASSERT(n < max_segments);
+    index_type const segment_size = index_type{1} << (n + m_first_segment_shift);
+    m_segments[n].store(new std::atomic<void*>[segment_size](), std::memory_order::release);
+    m_occupancy[n].store(new std::atomic<uint64_t>[segment_size / bits_per_word](), std::memory_order::release);
+    m_number_of_segments = n + 1;
+    new_size += segment_size;
   }
-//  Dout(dc::finish, '.');
+  while (new_size - size < required);
+  // Synchronizes with the load in for_each_occupied.
+  m_size.store(new_size, std::memory_order::release);
+
+  // Make sure that bounded_push can't fail: there are never more free indices than m_size.
+  m_free_indices.reserve(new_size - size);
+  // Push the new indices at once, in reverse order, so that the lowest index ends up on top and is used first.
+  std::vector<index_type> new_indices(new_size - size);
+  for (index_type i = 0; i < new_indices.size(); ++i)
+    new_indices[i] = new_size - 1 - i;
+  m_free_indices.bounded_push(new_indices.cbegin(), new_indices.cend());
+}
 
-  m_rwlock.wr2rdlock();
+void VoidPointerStorage::erase_n(std::span<index_type const> indices)
+{
+  Magazine& mag = magazine();
+  bool const have_magazine = mag.try_lock();
+  if (AI_UNLIKELY(!have_magazine))
+    m_rwlock.rdlock();
+  set_occupancy(indices, false);
+  auto begin = indices.begin();
+  if (AI_LIKELY(have_magazine))
+  {
+    while (begin != indices.end() && mag.m_count < magazine_capacity)
+      mag.m_indices[mag.m_count++] = *begin++;
+  }
+  // Push the remaining indices with a single CAS.
+  if (begin != indices.end())
+    m_free_indices.bounded_push(begin, indices.end());
+  if (AI_LIKELY(have_magazine))
+    mag.unlock();
+  else
+    m_rwlock.rdunlock();
 }
 
 #ifdef CWDEBUG
 bool VoidPointerStorage::debug_empty() const
 {
-  // The storage contains no pointers when all indices are free.
-  // The only way we can check this is by emptying the stack :/.
-  m_rwlock.wrlock();
-  std::vector<index_type> tmp;
-  m_free_indices.consume_all([&tmp](index_type index){
-    tmp.push_back(index);
-  });
-  bool empty = tmp.size() == m_size;
-  for (auto iter = tmp.rbegin(); iter != tmp.rend(); ++iter)
-    m_free_indices.bounded_push(*iter);
-  m_rwlock.wrunlock();
+  // The storage contains no pointers when no bit of the occupancy bitmap is set.
+  lock_all();
+  bool empty = true;
+  for_each_occupied(0, 1, [&empty](void*){ empty = false; });
+  unlock_all();
   return empty;
 }
 #endif
@@ -28,10 +28,16 @@
 #pragma once
 
 #include "AIReadWriteSpinLock.h"
+#include "utils/cpu_relax.h"
 #include "utils/macros.h"
 #include <boost/lockfree/stack.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cstdint>
 #include <mutex>
+#include <span>
 #include <vector>
 
 namespace threadsafe {
@@ -46,10 +52,18 @@ namespace threadsafe {
 //
 // Insertion and erase take constant time, except when the
 // memory allocated for the stored pointers is too small,
-// which causes a reallocation.
+// which causes a new segment to be allocated.
 //
-// Such reallocation might move the storage in memory, therefore
-// indices are used to refer to the place in the storage where
+// The storage consists of segments that are never moved in memory:
+// the first segment has room for initial_size pointers (rounded up
+// to a power of two, but at least 64) and each next segment is twice
+// as large as the previous one. An index is translated into a segment and an offset
+// in that segment with a bit of arithmetic (see at()), therefore get
+// is a wait-free lookup and growing the storage does not require
+// exclusive access: it only blocks other threads that need to grow
+// the storage at the same time.
+//
+// Indices are used to refer to the place in the storage where
 // a pointer is stored, for fast erasure. That in turn requires
 // that pointers are never moved relative to the storage however,
 // so that an additional accounting is necessary to keep track
@@ -118,73 +132,283 @@ namespace threadsafe {
 //               7 |            |                  |  0  |
 //                 `------------'                  `-----'
 //
-// In other words, any element of m_storage can end up used or free; and
+// In other words, any element of the storage can end up used or free; and
 // all elements in m_free_indices at m_last_freed_index and higher are relevant:
-// free indices of m_storage in reverse order that they were erased.
+// free indices of the storage in reverse order that they were erased.
 //
 // This means that an erase followed by an insert, writes and then reads
 // the same memory location in m_free_indices, which is cache friendly.
-// m_storage is only written to.
+// The storage is only written to.
+//
+// In order to avoid that every insert and erase of every thread does a CAS
+// on the head of m_free_indices, each thread also has a "magazine": a small
+// cache of free indices of its own (threads are assigned one of
+// number_of_magazines magazines round-robin, each on its own cache line).
+// insert takes an index from the magazine of the calling thread and erase
+// puts it back there; only when the magazine is empty (or full) half of
+// a magazine worth of indices is moved from (or to) m_free_indices.
+//
+// Hence, the free indices are those in m_free_indices plus those in all magazines.
+// The magazines are only accessed by insert and erase, each magazine being
+// protected by its own flag (in case more than number_of_magazines threads are used).
+// While a thread has its magazine it doesn't need any other lock: segments are
+// never moved. A thread that finds its magazine in use read locks m_rwlock instead.
+// for_each write locks m_rwlock and then takes the flags of all magazines, which
+// blocks insert and erase without them having to touch m_rwlock on the fast path.
+//
+// Finally, every segment has an occupancy bitmap with one bit per pointer,
+// that is set by insert (after storing the pointer) and reset by erase.
+// This allows iterating over all stored pointers without touching the free
+// indices; either while blocking insert and erase (for_each), or concurrently
+// with them (concurrent_for_each) - which can also be split over several threads.
 //
 class VoidPointerStorage
 {
  public:
   using index_type = uint_fast32_t;
-  static constexpr float memory_grow_factor = 1.414f;
+  static constexpr int max_segments = 32;
+  static constexpr size_t cache_line_size = 64;
+  static constexpr int number_of_magazines = 16;
+  static constexpr int magazine_capacity = 16;                  // The maximum number of indices in one magazine.
+  static constexpr int magazine_batch = magazine_capacity / 2;  // The number of indices moved between a magazine and m_free_indices at once.
 
  protected:
-  mutable AIReadWriteSpinLock m_rwlock;
-  index_type m_size;
-  std::vector<void*> m_storage;
+  struct alignas(cache_line_size) Magazine
+  {
+    std::atomic<bool> m_busy;                   // Set while a thread is using this magazine.
+    int m_count;                                // The number of free indices in m_indices.
+    std::array<index_type, magazine_capacity> m_indices;
+
+    Magazine() : m_busy(false), m_count(0) { }
+
+    bool try_lock() { return !m_busy.exchange(true, std::memory_order::acquire); }
+    void unlock() { m_busy.store(false, std::memory_order::release); }
+  };
+
+  static constexpr int bits_per_word = 64;
+  static constexpr int min_first_segment_shift = 6;                     // The size of a segment must be a multiple of bits_per_word.
+  static constexpr index_type words_per_block = 8;                      // The number of occupancy words that are handed out to one part at a time by concurrent_for_each.
+
+  mutable AIReadWriteSpinLock m_rwlock;                                 // Read locked by insert and erase when they can't use their magazine; write locked by for_each.
+  int const m_first_segment_shift;                                      // The first segment has room for 1 << m_first_segment_shift pointers.
+  std::array<std::atomic<std::atomic<void*>*>, max_segments> m_segments;        // Segment n has room for 2^n times as many pointers as the first segment.
+  std::array<std::atomic<std::atomic<uint64_t>*>, max_segments> m_occupancy;    // The occupancy bitmap of each segment.
+  std::atomic<index_type> m_size;                                       // The total size of all allocated segments.
+  std::mutex m_increase_size_mutex;                                     // Protects m_number_of_segments.
+  int m_number_of_segments;
   mutable boost::lockfree::stack<index_type> m_free_indices;
+  mutable std::array<Magazine, number_of_magazines> m_magazines;
 
- private:
-  void increase_size(uint32_t initial_size = 0);
+  inline static std::atomic<unsigned int> s_next_magazine;
 
- public:
-  VoidPointerStorage(uint32_t initial_size) : m_size(0), m_free_indices(initial_size)
+  // Return the magazine that is used by the current thread.
+  Magazine& magazine() const
   {
-    m_rwlock.rdlock();                  // Must have read-lock before calling increase_size!
-    increase_size(initial_size);
-    m_rwlock.rdunlock();
+    static thread_local unsigned int const magazine_index = s_next_magazine.fetch_add(1, std::memory_order::relaxed) % number_of_magazines;
+    return m_magazines[magazine_index];
   }
 
-  index_type insert(void* value)
+  // Block insert and erase (see for_each).
+  void lock_all() const
   {
-    index_type index;
-    for (;;)
+    m_rwlock.wrlock();
+    for (Magazine& mag : m_magazines)
+      while (!mag.try_lock())
+        cpu_relax();
+  }
+
+  void unlock_all() const
+  {
+    for (Magazine& mag : m_magazines)
+      mag.unlock();
+    m_rwlock.wrunlock();
+  }
+
+  // Return the segment that contains pos, and set offset to the offset of pos in that segment.
+  int locate(index_type pos, index_type& offset) const
+  {
+    // Segment n contains the indices [(2^n - 1) * S, (2^(n+1) - 1) * S), where S is the size of the first segment.
+    index_type j = (pos >> m_first_segment_shift) + 1;
+    int n = std::bit_width(j) - 1;
+    offset = pos - (((index_type{1} << n) - 1) << m_first_segment_shift);
+    return n;
+  }
+
+  // Return the storage of the pointer at pos.
+  std::atomic<void*>& at(index_type pos) const
+  {
+    index_type offset;
+    int n = locate(pos, offset);
+    return m_segments[n].load(std::memory_order::acquire)[offset];
+  }
+
+  // Return the occupancy word that contains the bit of pos.
+  std::atomic<uint64_t>& occupancy_word(index_type pos) const
+  {
+    index_type offset;
+    int n = locate(pos, offset);
+    return m_occupancy[n].load(std::memory_order::acquire)[offset / bits_per_word];
+  }
+
+  static uint64_t occupancy_bit(index_type pos) { return uint64_t{1} << (pos % bits_per_word); }
+
+  // Set (occupied is true) or reset the occupancy bits of indices, using one RMW per run of indices that are in the same word.
+  void set_occupancy(std::span<index_type const> indices, bool occupied)
+  {
+    size_t i = 0;
+    while (i < indices.size())
     {
+      std::atomic<uint64_t>& word = occupancy_word(indices[i]);
+      index_type const word_index = indices[i] / bits_per_word;
+      uint64_t bits = 0;
+      do
+        bits |= occupancy_bit(indices[i]);
+      while (++i < indices.size() && indices[i] / bits_per_word == word_index);
+      if (occupied)
+        word.fetch_or(bits, std::memory_order::release);
+      else
+        word.fetch_and(~bits, std::memory_order::relaxed);
+    }
+  }
+
+  template<typename T>
+  void do_insert_n(std::span<T* const> values, std::span<index_type> indices)
+  {
+    // indices must have the same size as values.
+    ASSERT(indices.size() == values.size());
+    size_t const n = values.size();
+    size_t count = 0;
+    Magazine& mag = magazine();
+    bool const have_magazine = mag.try_lock();
+    if (AI_LIKELY(have_magazine))
+    {
+      while (count < n && mag.m_count > 0)
+        indices[count++] = mag.m_indices[--mag.m_count];
+    }
+    else
       m_rwlock.rdlock();
-      try
+    while (count < n)
+    {
+      if (AI_UNLIKELY(!m_free_indices.pop(indices[count])))
+        increase_size(n - count);
+      else
+        ++count;
+    }
+    for (size_t i = 0; i < n; ++i)
+      at(indices[i]).store(values[i], std::memory_order::relaxed);
+    // Publish the values to concurrent_for_each.
+    set_occupancy(indices, true);
+    if (AI_LIKELY(have_magazine))
+      mag.unlock();
+    else
+      m_rwlock.rdunlock();
+  }
+
+  // Call callback with every stored pointer in the occupancy words that belong to part (of number_of_parts).
+  // The words are handed out to the parts in blocks of words_per_block, round-robin; hence it doesn't
+  // matter if the storage grows in the meantime and the different parts see a different size.
+  template<typename CALLBACK>
+  void for_each_occupied(int part, int number_of_parts, CALLBACK const& callback) const
+  {
+    index_type const number_of_words = m_size.load(std::memory_order::acquire) / bits_per_word;
+    for (index_type begin = part * words_per_block; begin < number_of_words; begin += number_of_parts * words_per_block)
+    {
+      index_type const end = std::min(begin + words_per_block, number_of_words);
+      for (index_type word = begin; word < end; ++word)
       {
-        while (AI_UNLIKELY(!m_free_indices.pop(index)))
-          increase_size();      // Converts m_rwlock from read to write lock (which might throw) and back.
+        index_type const first = word * bits_per_word;
+        uint64_t bits = occupancy_word(first).load(std::memory_order::acquire);
+        // Process the set bits from low to high.
+        while (bits)
+        {
+          callback(at(first + std::countr_zero(bits)).load(std::memory_order::relaxed));
+          bits &= bits - 1;
+        }
       }
-      catch (std::exception const&)
+    }
+  }
+
+ private:
+  // Add new segments for at least `required` pointers, unless another thread already added a segment while we were waiting for m_increase_size_mutex.
+  void increase_size(index_type required = 1);
+
+  void store(index_type index, void* value)
+  {
+    at(index).store(value, std::memory_order::relaxed);
+    // Publish value to concurrent_for_each.
+    occupancy_word(index).fetch_or(occupancy_bit(index), std::memory_order::release);
+  }
+
+ public:
+  VoidPointerStorage(uint32_t initial_size);
+  ~VoidPointerStorage();
+
+  index_type insert(void* value)
+  {
+    index_type index;
+    Magazine& mag = magazine();
+    if (AI_LIKELY(mag.try_lock()))
+    {
+      while (AI_UNLIKELY(mag.m_count == 0))
       {
-        m_rwlock.rdunlock();
-        m_rwlock.rd2wryield();  // Wait until the other thread is done increasing the size.
-        continue;
+        // Refill an empty magazine from m_free_indices.
+        while (mag.m_count < magazine_batch && m_free_indices.pop(mag.m_indices[mag.m_count]))
+          ++mag.m_count;
+        if (mag.m_count == 0)
+          increase_size();
       }
-      m_storage[index] = value;
-      m_rwlock.rdunlock();
-      break;
+      index = mag.m_indices[--mag.m_count];
+      // Store the value before releasing the magazine, so that for_each doesn't run in between.
+      store(index, value);
+      mag.unlock();
+      return index;
     }
+    // Another thread is using our magazine (or for_each is running).
+    m_rwlock.rdlock();
+    while (AI_UNLIKELY(!m_free_indices.pop(index)))
+      increase_size();
+    store(index, value);
+    m_rwlock.rdunlock();
     return index;
   }
 
   void erase(index_type pos)
   {
+    Magazine& mag = magazine();
+    if (AI_LIKELY(mag.try_lock()))
+    {
+      occupancy_word(pos).fetch_and(~occupancy_bit(pos), std::memory_order::relaxed);
+      // Move the oldest half of a full magazine to m_free_indices.
+      if (AI_UNLIKELY(mag.m_count == magazine_capacity))
+      {
+        for (int i = 0; i < magazine_batch; ++i)
+          m_free_indices.bounded_push(mag.m_indices[i]);
+        std::copy(mag.m_indices.begin() + magazine_batch, mag.m_indices.end(), mag.m_indices.begin());
+        mag.m_count -= magazine_batch;
+      }
+      mag.m_indices[mag.m_count++] = pos;
+      mag.unlock();
+      return;
+    }
+    // Another thread is using our magazine (or for_each is running).
     m_rwlock.rdlock();
+    occupancy_word(pos).fetch_and(~occupancy_bit(pos), std::memory_order::relaxed);
     m_free_indices.bounded_push(pos);
     m_rwlock.rdunlock();
   }
 
   void* get(index_type pos) const
   {
-    return m_storage[pos];
+    return at(pos).load(std::memory_order::relaxed);
   }
 
+  // Insert all values at once, writing the index of each into the corresponding element of indices
+  // (which must have the same size as values). This grows the storage at most once.
+  void insert_n(std::span<void* const> values, std::span<index_type> indices) { do_insert_n(values, indices); }
+
+  // Erase all pointers at indices at once.
+  void erase_n(std::span<index_type const> indices);
+
 #ifdef CWDEBUG
   // Extremely expensive function.
   bool debug_empty() const;
@@ -204,26 +428,43 @@ struct PointerStorage : public VoidPointerStorage
 
   index_type insert(T* value) { return VoidPointerStorage::insert(value); }
   T* get(index_type pos) { return static_cast<T*>(VoidPointerStorage::get(pos)); }
+  void insert_n(std::span<T* const> values, std::span<index_type> indices) { do_insert_n(values, indices); }
 
   // Call callback with all currently stored pointers.
+  // Calls to insert and erase block until this function returns.
   void for_each(std::function<void(T*)> callback);
+
+  // Call callback with all currently stored pointers, without blocking insert and erase (this function is lock-free).
+  //
+  // The callback is called for every pointer that is stored during the whole call, at most once for each index
+  // that it is stored at. Pointers that are inserted or erased while this function is running might be passed
+  // to the callback or not; therefore the caller must make sure that the objects that are erased in the meantime
+  // are not destroyed before this function returns.
+  void concurrent_for_each(std::function<void(T*)> callback) const { concurrent_for_each(0, 1, callback); }
+
+  // The same as the above, but only for part `part` of the storage, where the storage is divided into number_of_parts parts.
+  // This is intended to spread the work over number_of_parts threads, each calling this function with a different part
+  // (0 <= part < number_of_parts). For example,
+  //
+  //   // Called by each of the threads in a thread pool of size n, where i is the index of the thread (0 <= i < n).
+  //   storage.concurrent_for_each(i, n, [](Foo* foo){ foo->tick(); });
+  //
+  void concurrent_for_each(int part, int number_of_parts, std::function<void(T*)> callback) const;
 };
 
 template<typename T>
 void PointerStorage<T>::for_each(std::function<void(T*)> callback)
 {
-  std::vector<index_type> free_indices;
-  m_rwlock.wrlock();
-  m_free_indices.consume_all([this, &free_indices](index_type index){
-    m_storage[index] = nullptr;
-    free_indices.push_back(index);
-  });
-  for (void* ptr : m_storage)
-    if (ptr)
-      callback(static_cast<T*>(ptr));
-  for (index_type index : free_indices)
-    m_free_indices.bounded_push(index);
-  m_rwlock.wrunlock();
+  lock_all();
+  for_each_occupied(0, 1, [&callback](void* ptr){ callback(static_cast<T*>(ptr)); });
+  unlock_all();
+}
+
+template<typename T>
+void PointerStorage<T>::concurrent_for_each(int part, int number_of_parts, std::function<void(T*)> callback) const
+{
+  // Segments are never freed (before the destructor), so no lock is needed at all.
+  for_each_occupied(part, number_of_parts, [&callback](void* ptr){ callback(static_cast<T*>(ptr)); });
 }
 
 } // namespace threadsafe
@@ -0,0 +1,298 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class SPSCQueue.
+ *
+ * @Copyright (C) 2017  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Parking.h"
+#include "utils/cpu_relax.h"
+#include "utils/macros.h"
+#include <atomic>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+
+namespace threadsafe {
+
+// A bounded, lock-free queue for exactly one producer thread and one consumer thread.
+//
+// This replaces an Unlocked<std::deque<T>, policy::Primitive<ConditionVariable>> on hot paths:
+// pushing and popping an element doesn't lock anything; it is a copy (or move) of the element,
+// a store of one index and a fence. Only when the queue is full (for the producer) or empty
+// (for the consumer) the thread spins a little and then sleeps on a Parking (the same futex
+// based mechanism as used by ConditionVariable).
+//
+//   threadsafe::SPSCQueue<Message, 1024> queue;
+//
+//   // Producer thread.
+//   queue.push(Message{...});                       // Blocks while the queue is full.
+//
+//   // Consumer thread.
+//   Message message = queue.pop();                  // Blocks while the queue is empty.
+//
+// The batch functions (try_push_n, push_n, try_pop_n and pop_n) only pay once for the fence
+// and the update of the index, for the whole batch.
+//
+// CAPACITY must be a power of two. The index of the producer and that of the consumer are each
+// on their own cache line, together with a cached copy of the other index: the producer only
+// reads the index of the consumer again when the queue seems full, and vice versa.
+template<typename T, size_t CAPACITY>
+class SPSCQueue
+{
+  static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two.");
+  static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T>, "T must be nothrow move constructible.");
+
+ public:
+  static constexpr size_t cache_line_size = 64;
+  static constexpr size_t capacity = CAPACITY;
+
+ private:
+  static constexpr size_t mask = CAPACITY - 1;
+  static constexpr int max_spin_count = 128;
+
+  struct Slot
+  {
+    alignas(T) unsigned char m_storage[sizeof(T)];
+
+    T* data() { return std::launder(reinterpret_cast<T*>(m_storage)); }
+  };
+
+  // Written by the producer.
+  alignas(cache_line_size) std::atomic<size_t> m_tail;  // The number of elements that were pushed.
+  size_t m_cached_head;                                 // A copy of m_head, as last read by the producer.
+  // Written by the consumer.
+  alignas(cache_line_size) std::atomic<size_t> m_head;  // The number of elements that were popped.
+  size_t m_cached_tail;                                 // A copy of m_tail, as last read by the consumer.
+  // Only written by threads that are about to sleep.
+  alignas(cache_line_size) Parking m_not_empty;         // The consumer waits here while the queue is empty.
+  Parking m_not_full;                                   // The producer waits here while the queue is full.
+  alignas(cache_line_size) Slot m_slots[CAPACITY];
+
+  // Producer: return the number of free slots, but at most n.
+  size_t free_slots(size_t tail, size_t n)
+  {
+    size_t free = CAPACITY - (tail - m_cached_head);
+    if (free < n)
+    {
+      m_cached_head = m_head.load(std::memory_order::acquire);
+      free = CAPACITY - (tail - m_cached_head);
+    }
+    return free < n ? free : n;
+  }
+
+  // Consumer: return the number of available elements, but at most n.
+  size_t available(size_t head, size_t n)
+  {
+    size_t count = m_cached_tail - head;
+    if (count < n)
+    {
+      m_cached_tail = m_tail.load(std::memory_order::acquire);
+      count = m_cached_tail - head;
+    }
+    return count < n ? count : n;
+  }
+
+  // Spin for a while, then sleep on parking, until pred() returns true.
+  template<typename PRED>
+  static void block_until(Parking& parking, PRED pred)
+  {
+    for (int spin_count = 0; spin_count < max_spin_count; ++spin_count)
+    {
+      if (pred())
+        return;
+      cpu_relax();
+    }
+    parking.wait_until(pred);
+  }
+
+  void block_while_full()
+  {
+    size_t tail = m_tail.load(std::memory_order::relaxed);
+    block_until(m_not_full, [this, tail](){ return m_head.load(std::memory_order::seq_cst) != tail - CAPACITY; });
+  }
+
+  void block_while_empty()
+  {
+    size_t head = m_head.load(std::memory_order::relaxed);
+    block_until(m_not_empty, [this, head](){ return m_tail.load(std::memory_order::seq_cst) != head; });
+  }
+
+ public:
+  SPSCQueue() : m_tail(0), m_cached_head(0), m_head(0), m_cached_tail(0) { }
+  SPSCQueue(SPSCQueue const&) = delete;
+
+  ~SPSCQueue()
+  {
+    for (size_t head = m_head.load(std::memory_order::relaxed); head != m_tail.load(std::memory_order::relaxed); ++head)
+      m_slots[head & mask].data()->~T();
+  }
+
+  //---------------------------------------------------------------------------
+  // Producer.
+
+  // Construct an element at the end of the queue from args. Returns false if the queue is full.
+  template<typename... ARGS>
+  bool try_emplace(ARGS&&... args)
+  {
+    size_t tail = m_tail.load(std::memory_order::relaxed);
+    if (AI_UNLIKELY(free_slots(tail, 1) == 0))
+      return false;
+    new (m_slots[tail & mask].m_storage) T(std::forward<ARGS>(args)...);
+    m_tail.store(tail + 1, std::memory_order::release);
+    m_not_empty.notify_waiters();
+    return true;
+  }
+
+  bool try_push(T const& value) { return try_emplace(value); }
+  bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+  // Like try_emplace, but block while the queue is full.
+  template<typename... ARGS>
+  void emplace(ARGS&&... args)
+  {
+    while (AI_UNLIKELY(!try_emplace(std::forward<ARGS>(args)...)))
+      block_while_full();
+  }
+
+  void push(T const& value) { emplace(value); }
+  void push(T&& value) { emplace(std::move(value)); }
+
+  // Push the elements first, first + 1, ..., as long as there is room, but no more than n. Returns the number of elements pushed.
+  // Use std::make_move_iterator to move the elements into the queue.
+  template<typename ITER>
+  size_t try_push_n(ITER first, size_t n)
+  {
+    size_t tail = m_tail.load(std::memory_order::relaxed);
+    size_t count = free_slots(tail, n);
+    if (AI_UNLIKELY(count == 0))
+      return 0;
+    size_t i = 0;
+    try
+    {
+      for (; i < count; ++i, ++first)
+        new (m_slots[(tail + i) & mask].m_storage) T(*first);
+    }
+    catch (...)
+    {
+      // Nothing was pushed.
+      while (i > 0)
+        m_slots[(tail + --i) & mask].data()->~T();
+      throw;
+    }
+    m_tail.store(tail + count, std::memory_order::release);
+    m_not_empty.notify_waiters();
+    return count;
+  }
+
+  // Push n elements, blocking whenever the queue is full.
+  template<typename ITER>
+  void push_n(ITER first, size_t n)
+  {
+    for (;;)
+    {
+      size_t count = try_push_n(first, n);
+      if ((n -= count) == 0)
+        return;
+      std::advance(first, count);
+      block_while_full();
+    }
+  }
+
+  //---------------------------------------------------------------------------
+  // Consumer.
+
+  // Remove the first element from the queue. Returns std::nullopt if the queue is empty.
+  std::optional<T> try_pop()
+  {
+    size_t head = m_head.load(std::memory_order::relaxed);
+    if (AI_UNLIKELY(available(head, 1) == 0))
+      return std::nullopt;
+    T* element = m_slots[head & mask].data();
+    std::optional<T> result(std::move(*element));
+    element->~T();
+    m_head.store(head + 1, std::memory_order::release);
+    m_not_full.notify_waiters();
+    return result;
+  }
+
+  // Like try_pop, but block while the queue is empty.
+  T pop()
+  {
+    for (;;)
+    {
+      if (std::optional<T> result = try_pop(); AI_LIKELY(result))
+        return std::move(*result);
+      block_while_empty();
+    }
+  }
+
+  // Move at most n elements from the queue to *out, *(out + 1), ... Returns the number of elements popped.
+  template<typename OUT>
+  size_t try_pop_n(OUT out, size_t n)
+  {
+    size_t head = m_head.load(std::memory_order::relaxed);
+    size_t count = available(head, n);
+    if (AI_UNLIKELY(count == 0))
+      return 0;
+    for (size_t i = 0; i < count; ++i, ++out)
+    {
+      T* element = m_slots[(head + i) & mask].data();
+      *out = std::move(*element);
+      element->~T();
+    }
+    m_head.store(head + count, std::memory_order::release);
+    m_not_full.notify_waiters();
+    return count;
+  }
+
+  // Like try_pop_n, but block while the queue is empty. Returns the number of elements popped (at least one).
+  template<typename OUT>
+  size_t pop_n(OUT out, size_t n)
+  {
+    for (;;)
+    {
+      if (size_t count = try_pop_n(out, n); AI_LIKELY(count > 0))
+        return count;
+      block_while_empty();
+    }
+  }
+
+  //---------------------------------------------------------------------------
+  // Any thread; only a snapshot when the producer or consumer are active.
+
+  size_t size() const
+  {
+    size_t head = m_head.load(std::memory_order::acquire);
+    return m_tail.load(std::memory_order::acquire) - head;
+  }
+
+  bool empty() const { return size() == 0; }
+};
+
+} // namespace threadsafe
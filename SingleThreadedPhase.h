@@ -0,0 +1,123 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class SingleThreadedPhase.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "utils/threading/aithreadid.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <atomic>
+#include <thread>
+
+namespace threadsafe {
+
+// A process-wide switch that turns AIMutex and AIReadWriteSpinLock into no-ops while the
+// process is known to have only one thread; for example while loading a lot of data at
+// start up, before any worker thread was created.
+//
+//   int main()
+//   {
+//     threadsafe::SingleThreadedPhase::begin();
+//     load_snapshots();                            // All wat's and rat's here skip their atomic operations.
+//     threadsafe::SingleThreadedPhase::end();      // Must be called before starting the first other thread.
+//     start_workers();
+//   }
+//
+// The phase can only be entered once and ending it is a one-way transition. No lock
+// may be held while the phase ends: a lock that was taken during the phase wasn't really
+// taken, so releasing it after the phase would release a mutex that isn't locked.
+// In debug mode both, as well as that only the thread that called begin() locks anything
+// during the phase (see aithreadid::is_single_threaded), are asserted. Obviously, waiting
+// for a ConditionVariable during the phase is not possible either.
+//
+// Outside of the phase the only cost is a relaxed load of a flag that is never written
+// after start up (and hence shared, read-only, by all cores).
+class SingleThreadedPhase
+{
+ private:
+  inline static std::atomic<bool> s_active;
+  inline static bool s_ended;
+#ifdef CWDEBUG
+  inline static std::thread::id s_thread_id;
+  inline static int s_locked;                   // The number of locks that were elided and not released yet.
+#endif
+
+ public:
+  // Start the single threaded phase. Call this at most once, while there are no other threads.
+  static void begin()
+  {
+    // The phase can not be restarted after it ended.
+    ASSERT(!s_ended && !s_active.load(std::memory_order::relaxed));
+#ifdef CWDEBUG
+    s_thread_id = std::this_thread::get_id();
+#endif
+    s_active.store(true, std::memory_order::relaxed);
+  }
+
+  // End the single threaded phase. This must be called before starting another thread that might lock anything.
+  static void end()
+  {
+    // All locks that were taken during the phase must have been released.
+    ASSERT(s_locked == 0);
+    s_ended = true;
+    s_active.store(false, std::memory_order::release);
+    // Nothing that is done after this may be reordered with the store above.
+    std::atomic_thread_fence(std::memory_order::seq_cst);
+  }
+
+  static bool active()
+  {
+    bool active = s_active.load(std::memory_order::relaxed);
+    // Only the thread that called begin() may lock anything during the single threaded phase.
+    ASSERT(!active || aithreadid::is_single_threaded(s_thread_id));
+    return active;
+  }
+
+  // Called by the mutexes instead of taking a lock: returns true if the lock must be skipped.
+  static bool elide_lock()
+  {
+    if (AI_LIKELY(!active()))
+      return false;
+#ifdef CWDEBUG
+    ++s_locked;
+#endif
+    return true;
+  }
+
+  // Called by the mutexes instead of releasing a lock: returns true if releasing the lock must be skipped.
+  static bool elide_unlock()
+  {
+    if (AI_LIKELY(!active()))
+      return false;
+#ifdef CWDEBUG
+    --s_locked;
+#endif
+    return true;
+  }
+};
+
+} // namespace threadsafe
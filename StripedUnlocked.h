@@ -0,0 +1,109 @@
+/**
+ * threadsafe -- Threading utilities: object oriented (read/write) locking and more.
+ *
+ * @file
+ * @brief Declaration of class StripedUnlocked.
+ *
+ * @Copyright (C) 2026  Carlo Wood.
+ *
+ * pub   dsa3072/C155A4EEE4E527A2 2018-08-16 Carlo Wood (CarloWood on Libera) <carlo@alinoe.com>
+ * fingerprint: 8020 B266 6305 EE2F D53E  6827 C155 A4EE E4E5 27A2
+ *
+ * This file is part of threadsafe.
+ *
+ * Threadsafe is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Threadsafe is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with threadsafe.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "threadsafe.h"
+#include <array>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <cstddef>
+
+namespace threadsafe {
+
+// A fixed number of independently locked T's (stripes), that do not share cache lines.
+//
+// Each stripe is an Unlocked<T, policy::CacheLineIsolated<POLICY>>, so that the mutex
+// and the data of a stripe are on different cache lines and no cache line is shared
+// between two stripes. Locking one stripe therefore never slows down threads that are
+// using another stripe.
+//
+// A stripe can be selected by index, by key (using std::hash) or per thread (local),
+// the latter being useful for things like counters; for example,
+//
+//   threadsafe::StripedUnlocked<Statistics, threadsafe::policy::Primitive<AIMutex>, 16> stats;
+//
+//   // Every thread updates its own stripe (as long as there are no more than 16 threads).
+//   { decltype(stats)::wat stats_w(stats.local()); stats_w->add(sample); }
+//
+//   // Combine the results.
+//   for (auto const& stripe : stats)
+//     total += decltype(stats)::crat(stripe)->sum();
+template<typename T, typename POLICY, size_t N>
+class StripedUnlocked
+{
+ public:
+  using unlocked_type = Unlocked<T, policy::CacheLineIsolated<POLICY>>;
+  using value_type = unlocked_type;
+  using crat = typename unlocked_type::crat;
+  using rat = typename unlocked_type::rat;
+  using wat = typename unlocked_type::wat;
+
+  static constexpr size_t number_of_stripes = N;
+
+ private:
+  std::array<unlocked_type, N> m_stripes;
+
+  inline static std::atomic<unsigned int> s_next_stripe;
+
+  template<size_t... I, typename... ARGS>
+  StripedUnlocked(std::index_sequence<I...>, ARGS const&... args) : m_stripes{{ ((void)I, unlocked_type(args...))... }} { }
+
+ public:
+  StripedUnlocked() = default;
+
+  // Construct every stripe with the same arguments.
+  template<typename... ARGS>
+  explicit StripedUnlocked(std::in_place_t, ARGS const&... args) : StripedUnlocked(std::make_index_sequence<N>{}, args...) { }
+
+  unlocked_type& operator[](size_t stripe) { return m_stripes[stripe]; }
+  unlocked_type const& operator[](size_t stripe) const { return m_stripes[stripe]; }
+
+  // Return the stripe that key maps to.
+  template<typename KEY>
+  unlocked_type& for_key(KEY const& key) { return m_stripes[std::hash<KEY>{}(key) % N]; }
+  template<typename KEY>
+  unlocked_type const& for_key(KEY const& key) const { return m_stripes[std::hash<KEY>{}(key) % N]; }
+
+  // Return the stripe that is used by the current thread.
+  // Stripes are handed out round-robin, so that the first N threads each have their own stripe.
+  unlocked_type& local()
+  {
+    static thread_local unsigned int const stripe_index = s_next_stripe.fetch_add(1, std::memory_order::relaxed) % N;
+    return m_stripes[stripe_index];
+  }
+
+  static constexpr size_t size() { return N; }
+
+  auto begin() { return m_stripes.begin(); }
+  auto end() { return m_stripes.end(); }
+  auto begin() const { return m_stripes.begin(); }
+  auto end() const { return m_stripes.end(); }
+};
+
+} // namespace threadsafe
@@ -0,0 +1,732 @@
+// threadsafe_bench -- compare the mutexes and policies of threadsafe under configurable workloads.
+//
+// Usage: threadsafe_bench [--threads=1,2,4] [--read=0.5,0.9,0.99] [--cs=0,64] [--upgrade=0,0.01] [--duration=100] [--filter=substring]
+//
+//   --help      print the usage and exit.
+//   --threads   comma separated list of the number of threads to run.
+//   --read      comma separated list of the fraction of the operations that only read.
+//   --cs        comma separated list of critical section lengths (the number of accesses of the protected data).
+//   --upgrade   comma separated list of the fraction of the read operations that convert their read lock into a write lock.
+//   --duration  the duration of each run in milliseconds.
+//   --filter    only run the benchmarks whose name contains this substring.
+//
+// Every combination of the above is run for each lock type, then the PointerStorage and counter benchmarks are run for each number of threads.
+// The acquire latency is the time it took to obtain the lock (including the time it takes to read the clock, which is
+// roughly the value that you see for an uncontended lock), printed as percentiles in nanoseconds.
+
+#include "sys.h"
+#include "threadsafe/threadsafe.h"
+#include "threadsafe/AIBiasedMutex.h"
+#include "threadsafe/AICohortReadWriteLock.h"
+#include "threadsafe/AIMCSMutex.h"
+#include "threadsafe/AIMutex.h"
+#include "threadsafe/AIPhaseFairReadWriteLock.h"
+#include "threadsafe/AIReadWriteMutex.h"
+#include "threadsafe/AIReadWriteSpinLock.h"
+#include "threadsafe/AIShardedReadWriteLock.h"
+#include "threadsafe/ConcurrentMap.h"
+#include "threadsafe/ConditionVariable.h"
+#include "threadsafe/MPSCQueue.h"
+#include "threadsafe/FlatCombining.h"
+#include "threadsafe/PointerStorage.h"
+#include "threadsafe/SPSCQueue.h"
+#include "threadsafe/StripedUnlocked.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Adapter that gives std::shared_mutex the interface required by threadsafe::policy::ReadWrite.
+//
+// std::shared_mutex has no way to convert a read lock into a write lock; rd2wrlock is implemented
+// by releasing the read lock and then obtaining the write lock, which is NOT atomic (another writer
+// can get in between). That is fine for this benchmark, which only measures the cost of the calls.
+class StdSharedMutex
+{
+ private:
+  std::shared_mutex m_mutex;
+
+ public:
+  void rdlock() { m_mutex.lock_shared(); }
+  void rdunlock() { m_mutex.unlock_shared(); }
+  void wrlock() { m_mutex.lock(); }
+  void wrunlock() { m_mutex.unlock(); }
+  void rd2wrlock() { m_mutex.unlock_shared(); m_mutex.lock(); }
+  void wr2rdlock() { m_mutex.unlock(); m_mutex.lock_shared(); }
+  void rd2wryield() { std::this_thread::yield(); }
+};
+
+// The protected data.
+struct Data
+{
+  std::array<uint64_t, 8> m_values{};
+
+  uint64_t read(unsigned int cs) const
+  {
+    uint64_t sum = 0;
+    for (unsigned int i = 0; i < cs; ++i)
+      sum += m_values[i & 7];
+    return sum;
+  }
+
+  void write(unsigned int cs)
+  {
+    for (unsigned int i = 0; i < cs; ++i)
+      ++m_values[i & 7];
+    ++m_values[0];
+  }
+};
+
+struct Workload
+{
+  int threads;
+  double read_ratio;
+  unsigned int cs;
+  double upgrade_rate;
+};
+
+enum operation_type
+{
+  read_op,
+  upgrade_op,
+  write_op
+};
+
+// Per thread state of a benchmark run.
+class Worker
+{
+ private:
+  uint64_t m_rng;
+  uint32_t m_read_threshold;
+  uint32_t m_upgrade_threshold;
+
+ public:
+  int const m_id;                       // The index of this worker (0 ... threads - 1).
+  std::vector<uint32_t> m_latencies;    // Acquire latencies in nanoseconds.
+  uint64_t m_sink = 0;                  // The result of reads, to stop the compiler from optimizing them away.
+
+  Worker(int id, Workload const& workload) :
+    m_rng(0x9E3779B97F4A7C15ULL * (id + 1)),
+    m_read_threshold(static_cast<uint32_t>(workload.read_ratio * 4294967295.0)),
+    m_upgrade_threshold(static_cast<uint32_t>(workload.upgrade_rate * 4294967295.0)),
+    m_id(id)
+  {
+    m_latencies.reserve(1 << 20);
+  }
+
+  uint32_t random()
+  {
+    // xorshift64*.
+    m_rng ^= m_rng >> 12;
+    m_rng ^= m_rng << 25;
+    m_rng ^= m_rng >> 27;
+    return static_cast<uint32_t>((m_rng * 0x2545F4914F6CDD1DULL) >> 32);
+  }
+
+  operation_type next_operation()
+  {
+    if (random() >= m_read_threshold)
+      return write_op;
+    return random() < m_upgrade_threshold ? upgrade_op : read_op;
+  }
+
+  void record(clock_type::time_point start)
+  {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+    m_latencies.push_back(static_cast<uint32_t>(std::min<decltype(ns)>(ns, UINT32_MAX)));
+  }
+};
+
+struct Result
+{
+  uint64_t operations;
+  double seconds;
+  std::vector<uint32_t> latencies;
+};
+
+// Run `operation(worker)` on workload.threads threads for duration, and collect the results.
+template<typename OPERATION>
+Result run(Workload const& workload, std::chrono::milliseconds duration, OPERATION const& operation)
+{
+  std::vector<Worker> workers;
+  workers.reserve(workload.threads);
+  for (int id = 0; id < workload.threads; ++id)
+    workers.emplace_back(id, workload);
+
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> stop{false};
+  std::vector<uint64_t> operations(workload.threads);
+  std::vector<std::thread> threads;
+  for (int id = 0; id < workload.threads; ++id)
+    threads.emplace_back([&, id](){
+      Worker& worker = workers[id];
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order::acquire))
+        std::this_thread::yield();
+      uint64_t count = 0;
+      do
+      {
+        operation(worker);
+        ++count;
+      }
+      while (!stop.load(std::memory_order::relaxed));
+      operations[id] = count;
+    });
+
+  while (ready.load() != workload.threads)
+    std::this_thread::yield();
+  auto start = clock_type::now();
+  go.store(true, std::memory_order::release);
+  std::this_thread::sleep_for(duration);
+  stop.store(true, std::memory_order::relaxed);
+  for (std::thread& thread : threads)
+    thread.join();
+  auto end = clock_type::now();
+
+  Result result{0, std::chrono::duration<double>(end - start).count(), {}};
+  for (int id = 0; id < workload.threads; ++id)
+  {
+    result.operations += operations[id];
+    result.latencies.insert(result.latencies.end(), workers[id].m_latencies.begin(), workers[id].m_latencies.end());
+  }
+  return result;
+}
+
+uint32_t percentile(std::vector<uint32_t>& latencies, double fraction)
+{
+  if (latencies.empty())
+    return 0;
+  auto nth = latencies.begin() + static_cast<size_t>(fraction * (latencies.size() - 1));
+  std::nth_element(latencies.begin(), nth, latencies.end());
+  return *nth;
+}
+
+void print_header()
+{
+  std::cout << std::left << std::setw(58) << "benchmark" << std::right <<
+    std::setw(8) << "threads" << std::setw(8) << "read" << std::setw(6) << "cs" << std::setw(9) << "upgrade" <<
+    std::setw(12) << "Mops/s" << std::setw(10) << "p50 [ns]" << std::setw(10) << "p99 [ns]" << std::setw(11) << "p999 [ns]" << '\n';
+}
+
+void print_result(std::string const& name, Workload const& workload, Result& result)
+{
+  std::cout << std::left << std::setw(58) << name << std::right <<
+    std::setw(8) << workload.threads << std::setw(8) << workload.read_ratio << std::setw(6) << workload.cs <<
+    std::setw(9) << workload.upgrade_rate <<
+    std::setw(12) << std::fixed << std::setprecision(3) << result.operations / result.seconds * 1e-6 << std::defaultfloat <<
+    std::setw(10) << percentile(result.latencies, 0.5) <<
+    std::setw(10) << percentile(result.latencies, 0.99) <<
+    std::setw(11) << percentile(result.latencies, 0.999) << '\n' << std::flush;
+}
+
+//-----------------------------------------------------------------------------
+// The benchmarks.
+
+// A read/write lock used directly.
+template<typename RW>
+void bench_raw_rw(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  RW rw;
+  Data data;
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    auto start = clock_type::now();
+    if (op == write_op)
+    {
+      rw.wrlock();
+      worker.record(start);
+      data.write(workload.cs);
+      rw.wrunlock();
+      return;
+    }
+    for (;;)
+    {
+      rw.rdlock();
+      worker.record(start);
+      worker.m_sink += data.read(workload.cs);
+      if (op == upgrade_op)
+      {
+        try
+        {
+          rw.rd2wrlock();
+        }
+        catch (std::exception const&)
+        {
+          rw.rdunlock();
+          rw.rd2wryield();
+          start = clock_type::now();
+          continue;
+        }
+        data.write(workload.cs);
+        rw.wrunlock();
+        return;
+      }
+      rw.rdunlock();
+      return;
+    }
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// A mutex used directly; every operation is a write.
+template<typename M>
+void bench_raw_mutex(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  M m;
+  Data data;
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    auto start = clock_type::now();
+    m.lock();
+    worker.record(start);
+    if (op == read_op)
+      worker.m_sink += data.read(workload.cs);
+    else
+      data.write(workload.cs);
+    m.unlock();
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// An Unlocked object with the read/write policy, accessed with rat / wat.
+template<typename RW>
+void bench_unlocked_rw(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  using data_t = threadsafe::Unlocked<Data, threadsafe::policy::ReadWrite<RW>>;
+  data_t data;
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    auto start = clock_type::now();
+    if (op == write_op)
+    {
+      typename data_t::wat data_w(data);
+      worker.record(start);
+      data_w->write(workload.cs);
+      return;
+    }
+    if (op == read_op)
+    {
+      typename data_t::rat data_r(data);
+      worker.record(start);
+      worker.m_sink += data_r->read(workload.cs);
+      return;
+    }
+    for (;;)
+    {
+      try
+      {
+        typename data_t::rat data_r(data);
+        worker.record(start);
+        worker.m_sink += data_r->read(workload.cs);
+        typename data_t::wat data_w(data_r);
+        data_w->write(workload.cs);
+      }
+      catch (std::exception const&)
+      {
+        data.rd2wryield();
+        start = clock_type::now();
+        continue;
+      }
+      break;
+    }
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// An Unlocked object with the primitive policy; every operation is a wat.
+template<typename M>
+void bench_unlocked_primitive(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  using data_t = threadsafe::Unlocked<Data, threadsafe::policy::Primitive<M>>;
+  data_t data;
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    auto start = clock_type::now();
+    typename data_t::wat data_w(data);
+    worker.record(start);
+    if (op == read_op)
+      worker.m_sink += data_w->read(workload.cs);
+    else
+      data_w->write(workload.cs);
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// An Unlocked object with the flat combining policy; reads use a rat (or a wat for Primitive), writes use combine.
+template<typename POLICY>
+void bench_unlocked_combining(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  using data_t = threadsafe::Unlocked<Data, threadsafe::policy::FlatCombining<POLICY>>;
+  data_t data;
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    auto start = clock_type::now();
+    if (op == read_op)
+    {
+      typename data_t::rat data_r(data);
+      worker.record(start);
+      worker.m_sink += data_r->read(workload.cs);
+      return;
+    }
+    // The latency includes the time that the write itself takes, possibly by another thread.
+    unsigned int cs = workload.cs;
+    data.combine([cs](Data& d){ d.write(cs); });
+    worker.record(start);
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// A counter per thread, each counter being an Unlocked object with the primitive policy.
+struct Counter
+{
+  uint64_t m_value = 0;
+};
+
+// Every operation locks the counter of the current thread and increments it. There is no contention
+// for the locks, but without cache line isolation neighbouring counters share a cache line.
+template<typename COUNTERS>
+void bench_counters(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  COUNTERS counters;
+  auto operation = [&](Worker& worker){
+    auto start = clock_type::now();
+    typename COUNTERS::value_type::wat counter_w(counters[worker.m_id % counters.size()]);
+    worker.record(start);
+    ++counter_w->m_value;
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+using adjacent_counters_type = std::array<threadsafe::Unlocked<Counter, threadsafe::policy::Primitive<AIMutex>>, 256>;
+using striped_counters_type = threadsafe::StripedUnlocked<Counter, threadsafe::policy::Primitive<AIMutex>, 256>;
+
+// A map with 4096 keys; reads look up a random key, writes increment the value of a random key.
+// With a single shard this is the same as an Unlocked<std::unordered_map<>, ReadWrite<AIReadWriteSpinLock>>.
+template<size_t SHARDS>
+void bench_concurrent_map(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  using map_t = threadsafe::ConcurrentMap<uint32_t, uint64_t, threadsafe::policy::ReadWrite<AIReadWriteSpinLock>, SHARDS>;
+  constexpr uint32_t number_of_keys = 4096;
+  map_t map;
+  for (uint32_t key = 0; key < number_of_keys; ++key)
+    map.insert_or_assign(key, 0);
+  auto operation = [&](Worker& worker){
+    operation_type op = worker.next_operation();
+    uint32_t key = worker.random() % number_of_keys;
+    auto start = clock_type::now();
+    if (op == write_op)
+    {
+      typename map_t::wat map_w(map.shard(key));
+      worker.record(start);
+      ++(*map_w)[key];
+      return;
+    }
+    typename map_t::rat map_r(map.shard(key));
+    worker.record(start);
+    worker.m_sink += map_r->find(key)->second;
+  };
+  Result result = run(workload, duration, operation);
+  print_result(name, workload, result);
+}
+
+// PointerStorage with enough room: every operation is an insert followed by an erase (and a get in between).
+void bench_pointer_storage(Workload const& workload, std::chrono::milliseconds duration)
+{
+  threadsafe::VoidPointerStorage storage(1024 * workload.threads);
+  auto operation = [&](Worker& worker){
+    auto start = clock_type::now();
+    threadsafe::VoidPointerStorage::index_type index = storage.insert(&worker);
+    worker.record(start);
+    if (storage.get(index) != &worker)
+      std::abort();
+    storage.erase(index);
+  };
+  Result result = run(workload, duration, operation);
+  print_result("PointerStorage insert/get/erase", workload, result);
+}
+
+// PointerStorage with bursts of 256 pointers: every operation is an insert_n followed by an erase_n.
+void bench_pointer_storage_batch(Workload const& workload, std::chrono::milliseconds duration)
+{
+  constexpr int batch = 256;
+  threadsafe::VoidPointerStorage storage(1024 * workload.threads);
+  auto operation = [&](Worker& worker){
+    std::array<void*, batch> values;
+    values.fill(&worker);
+    std::array<threadsafe::VoidPointerStorage::index_type, batch> indices;
+    auto start = clock_type::now();
+    storage.insert_n(values, indices);
+    worker.record(start);
+    storage.erase_n(indices);
+  };
+  Result result = run(workload, duration, operation);
+  print_result("PointerStorage insert_n/erase_n (256)", workload, result);
+}
+
+// PointerStorage that starts with a single entry, so that it has to grow (call increase_size) many times.
+// Each operation fills a new storage with 256 pointers per thread and then erases them again.
+void bench_pointer_storage_growth(Workload const& workload, std::chrono::milliseconds duration)
+{
+  constexpr int batch = 256;
+  Result total{0, 0.0, {}};
+  auto end = clock_type::now() + duration;
+  do
+  {
+    threadsafe::VoidPointerStorage storage(1);
+    // Let every thread do exactly one batch.
+    std::vector<Worker> workers;
+    for (int id = 0; id < workload.threads; ++id)
+      workers.emplace_back(id, workload);
+    auto start = clock_type::now();
+    std::vector<std::thread> threads;
+    for (int id = 0; id < workload.threads; ++id)
+      threads.emplace_back([&, id](){
+        Worker& worker = workers[id];
+        std::array<threadsafe::VoidPointerStorage::index_type, batch> indices;
+        for (int i = 0; i < batch; ++i)
+        {
+          auto insert_start = clock_type::now();
+          indices[i] = storage.insert(&worker);
+          worker.record(insert_start);
+        }
+        for (int i = 0; i < batch; ++i)
+          storage.erase(indices[i]);
+      });
+    for (std::thread& thread : threads)
+      thread.join();
+    total.seconds += std::chrono::duration<double>(clock_type::now() - start).count();
+    total.operations += static_cast<uint64_t>(batch) * workload.threads;
+    for (Worker const& worker : workers)
+      total.latencies.insert(total.latencies.end(), worker.m_latencies.begin(), worker.m_latencies.end());
+  }
+  while (clock_type::now() < end);
+  print_result("PointerStorage insert (growing)", workload, total);
+}
+
+// The pattern that SPSCQueue and MPSCQueue replace.
+class LockedQueue
+{
+ private:
+  using queue_type = threadsafe::Unlocked<std::deque<uint64_t>, threadsafe::policy::Primitive<threadsafe::ConditionVariable>>;
+  queue_type m_queue;
+
+ public:
+  void push(uint64_t value)
+  {
+    queue_type::wat queue_w(m_queue);
+    queue_w->push_back(value);
+    queue_w.notify_one();
+  }
+
+  uint64_t pop()
+  {
+    queue_type::wat queue_w(m_queue);
+    queue_w.wait([&](){ return !queue_w->empty(); });
+    uint64_t value = queue_w->front();
+    queue_w->pop_front();
+    return value;
+  }
+};
+
+// workload.threads producers push as fast as they can for duration, while the main thread pops everything.
+// The latencies are those of push.
+template<typename QUEUE>
+void bench_queue(std::string const& name, Workload const& workload, std::chrono::milliseconds duration)
+{
+  constexpr uint64_t done = UINT64_MAX;
+  QUEUE queue;
+  std::vector<Worker> workers;
+  for (int id = 0; id < workload.threads; ++id)
+    workers.emplace_back(id, workload);
+  std::atomic<bool> stop{false};
+  auto start = clock_type::now();
+  std::vector<std::thread> threads;
+  for (int id = 0; id < workload.threads; ++id)
+    threads.emplace_back([&, id](){
+      Worker& worker = workers[id];
+      for (uint64_t value = 0; !stop.load(std::memory_order::relaxed); ++value)
+      {
+        auto push_start = clock_type::now();
+        queue.push(value);
+        worker.record(push_start);
+      }
+      queue.push(done);
+    });
+  Result result{0, 0.0, {}};
+  std::thread timer([&](){ std::this_thread::sleep_for(duration); stop = true; });
+  for (int producers = workload.threads; producers > 0;)
+  {
+    if (queue.pop() == done)
+      --producers;
+    else
+      ++result.operations;
+  }
+  result.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+  timer.join();
+  for (std::thread& thread : threads)
+    thread.join();
+  for (Worker const& worker : workers)
+    result.latencies.insert(result.latencies.end(), worker.m_latencies.begin(), worker.m_latencies.end());
+  print_result(name, workload, result);
+}
+
+//-----------------------------------------------------------------------------
+// Command line parsing.
+
+template<typename T>
+std::vector<T> parse_list(std::string const& arg)
+{
+  std::vector<T> result;
+  std::istringstream iss(arg);
+  std::string item;
+  while (std::getline(iss, item, ','))
+  {
+    std::istringstream item_ss(item);
+    T value;
+    if (!(item_ss >> value))
+    {
+      std::cerr << "threadsafe_bench: invalid value \"" << item << "\".\n";
+      std::exit(1);
+    }
+    result.push_back(value);
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::vector<int> thread_counts;
+  for (int n = 1; n < static_cast<int>(std::thread::hardware_concurrency()); n *= 2)
+    thread_counts.push_back(n);
+  thread_counts.push_back(std::max(1U, std::thread::hardware_concurrency()));
+  std::vector<double> read_ratios = { 0.5, 0.9, 0.99 };
+  std::vector<unsigned int> cs_lengths = { 0, 64 };
+  std::vector<double> upgrade_rates = { 0.0, 0.01 };
+  std::chrono::milliseconds duration{100};
+  std::string filter;
+
+  std::string const usage = std::string("Usage: ") + argv[0] +
+    " [--threads=1,2,4] [--read=0.5,0.9,0.99] [--cs=0,64] [--upgrade=0,0.01] [--duration=100] [--filter=substring]\n";
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    auto value = arg.substr(arg.find('=') + 1);
+    if (arg == "--help" || arg == "-h")
+    {
+      std::cout << usage;
+      return 0;
+    }
+    else if (arg.starts_with("--threads="))
+      thread_counts = parse_list<int>(value);
+    else if (arg.starts_with("--read="))
+      read_ratios = parse_list<double>(value);
+    else if (arg.starts_with("--cs="))
+      cs_lengths = parse_list<unsigned int>(value);
+    else if (arg.starts_with("--upgrade="))
+      upgrade_rates = parse_list<double>(value);
+    else if (arg.starts_with("--duration="))
+      duration = std::chrono::milliseconds{parse_list<int>(value).at(0)};
+    else if (arg.starts_with("--filter="))
+      filter = value;
+    else
+    {
+      std::cerr << usage;
+      return 1;
+    }
+  }
+
+  using bench_function = void (*)(std::string const&, Workload const&, std::chrono::milliseconds);
+  struct Benchmark
+  {
+    char const* name;
+    bench_function function;
+  };
+  std::array<Benchmark, 26> const benchmarks = {{
+    { "AIMutex", &bench_raw_mutex<AIMutex> },
+    { "AIMCSMutex", &bench_raw_mutex<AIMCSMutex> },
+    { "AICohortMutex", &bench_raw_mutex<AICohortMutex> },
+    { "AIBiasedMutex", &bench_raw_mutex<AIBiasedMutex> },
+    { "std::mutex", &bench_raw_mutex<std::mutex> },
+    { "AIReadWriteMutex", &bench_raw_rw<AIReadWriteMutex> },
+    { "AIReadWriteSpinLock", &bench_raw_rw<AIReadWriteSpinLock> },
+    { "AIShardedReadWriteLock", &bench_raw_rw<AIShardedReadWriteLock> },
+    { "AIPhaseFairReadWriteLock", &bench_raw_rw<AIPhaseFairReadWriteLock> },
+    { "AICohortReadWriteLock", &bench_raw_rw<AICohortReadWriteLock> },
+    { "std::shared_mutex", &bench_raw_rw<StdSharedMutex> },
+    { "Unlocked<Primitive<AIMutex>>", &bench_unlocked_primitive<AIMutex> },
+    { "Unlocked<Primitive<AIMCSMutex>>", &bench_unlocked_primitive<AIMCSMutex> },
+    { "Unlocked<Primitive<AICohortMutex>>", &bench_unlocked_primitive<AICohortMutex> },
+    { "Unlocked<Primitive<AIBiasedMutex>>", &bench_unlocked_primitive<AIBiasedMutex> },
+    { "Unlocked<Primitive<std::mutex>>", &bench_unlocked_primitive<std::mutex> },
+    { "Unlocked<ReadWrite<AIReadWriteMutex>>", &bench_unlocked_rw<AIReadWriteMutex> },
+    { "Unlocked<ReadWrite<AIReadWriteSpinLock>>", &bench_unlocked_rw<AIReadWriteSpinLock> },
+    { "Unlocked<ReadWrite<AIShardedReadWriteLock>>", &bench_unlocked_rw<AIShardedReadWriteLock> },
+    { "Unlocked<ReadWrite<AIPhaseFairReadWriteLock>>", &bench_unlocked_rw<AIPhaseFairReadWriteLock> },
+    { "Unlocked<ReadWrite<AICohortReadWriteLock>>", &bench_unlocked_rw<AICohortReadWriteLock> },
+    { "Unlocked<ReadWrite<std::shared_mutex>>", &bench_unlocked_rw<StdSharedMutex> },
+    { "Unlocked<FlatCombining<Primitive<AIMutex>>>", &bench_unlocked_combining<threadsafe::policy::Primitive<AIMutex>> },
+    { "Unlocked<FlatCombining<ReadWrite<AIReadWriteSpinLock>>>", &bench_unlocked_combining<threadsafe::policy::ReadWrite<AIReadWriteSpinLock>> },
+    { "ConcurrentMap<1 shard>", &bench_concurrent_map<1> },
+    { "ConcurrentMap<64 shards>", &bench_concurrent_map<64> }
+  }};
+
+  print_header();
+  for (Benchmark const& benchmark : benchmarks)
+  {
+    if (std::string(benchmark.name).find(filter) == std::string::npos)
+      continue;
+    for (int threads : thread_counts)
+      for (double read_ratio : read_ratios)
+        for (unsigned int cs : cs_lengths)
+          for (double upgrade_rate : upgrade_rates)
+            benchmark.function(benchmark.name, { threads, read_ratio, cs, upgrade_rate }, duration);
+  }
+
+  for (int threads : thread_counts)
+  {
+    Workload workload{ threads, 0.0, 0, 0.0 };
+    if (std::string("PointerStorage insert/get/erase").find(filter) != std::string::npos)
+      bench_pointer_storage(workload, duration);
+    if (std::string("PointerStorage insert_n/erase_n (256)").find(filter) != std::string::npos)
+      bench_pointer_storage_batch(workload, duration);
+    if (std::string("PointerStorage insert (growing)").find(filter) != std::string::npos)
+      bench_pointer_storage_growth(workload, duration);
+    if (std::string("Unlocked<Primitive<AIMutex>> counters").find(filter) != std::string::npos)
+      bench_counters<adjacent_counters_type>("Unlocked<Primitive<AIMutex>> counters", workload, duration);
+    if (std::string("StripedUnlocked<Primitive<AIMutex>> counters").find(filter) != std::string::npos)
+      bench_counters<striped_counters_type>("StripedUnlocked<Primitive<AIMutex>> counters", workload, duration);
+    if (std::string("Unlocked<deque, Primitive<ConditionVariable>> queue").find(filter) != std::string::npos)
+      bench_queue<LockedQueue>("Unlocked<deque, Primitive<ConditionVariable>> queue", workload, duration);
+    if (threads == 1 && std::string("SPSCQueue").find(filter) != std::string::npos)
+      bench_queue<threadsafe::SPSCQueue<uint64_t, 1024>>("SPSCQueue", workload, duration);
+    if (std::string("MPSCQueue").find(filter) != std::string::npos)
+      bench_queue<threadsafe::MPSCQueue<uint64_t, 1024>>("MPSCQueue", workload, duration);
+  }
+}
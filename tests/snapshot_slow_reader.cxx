@@ -0,0 +1,169 @@
+// snapshot_slow_reader -- force a reader of AISnapshotLock to be overtaken by two publishes.
+//
+// The reader loads the index of the reader counters and is then stalled until a writer
+// published a new version (and deleted the previous one). Next it loads the current
+// version and is stalled again, while another writer publishes yet another version.
+// That second publish must wait for the reader, so that the version that the reader
+// loaded is not released before the reader added its reference to it.
+//
+// This test must be compiled with THREADSAFE_RCU_TEST_HOOKS=1.
+
+#include "sys.h"
+#include "threadsafe/AISnapshotLock.h"
+#include "debug.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#if !THREADSAFE_RCU_TEST_HOOKS
+#error "Compile snapshot_slow_reader with THREADSAFE_RCU_TEST_HOOKS=1."
+#endif
+
+namespace {
+
+struct Version : public AIRefCount
+{
+  static inline std::atomic<int> s_deleted_mask;        // Bit n is set when version n was deleted.
+
+  int const m_id;
+
+  Version(int id) : m_id(id) { }
+  ~Version() override { s_deleted_mask.fetch_or(1 << m_id); }
+
+  // Versions live in static storage that is never freed, so that a version that is used
+  // after it was deleted can be detected without crashing.
+  static void* operator new(std::size_t size);
+  static void operator delete(void*) { }
+};
+
+alignas(Version) char s_version_storage[3][sizeof(Version)];
+int s_allocated_versions;
+
+void* Version::operator new(std::size_t size)
+{
+  assert(size == sizeof(Version) && s_allocated_versions < 3);
+  return s_version_storage[s_allocated_versions++];
+}
+
+enum Stage
+{
+  start,
+  reader_loaded_index,
+  first_publish_done,
+  reader_loaded_version,
+  second_publish_done
+};
+
+std::mutex s_stage_mutex;
+std::condition_variable s_stage_cv;
+Stage s_stage = start;
+thread_local bool t_is_reader;
+
+void set_stage(Stage stage)
+{
+  {
+    std::lock_guard<std::mutex> lk(s_stage_mutex);
+    s_stage = stage;
+  }
+  s_stage_cv.notify_all();
+}
+
+Stage current_stage()
+{
+  std::lock_guard<std::mutex> lk(s_stage_mutex);
+  return s_stage;
+}
+
+// Returns false if stage was not reached before timeout.
+bool wait_for_stage(Stage stage, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+{
+  std::unique_lock<std::mutex> lk(s_stage_mutex);
+  return s_stage_cv.wait_for(lk, timeout, [stage]{ return s_stage >= stage; });
+}
+
+void index_loaded()
+{
+  if (!t_is_reader || current_stage() != start)
+    return;
+  set_stage(reader_loaded_index);
+  wait_for_stage(first_publish_done);
+}
+
+void version_loaded()
+{
+  if (!t_is_reader || current_stage() != first_publish_done)
+    return;
+  set_stage(reader_loaded_version);
+  // The second publish must wait for us; if it doesn't then the version that we loaded is deleted now.
+  wait_for_stage(second_publish_done, std::chrono::milliseconds(200));
+}
+
+void publish(AISnapshotLock& lock, Version* version)
+{
+  lock.wrlock();
+  lock.publish(version);
+  lock.wrunlock();
+}
+
+} // namespace
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  AISnapshotLock lock;
+  Version* v0 = new Version(0);
+  Version* v1 = new Version(1);
+  Version* v2 = new Version(2);
+  publish(lock, v0);
+
+  AIRCULock::s_index_loaded_hook = &index_loaded;
+  AIRCULock::s_version_loaded_hook = &version_loaded;
+
+  AIRefCount const* acquired = nullptr;
+  std::thread reader([&]{
+    t_is_reader = true;
+    acquired = lock.acquire();
+  });
+  // Wait until the reader is stalled right after loading the index.
+  if (!wait_for_stage(reader_loaded_index))
+  {
+    std::cerr << "The reader never loaded the index.\n";
+    reader.detach();
+    return EXIT_FAILURE;
+  }
+  publish(lock, v1);                            // Deletes v0.
+  set_stage(first_publish_done);
+  if (!wait_for_stage(reader_loaded_version))
+  {
+    std::cerr << "The reader never loaded a version.\n";
+    reader.detach();
+    return EXIT_FAILURE;
+  }
+  std::thread writer([&]{
+    publish(lock, v2);                          // Releases v1, which must not be deleted while the reader didn't add its reference yet.
+    set_stage(second_publish_done);
+  });
+  reader.join();
+  writer.join();
+
+  AIRCULock::s_index_loaded_hook = nullptr;
+  AIRCULock::s_version_loaded_hook = nullptr;
+
+  int deleted_mask = Version::s_deleted_mask.load();
+  if (acquired != v1 || (deleted_mask & 2))
+  {
+    std::cerr << "The reader acquired " << (acquired == v0 ? "v0" : acquired == v1 ? "v1" : "an unexpected version") <<
+      " but that was deleted (deleted mask: " << deleted_mask << ").\n";
+    return EXIT_FAILURE;
+  }
+  intrusive_ptr_release(acquired);              // Deletes v1.
+  std::cout << "The reader acquired v1, which was kept alive until it was released.\n";
+  return EXIT_SUCCESS;
+}
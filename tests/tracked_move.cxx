@@ -0,0 +1,98 @@
+// tracked_move -- move a final class derived from UnlockedTrackedObject while a reader waits for it.
+//
+// The tracker is lock-free, so the move constructor of UnlockedTrackedObject must unlock the
+// moved-from object before it waits for the readers that might still be using its mutex.
+// The final class passes its own LockFinalMove down to UnlockedTrackedObject, which then has
+// to unlock the object that was locked by the LockFinalMove of the final class.
+//
+// The main thread write locks the object, the mover thread then blocks in the move constructor
+// and the reader thread blocks in tracked_rat. When the main thread unlocks the object the waiting
+// writer (the mover) gets it first. If the move then doesn't unlock the moved-from object, the
+// reader never gets the lock and the move never finishes.
+
+#include "sys.h"
+#include "threadsafe/ObjectTracker.h"
+#include "threadsafe/AIReadWriteMutex.h"
+#include "debug.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+class locked_Node;
+class Node;
+using NodeTracker = threadsafe::ObjectTracker<Node, locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>, threadsafe::tracking::LockFree>;
+
+class locked_Node : public threadsafe::TrackedObject<Node, NodeTracker>
+{
+ private:
+  int m_value;
+
+ public:
+  locked_Node(int value) : m_value(value) { }
+
+  int value() const { return m_value; }
+};
+
+class Node final : public threadsafe::UnlockedTrackedObject<locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>>
+{
+ public:
+  Node(int value) : UnlockedTrackedObject<locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>>(value) { }
+  Node(Node&& other) : UnlockedTrackedObject<locked_Node, threadsafe::policy::ReadWrite<AIReadWriteMutex>>(threadsafe::LockFinalMove<Node>{std::move(other)}) { }
+};
+
+#include "threadsafe/ObjectTracker.inl.h"
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::unique_ptr<Node> node = std::make_unique<Node>(42);
+  std::unique_ptr<Node> moved_node;
+  std::shared_ptr<NodeTracker> tracker = std::weak_ptr<NodeTracker>(*node).lock();
+
+  std::atomic<int> finished_threads = 0;
+  int read_value = 0;
+  std::thread mover;
+  std::thread reader;
+  {
+    NodeTracker::wat node_w = tracker->tracked_wat();
+    mover = std::thread([&]{
+      moved_node = std::make_unique<Node>(std::move(*node));
+      node.reset();
+      finished_threads.fetch_add(1);
+    });
+    // Give the mover the time to block in the move constructor.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    reader = std::thread([&]{
+      NodeTracker::rat node_r = tracker->tracked_rat();
+      read_value = node_r->value();
+      finished_threads.fetch_add(1);
+    });
+    // Give the reader the time to block in tracked_rat.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (finished_threads.load() < 2)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      std::cerr << "Moving the node while a reader is waiting for it deadlocked.\n";
+      std::_Exit(EXIT_FAILURE);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  mover.join();
+  reader.join();
+
+  if (read_value != 42 || tracker->tracked_rat()->value() != 42)
+  {
+    std::cerr << "The reader read " << read_value << " instead of 42.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "The node was moved while a reader was waiting for it.\n";
+  return EXIT_SUCCESS;
+}
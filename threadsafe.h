@@ -63,6 +63,24 @@
  *   2023/06/12
  *   - Unlocked no longer takes align and blocksize as template arguments.
  *   - Unlocked is now derived from protected from T instead of obscuring with Bits.
+ *
+ *   2026/10/14
+ *   - Added policy::SeqLock.
+ *   - Added policy::RCU.
+ *   - Added policy::Instrumented.
+ *   - Added lock_all.
+ *   - Added try_wat, try_rat and their timed variants.
+ *   - Added urat (UpgradableReadAccess).
+ *   - Added policy::CacheLineIsolated.
+ *   - Added wait_until, wait_for and notify_all to the Primitive access types (for ConditionVariable).
+ *   - Added async_wat and async_rat (see AsyncAccess.h).
+ *   - Added tracking::LockFree, a lock-free mode of ObjectTracker.
+ *   - Added policy::FlatCombining and Unlocked::combine (see FlatCombining.h).
+ *   - Added policy::Snapshot.
+ *   - Added LockTrace (THREADSAFE_TRACE_LOCKS).
+ *   - Added SingleThreadedPhase (see SingleThreadedPhase.h).
+ *   - Added ConcurrentMap (see ConcurrentMap.h).
+ *   - Added SPSCQueue and MPSCQueue.
  */
 
 // This file defines a wrapper template class for arbitrary types T
@@ -74,7 +92,7 @@
 // whose constructor takes the wrapper object as argument. Creating the
 // access object obtains the lock, while destructing it releases the lock.
 //
-// There are three types of policies: ReadWrite, Primitive and OneThread.
+// There are six types of policies: ReadWrite, Primitive, SeqLock, RCU, Snapshot and OneThread.
 // The latter doesn't use any mutex and doesn't do any locking, it does
 // however check that all accesses are done by the same (one) thread.
 //
@@ -85,8 +103,52 @@
 // policy::Primitive<MUTEX> allows primitive locking. MUTEX needs to
 // provide the following member functions: lock and unlock.
 //
+// policy::SeqLock protects small, trivially copyable, objects that are
+// read very often and written rarely. A crat or rat does not lock anything
+// but makes a copy of the object, retrying when a writer interfered.
+// Converting a rat into a wat throws a std::exception when the object
+// was changed after the rat made its copy.
+//
+// policy::RCU (read-copy-update) is for large objects that are read very
+// often. A crat or rat pins the current version of the object without
+// ever blocking, while a wat writes to a private copy that is published
+// when the wat is destructed. The previous version is deleted as soon as
+// the last reader that pinned it is gone. Converting a rat into a wat
+// throws when a new version was published after the rat was created.
+// UnlockedBase is not supported.
+//
+// policy::Snapshot (copy-on-write) is for objects that are read very often
+// and changed rarely, like configuration. A crat or rat is a reference counted,
+// immutable, snapshot of the object that does not hold any lock and can be kept
+// (and copied) for as long as needed, while a wat writes to a private copy that
+// replaces the current version when the wat is destructed. Converting a rat into
+// a wat throws when a new version was published after the rat was created.
+// UnlockedBase is not supported.
+//
+// policy::Instrumented<POLICY> can be wrapped around a ReadWrite or Primitive
+// policy to collect lock contention statistics per object (see LockStats).
+//
+// policy::CacheLineIsolated<POLICY> can be wrapped around any policy to put
+// the mutex on its own cache line, separated from T and from neighbouring
+// objects (see also StripedUnlocked).
+//
+// policy::FlatCombining<POLICY> (see FlatCombining.h) can be wrapped around
+// a ReadWrite or Primitive policy to add Unlocked::combine, which lets the
+// thread that holds the write lock execute the small updates of all threads
+// that are waiting for it in one batch.
+//
 // policy::OneThread does no locking but allows testing that an object
-// is really only accessed by a single thread (in debug mode).
+// is really only accessed by a single thread (in debug mode). For objects
+// that are nearly always accessed by the same thread, but not always,
+// use policy::Primitive<AIBiasedMutex>.
+//
+// lock_all can be used to obtain the access types of several ReadWrite
+// or Primitive protected objects at once, without the risk of a deadlock.
+//
+// async_wat and async_rat (see AsyncAccess.h) can be co_await-ed by a coroutine
+// to obtain a wat or rat of an object that is protected by
+// policy::ReadWrite<AIAsyncReadWriteMutex>, suspending the coroutine instead
+// of blocking the thread when the lock is contended.
 //
 // For generality it is advised to always make the distincting between
 // read-only access and read/write access, even for the primitive (and
@@ -102,6 +164,7 @@
 //
 // mydata_t::crat : Const Read Access Type (cannot be converted to a wat).
 // mydata_t::rat  : Read Access Type.
+// mydata_t::urat : Upgradable Read Access Type.
 // mydata_t::wat  : (read/)Write Access Type.
 //
 // crat (const read access type) provides read-only access to a const Unlocked
@@ -113,6 +176,13 @@
 // of its scope) followed by calling rd2wryield(). After that one can loop
 // back and recreate the rat. See the documentation of Unlocked for more details.
 //
+// urat (upgradable read access type) is a rat that can be converted to a wat
+// without ever throwing. Only one thread at a time can have a urat of a given
+// object (other threads can still have a crat or rat at the same time). Converting
+// a rat to a wat throws while another thread has a urat. The RWMUTEX of a ReadWrite
+// policy must provide urdlock, urdunlock and urd2wrlock for this; for the Primitive
+// and OneThread policies a urat is the same as a rat.
+//
 // wat (write access type) provides (read and) write access to a non-const
 // Unlocked wrapper. It can safely be converted to a rat, for example by passing it
 // to a function that takes a rat, but that doesn't release the write lock
@@ -130,6 +200,11 @@
 #include "utils/threading/aithreadid.h"
 #include "utils/AIRefCount.h"
 #include "utils/is_specialization_of.h"
+#include "AISeqLock.h"
+#include "AIRCULock.h"
+#include "AISnapshotLock.h"
+#include "LockStats.h"
+#include "LockTrace.h"
 
 #include <new>
 #include <cstddef>
@@ -139,7 +214,15 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <typeinfo>
+#include <tuple>
+#include <optional>
+#include <array>
+#include <algorithm>
+#include <functional>
 #include <boost/integer/common_factor.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 #ifdef CWDEBUG
 // Set this to 1 to print tracking information about Unlocked and UnlockedBase to dc::tracked.
@@ -161,12 +244,26 @@ class Unlocked;
 template<typename TrackedLockedType, typename POLICY_MUTEX>
 class UnlockedTrackedObject;
 
-template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX>
+namespace tracking {
+// The last template parameter of ObjectTracker (see ObjectTracker.h).
+struct Locked;          // The tracked pointer is protected by a read/write spin lock.
+struct LockFree;        // The tracked pointer is published atomically.
+} // namespace tracking
+
+template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX, typename TRACKING = tracking::Locked>
 class ObjectTracker;
 
 template<typename TrackedType, typename Tracker>
 class TrackedObject;
 
+template<typename UNLOCKED, typename ACCESS>
+struct LockRequest;
+
+template<typename UNLOCKED, typename ACCESS, typename EXECUTOR>
+class AsyncAccessAwaiter;
+
+struct AccessTracer;
+
 template<typename T, typename POLICY_MUTEX>
 requires std::derived_from<T, AIRefCount>
 void intrusive_ptr_add_ref(Unlocked<T, POLICY_MUTEX> const* ptr);
@@ -223,17 +320,26 @@ template <typename DerivedClass>
 class LockFinalMove
 {
  private:
+  template<typename U>
+  friend class LockFinalMove;
+
   DerivedClass* ptr_;
-  bool locked_;
+  bool locked_;                 // True if this object locked ptr_ and still has to unlock it.
+  bool* owner_locked_;          // Points to locked_ of the LockFinalMove that locked ptr_.
 
  public:
-  LockFinalMove(ConceptRvalue<DerivedClass> auto&& orig) : ptr_(&orig), locked_(true)
+  LockFinalMove(ConceptRvalue<DerivedClass> auto&& orig) : ptr_(&orig), locked_(true), owner_locked_(&locked_)
   {
     ptr_->do_wrlock();
   }
 
+  // A converted (or moved) LockFinalMove doesn't own the lock, but unlock() still releases it.
   template<typename U>
-  LockFinalMove(LockFinalMove<U>&& orig) : ptr_(orig.operator->()), locked_(false)
+  LockFinalMove(LockFinalMove<U>&& orig) : ptr_(orig.operator->()), locked_(false), owner_locked_(orig.owner_locked_)
+  {
+  }
+
+  LockFinalMove(LockFinalMove&& orig) : ptr_(orig.ptr_), locked_(false), owner_locked_(orig.owner_locked_)
   {
   }
 
@@ -243,6 +349,16 @@ class LockFinalMove
       ptr_->do_wrunlock();
   }
 
+  // Unlock the moved object before the end of the constructor of the final object.
+  void unlock()
+  {
+    if (*owner_locked_)
+    {
+      ptr_->do_wrunlock();
+      *owner_locked_ = false;
+    }
+  }
+
   // Use pointer semantics to access the underlaying type DerivedClass.
   DerivedClass* operator->() { return ptr_; }
   DerivedClass&& operator*() { return std::move(*ptr_); }
@@ -447,6 +563,7 @@ class Unlocked : public POLICY_MUTEX,           // Initialize this first because
     // The access types.
     using crat = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::const_read_access_type;
     using rat = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::read_access_type;
+    using urat = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::upgradable_read_access_type;
     using wat = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::write_access_type;
     using w2rCarry = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::write_to_read_carry;
     using ratBase = typename POLICY_MUTEX::template access_types<Unlocked<T, POLICY_MUTEX>>::read_access_base_type;
@@ -465,7 +582,7 @@ class Unlocked : public POLICY_MUTEX,           // Initialize this first because
     template<typename TrackedType, typename Tracker>
     friend class TrackedObject;
 
-    template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX2>
+    template<typename TrackedType, typename TrackedLockedType, typename POLICY_MUTEX2, typename TRACKING>
     friend class ObjectTracker;
 
     template <typename DerivedClass>
@@ -540,6 +657,11 @@ class Unlocked : public POLICY_MUTEX,           // Initialize this first because
     // additional arguments: that will just use the above constructor.
     Unlocked(Unlocked&& other) : Unlocked(LockFinalMove<Unlocked>{std::move(other)}) { }
 
+    // Execute op(T&) while holding the write lock, possibly by another thread (see policy::FlatCombining).
+    template<typename OP>
+    requires requires { POLICY_MUTEX::is_flat_combining; }
+    void combine(OP&& op) { POLICY_MUTEX::combine(*this, op); }
+
   protected:
     // Used by the above constructors.
     Unlocked const& do_rdlock() const;
@@ -551,6 +673,7 @@ class Unlocked : public POLICY_MUTEX,           // Initialize this first because
     // Only these may access the object (through ptr()).
     friend crat;
     friend rat;
+    friend urat;
     friend wat;
     friend w2rCarry;
 
@@ -631,6 +754,9 @@ struct AccessConst;
 
 template<class UNLOCKED>
 struct OTAccessConst;
+
+template<class UNLOCKED>
+struct SLAccessConst;
 #endif
 
 #if THREADSAFE_TRACK_UNLOCKED
@@ -811,7 +937,7 @@ class ConstUnlockedBase : public POLICY_MUTEX::reference_type
     // Only these may access the object (through ptr()).
     friend crat;
     // The crat type is ConstReadAccess<threadsafe::ConstUnlockedBase<BASE, POLICY_MUTEX>>.
-    // But the base class of ReadAccess, AccessConst and OTAccessConst, which use UnlockedBase, also need
+    // But the base class of ReadAccess, AccessConst, OTAccessConst and SLAccessConst, which use UnlockedBase, also need
     // access to increment_ref/decrement_ref:
     friend ratBase;
 
@@ -838,6 +964,7 @@ class UnlockedBase : public ConstUnlockedBase<BASE, POLICY_MUTEX>
     using const_unlocked_type = ConstUnlockedBase<BASE, POLICY_MUTEX>;
 
     using rat = typename policy_type::template access_types<UnlockedBase<BASE, POLICY_MUTEX>>::read_access_type;
+    using urat = typename policy_type::template access_types<UnlockedBase<BASE, POLICY_MUTEX>>::upgradable_read_access_type;
     using wat = typename policy_type::template access_types<UnlockedBase<BASE, POLICY_MUTEX>>::write_access_type;
     using w2rCarry = typename ConstUnlockedBase<BASE, POLICY_MUTEX>::w2rCarry;
     using ratBase = typename ConstUnlockedBase<BASE, POLICY_MUTEX>::ratBase;
@@ -889,6 +1016,7 @@ class UnlockedBase : public ConstUnlockedBase<BASE, POLICY_MUTEX>
 
   protected:
     friend rat;
+    friend urat;
     friend wat;
     friend w2rCarry;
     friend ratBase;
@@ -898,6 +1026,122 @@ class UnlockedBase : public ConstUnlockedBase<BASE, POLICY_MUTEX>
     BASE* ptr() { return ConstUnlockedBase<BASE, POLICY_MUTEX>::m_base; }
 };
 
+// The name of UNLOCKED, as used by LockStats and LockTrace.
+template<typename UNLOCKED>
+char const* unlocked_name()
+{
+#if THREADSAFE_TRACK_UNLOCKED
+  return NameUnlocked<typename UNLOCKED::data_type, typename UNLOCKED::policy_type>::name;
+#else
+  return typeid(UNLOCKED).name();
+#endif
+}
+
+/**
+ * @brief Record the lock events of an access object in the LockTrace of the current thread.
+ *
+ * This is an empty class unless THREADSAFE_TRACE_LOCKS is set.
+ */
+struct AccessTracer
+{
+#if THREADSAFE_TRACE_LOCKS
+  static constexpr bool enabled = true;
+
+  bool m_traced = false;                ///< True if acquire_end was recorded, but release wasn't yet.
+
+  template<typename UNLOCKED>
+  static void const* object(UNLOCKED const& unlocked) { return &unlocked.UNLOCKED::policy_type::mutex(); }
+
+  template<typename UNLOCKED>
+  void locking(UNLOCKED const& unlocked) { LockTrace::record(LockTrace::acquire_start, object(unlocked)); }
+
+  template<typename UNLOCKED>
+  void locked(UNLOCKED const& unlocked, LockStats::access_type type)
+  {
+    LockTrace::record(LockTrace::acquire_end, object(unlocked), unlocked_name<UNLOCKED>(), type);
+    m_traced = true;
+  }
+
+  template<typename UNLOCKED>
+  void unlocking(UNLOCKED const& unlocked)
+  {
+    if (!m_traced)
+      return;
+    m_traced = false;
+    LockTrace::record(LockTrace::release, object(unlocked));
+  }
+
+  template<typename UNLOCKED>
+  void rd2wrlock_failed(UNLOCKED const& unlocked) { LockTrace::record(LockTrace::rd2wrlock_exception, object(unlocked)); }
+#else
+  static constexpr bool enabled = false;
+
+  template<typename UNLOCKED> void locking(UNLOCKED const&) { }
+  template<typename UNLOCKED> void locked(UNLOCKED const&, LockStats::access_type) { }
+  template<typename UNLOCKED> void unlocking(UNLOCKED const&) { }
+  template<typename UNLOCKED> void rd2wrlock_failed(UNLOCKED const&) { }
+#endif
+};
+
+/**
+ * @brief Measure the time that an access object waited for and held its lock.
+ *
+ * This only traces (see AccessTracer) unless POLICY is a policy::Instrumented.
+ */
+template<typename POLICY>
+struct AccessProbe : AccessTracer
+{
+};
+
+template<typename POLICY>
+requires (POLICY::is_instrumented)
+struct AccessProbe<POLICY> : AccessTracer
+{
+  using clock_type = std::chrono::steady_clock;
+  static constexpr bool enabled = true;
+
+  clock_type::time_point m_start;       ///< When locking started, or when the lock was obtained (if m_locked is true).
+  bool m_locked = false;
+
+  static uint64_t ns(clock_type::duration duration) { return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(); }
+
+  template<typename UNLOCKED>
+  void locking(UNLOCKED const& unlocked)
+  {
+    AccessTracer::locking(unlocked);
+    m_start = clock_type::now();
+  }
+
+  template<typename UNLOCKED>
+  void locked(UNLOCKED const& unlocked, LockStats::access_type type)
+  {
+    clock_type::time_point now = clock_type::now();
+    AccessTracer::locked(unlocked, type);
+    LockStats& lock_stats = unlocked.UNLOCKED::policy_type::lock_stats();
+    lock_stats.set_name(unlocked_name<UNLOCKED>());
+    lock_stats.add_acquisition(type, ns(now - m_start));
+    m_start = now;
+    m_locked = true;
+  }
+
+  template<typename UNLOCKED>
+  void unlocking(UNLOCKED const& unlocked)
+  {
+    AccessTracer::unlocking(unlocked);
+    if (!m_locked)
+      return;
+    m_locked = false;
+    unlocked.UNLOCKED::policy_type::lock_stats().add_hold(ns(clock_type::now() - m_start));
+  }
+
+  template<typename UNLOCKED>
+  void rd2wrlock_failed(UNLOCKED const& unlocked)
+  {
+    AccessTracer::rd2wrlock_failed(unlocked);
+    unlocked.UNLOCKED::policy_type::lock_stats().add_rd2wrlock_exception();
+  }
+};
+
 /**
  * @brief Read lock object and provide read access.
  */
@@ -914,7 +1158,8 @@ struct ConstReadAccess
       read2writelocked,	///< A WriteAccess constructed from a ReadAccess.
       writelocked,	///< A WriteAccess constructed from a ThreadSafe.
       write2writelocked,///< A WriteAccess constructed from (the ReadAccess base class of) a WriteAccess.
-      carrylocked	///< A ReadAccess constructed from a Write2ReadCarry.
+      carrylocked,	///< A ReadAccess constructed from a Write2ReadCarry.
+      upgradelocked	///< An UpgradableReadAccess.
     };
 
     /// Construct a ConstReadAccess from a constant Unlocked.
@@ -924,7 +1169,9 @@ struct ConstReadAccess
 #if THREADSAFE_DEBUG
       m_unlocked->increment_ref();
 #endif // THREADSAFE_DEBUG
+      m_probe.locking(*this->m_unlocked);
       m_unlocked->UNLOCKED::policy_type::mutex().rdlock(std::forward<Args>(args)...);
+      m_probe.locked(*m_unlocked, LockStats::crat);
     }
 
     /// Destruct the Access object.
@@ -933,6 +1180,7 @@ struct ConstReadAccess
     {
       if (AI_UNLIKELY(!m_unlocked))
         return;
+      m_probe.unlocking(*m_unlocked);
       if (m_state == readlocked)
 	m_unlocked->UNLOCKED::policy_type::mutex().rdunlock();
       else if (m_state == writelocked)
@@ -961,12 +1209,13 @@ struct ConstReadAccess
 
     UNLOCKED* m_unlocked;       ///< Pointer to the object that we provide access to.
     state_type const m_state;   ///< The lock state that m_unlocked is in.
+    [[no_unique_address]] AccessProbe<typename UNLOCKED::policy_type> m_probe;
 
     // Disallow copy constructing directly.
     ConstReadAccess(ConstReadAccess const&) = delete;
 
     // Move constructor.
-    ConstReadAccess(ConstReadAccess&& rvalue) : m_unlocked(rvalue.m_unlocked), m_state(rvalue.m_state) { rvalue.m_unlocked = nullptr; }
+    ConstReadAccess(ConstReadAccess&& rvalue) : m_unlocked(rvalue.m_unlocked), m_state(rvalue.m_state), m_probe(rvalue.m_probe) { rvalue.m_unlocked = nullptr; }
 };
 
 template<class UNLOCKED>
@@ -977,6 +1226,10 @@ template<class UNLOCKED>
 requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
 struct WriteAccess;
 
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+struct UpgradableReadAccess;
+
 /**
  * @brief Allow to carry the read access from a wat to a rat.
  */
@@ -1024,7 +1277,9 @@ struct ReadAccess : public ConstReadAccess<UNLOCKED>
     template<typename ...Args>
     explicit ReadAccess(UNLOCKED& unlocked, Args&&... args) : ConstReadAccess<UNLOCKED>(unlocked, readlocked)
     {
+      this->m_probe.locking(*this->m_unlocked);
       this->m_unlocked->UNLOCKED::policy_type::mutex().rdlock(std::forward<Args>(args)...);
+      this->m_probe.locked(*this->m_unlocked, LockStats::rat);
     }
 
     /// Construct a ReadAccess from a Write2ReadCarry object containing an read locked Unlocked. Upon destruction leave the Unlocked read locked.
@@ -1033,11 +1288,37 @@ struct ReadAccess : public ConstReadAccess<UNLOCKED>
       assert(w2rc.m_used); // Always pass a w2rCarry to a wat first.
     }
 
+    /// Return a ReadAccess, or an empty optional if the read lock can not be obtained without blocking.
+    static std::optional<ReadAccess> try_lock(UNLOCKED& unlocked)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_rdlock())
+        return std::nullopt;
+      return ReadAccess(unlocked, std::adopt_lock);
+    }
+
+    /// Return a ReadAccess, or an empty optional if the read lock could not be obtained before deadline.
+    template<typename Clock, typename Duration>
+    static std::optional<ReadAccess> try_lock_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_rdlock_until(deadline))
+        return std::nullopt;
+      return ReadAccess(unlocked, std::adopt_lock);
+    }
+
   protected:
     /// Constructor used by WriteAccess.
     ReadAccess(UNLOCKED& unlocked, state_type state) : ConstReadAccess<UNLOCKED>(unlocked, state) { }
 
+    /// Constructor used by try_lock: unlocked is already read locked.
+    ReadAccess(UNLOCKED& unlocked, std::adopt_lock_t) : ConstReadAccess<UNLOCKED>(unlocked, readlocked)
+    {
+      this->m_probe.locking(*this->m_unlocked);
+      this->m_probe.locked(*this->m_unlocked, LockStats::rat);
+    }
+
     friend struct WriteAccess<UNLOCKED>;
+    friend struct UpgradableReadAccess<UNLOCKED>;
+    template<typename UNLOCKED2, typename ACCESS, typename EXECUTOR> friend class ::threadsafe::AsyncAccessAwaiter;
 
   public:
     operator ConstReadAccess<typename UNLOCKED::const_unlocked_type> const&() const
@@ -1049,6 +1330,50 @@ struct ReadAccess : public ConstReadAccess<UNLOCKED>
     }
 };
 
+// A RWMUTEX that supports the upgradable read lock.
+template<typename RWMUTEX>
+concept ConceptUpgradableReadWriteMutex = requires(RWMUTEX& rwmutex)
+{
+  rwmutex.urdlock();
+  rwmutex.urdunlock();
+  rwmutex.urd2wrlock();
+};
+
+/**
+ * @brief Read lock object that can always be promoted to write access.
+ *
+ * Only one thread at a time can have an upgradable read lock, but it coexists with
+ * normal readers. Converting it into a wat never throws; it is the other threads,
+ * that try to convert a rat into a wat at the same time, that throw instead.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+struct UpgradableReadAccess : public ReadAccess<UNLOCKED>
+{
+  public:
+    using ConstReadAccess<UNLOCKED>::upgradelocked;
+
+    /// Construct an UpgradableReadAccess from a non-constant Unlocked.
+    template<typename ...Args>
+    explicit UpgradableReadAccess(UNLOCKED& unlocked, Args&&... args) : ReadAccess<UNLOCKED>(unlocked, upgradelocked)
+    {
+      this->m_probe.locking(*this->m_unlocked);
+      this->m_unlocked->UNLOCKED::policy_type::mutex().urdlock(std::forward<Args>(args)...);
+      this->m_probe.locked(*this->m_unlocked, LockStats::urat);
+    }
+
+    // ~ConstReadAccess doesn't unlock anything in the upgradelocked state.
+    ~UpgradableReadAccess()
+    {
+      if (AI_UNLIKELY(!this->m_unlocked))
+        return;
+      this->m_probe.unlocking(*this->m_unlocked);
+      this->m_unlocked->UNLOCKED::policy_type::mutex().urdunlock();
+    }
+
+    UpgradableReadAccess(UpgradableReadAccess&& rvalue) = default;
+};
+
 /**
  * @brief Write lock object and provide read/write access.
  */
@@ -1061,13 +1386,16 @@ struct WriteAccess : public ReadAccess<UNLOCKED>
     using ConstReadAccess<UNLOCKED>::read2writelocked;
     using ConstReadAccess<UNLOCKED>::writelocked;
     using ConstReadAccess<UNLOCKED>::write2writelocked;
+    using ConstReadAccess<UNLOCKED>::upgradelocked;
     using state_type = typename ReadAccess<UNLOCKED>::state_type;
 
     /// Construct a WriteAccess from a non-constant Unlocked.
     template<typename ...Args>
     explicit WriteAccess(UNLOCKED& unlocked, Args&&... args) : ReadAccess<UNLOCKED>(unlocked, writelocked)
     {
+      this->m_probe.locking(*this->m_unlocked);
       this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock(std::forward<Args>(args)...);
+      this->m_probe.locked(*this->m_unlocked, LockStats::wat);
     }
 
     /// Promote read access to write access.
@@ -1076,7 +1404,22 @@ struct WriteAccess : public ReadAccess<UNLOCKED>
     {
       if (access.m_state == readlocked)
       {
-	this->m_unlocked->UNLOCKED::policy_type::mutex().rd2wrlock();
+        this->m_probe.locking(*this->m_unlocked);
+        if constexpr (decltype(this->m_probe)::enabled)
+        {
+          try
+          {
+            this->m_unlocked->UNLOCKED::policy_type::mutex().rd2wrlock();
+          }
+          catch (...)
+          {
+            this->m_probe.rd2wrlock_failed(*this->m_unlocked);
+            throw;
+          }
+        }
+        else
+          this->m_unlocked->UNLOCKED::policy_type::mutex().rd2wrlock();
+        this->m_probe.locked(*this->m_unlocked, LockStats::wat);
         // We should have initialized the base class with read2writelocked, but if rd2wrlock() throws
         // then the base class destructor ~ConstReadAccess would call wr2rdlock() as if obtaining the
         // write-lock had succeeded. In order to stop it from doing that, we did set m_state to
@@ -1084,6 +1427,18 @@ struct WriteAccess : public ReadAccess<UNLOCKED>
         // we correct this value.
         const_cast<state_type&>(this->m_state) = read2writelocked;
       }
+      else if (access.m_state == upgradelocked)
+      {
+        // Only the mutex of an UpgradableReadAccess can be in this state.
+        if constexpr (ConceptUpgradableReadWriteMutex<std::remove_reference_t<decltype(this->m_unlocked->UNLOCKED::policy_type::mutex())>>)
+        {
+          this->m_probe.locking(*this->m_unlocked);
+          this->m_unlocked->UNLOCKED::policy_type::mutex().urd2wrlock();
+          this->m_probe.locked(*this->m_unlocked, LockStats::wat);
+          // Convert back to the upgradable read lock upon destruction.
+          const_cast<state_type&>(this->m_state) = read2writelocked;
+        }
+      }
     }
 
     /// Construct a WriteAccess from a Write2ReadCarry object containing an unlocked Unlocked. Upon destruction leave the Unlocked read locked.
@@ -1091,7 +1446,26 @@ struct WriteAccess : public ReadAccess<UNLOCKED>
     {
       assert(!w2rc.m_used); // Always pass a w2rCarry to the wat first. There can only be one wat.
       w2rc.m_used = true;
+      this->m_probe.locking(*this->m_unlocked);
       this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock();
+      this->m_probe.locked(*this->m_unlocked, LockStats::w2rCarry);
+    }
+
+    /// Return a WriteAccess, or an empty optional if the write lock can not be obtained without blocking.
+    static std::optional<WriteAccess> try_lock(UNLOCKED& unlocked)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_wrlock())
+        return std::nullopt;
+      return WriteAccess(unlocked, std::adopt_lock);
+    }
+
+    /// Return a WriteAccess, or an empty optional if the write lock could not be obtained before deadline.
+    template<typename Clock, typename Duration>
+    static std::optional<WriteAccess> try_lock_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_wrlock_until(deadline))
+        return std::nullopt;
+      return WriteAccess(unlocked, std::adopt_lock);
     }
 
     /// Access the underlaying object for (read and) write access.
@@ -1099,6 +1473,16 @@ struct WriteAccess : public ReadAccess<UNLOCKED>
 
     /// Access the underlaying object for (read and) write access.
     typename UNLOCKED::data_type& operator*() const { return *this->m_unlocked->ptr(); }
+
+  protected:
+    /// Constructor used by try_lock: unlocked is already write locked.
+    WriteAccess(UNLOCKED& unlocked, std::adopt_lock_t) : ReadAccess<UNLOCKED>(unlocked, writelocked)
+    {
+      this->m_probe.locking(*this->m_unlocked);
+      this->m_probe.locked(*this->m_unlocked, LockStats::wat);
+    }
+
+    template<typename UNLOCKED2, typename ACCESS, typename EXECUTOR> friend class ::threadsafe::AsyncAccessAwaiter;
 };
 
 /**
@@ -1113,13 +1497,7 @@ struct AccessConst
 
     /// Construct a AccessConst from a constant Unlocked.
     template<typename ...Args>
-    AccessConst(UNLOCKED const& unlocked, Args&&... args) : m_unlocked(const_cast<UNLOCKED*>(&unlocked))
-    {
-#if THREADSAFE_DEBUG
-      m_unlocked->increment_ref();
-#endif // THREADSAFE_DEBUG
-      this->m_unlocked->UNLOCKED::policy_type::mutex().lock(std::forward<Args>(args)...);
-    }
+    AccessConst(UNLOCKED const& unlocked, Args&&... args) : AccessConst(unlocked, LockStats::crat, std::forward<Args>(args)...) { }
 
     /// Access the underlaying object for read access.
     typename UNLOCKED::data_type const* operator->() const { return this->m_unlocked->ptr(); }
@@ -1134,6 +1512,7 @@ struct AccessConst
 #if THREADSAFE_DEBUG
         this->m_unlocked->decrement_ref();
 #endif // THREADSAFE_DEBUG
+        m_probe.unlocking(*this->m_unlocked);
         this->m_unlocked->UNLOCKED::policy_type::mutex().unlock();
       }
     }
@@ -1141,8 +1520,14 @@ struct AccessConst
     // If m_primitive_mutex is a ConditionVariable, then this can be used to wait for a signal.
     template<typename Predicate>
     void wait(Predicate pred) { this->m_unlocked->UNLOCKED::policy_type::mutex().wait(pred); }
-    // If m_primitive_mutex is a ConditionVariable then this can be used to wake up the waiting thread.
+    // Same as wait, but give up at deadline, or after timeout. Returns false upon a time out.
+    template<typename Clock, typename Duration, typename Predicate>
+    bool wait_until(std::chrono::time_point<Clock, Duration> const& deadline, Predicate pred) { return this->m_unlocked->UNLOCKED::policy_type::mutex().wait_until(deadline, pred); }
+    template<typename Rep, typename Period, typename Predicate>
+    bool wait_for(std::chrono::duration<Rep, Period> const& timeout, Predicate pred) { return this->m_unlocked->UNLOCKED::policy_type::mutex().wait_for(timeout, pred); }
+    // If m_primitive_mutex is a ConditionVariable then this can be used to wake up the waiting thread(s).
     void notify_one() { this->m_unlocked->UNLOCKED::policy_type::mutex().notify_one(); }
+    void notify_all() { this->m_unlocked->UNLOCKED::policy_type::mutex().notify_all(); }
 
     // Experimental unlock/relock. Const because we must be able to call it on a rat type (which is const).
     void unlock() const
@@ -1150,6 +1535,7 @@ struct AccessConst
 #if THREADSAFE_DEBUG
       this->m_unlocked->decrement_ref();
 #endif // THREADSAFE_DEBUG
+      m_probe.unlocking(*this->m_unlocked);
       this->m_unlocked->UNLOCKED::policy_type::mutex().unlock();
       this->m_unlocked = nullptr;
     }
@@ -1161,17 +1547,42 @@ struct AccessConst
 #if THREADSAFE_DEBUG
       m_unlocked->increment_ref();
 #endif // THREADSAFE_DEBUG
+      m_probe.locking(*this->m_unlocked);
       this->m_unlocked->UNLOCKED::policy_type::mutex().lock();
+      m_probe.locked(*this->m_unlocked, LockStats::crat);
     }
 
   protected:
     mutable UNLOCKED* m_unlocked;		///< Pointer to the object that we provide access to.
+    [[no_unique_address]] mutable AccessProbe<typename UNLOCKED::policy_type> m_probe;
+
+    /// Constructor used by ConstAccess and Access.
+    template<typename ...Args>
+    AccessConst(UNLOCKED const& unlocked, LockStats::access_type type, Args&&... args) : m_unlocked(const_cast<UNLOCKED*>(&unlocked))
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+      m_probe.locking(*this->m_unlocked);
+      this->m_unlocked->UNLOCKED::policy_type::mutex().lock(std::forward<Args>(args)...);
+      m_probe.locked(*this->m_unlocked, type);
+    }
+
+    /// Constructor used by the try_lock functions of ConstAccess and Access: unlocked is already locked.
+    AccessConst(UNLOCKED const& unlocked, LockStats::access_type type, std::adopt_lock_t) : m_unlocked(const_cast<UNLOCKED*>(&unlocked))
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+      m_probe.locking(*this->m_unlocked);
+      m_probe.locked(*this->m_unlocked, type);
+    }
 
     // Disallow copy constructing directly.
     AccessConst(AccessConst const&) = delete;
 
     // Move constructor.
-    AccessConst(AccessConst&& rvalue) : m_unlocked(rvalue.m_unlocked) { rvalue.m_unlocked = nullptr; }
+    AccessConst(AccessConst&& rvalue) : m_unlocked(rvalue.m_unlocked), m_probe(rvalue.m_probe) { rvalue.m_unlocked = nullptr; }
 };
 
 /**
@@ -1184,13 +1595,35 @@ struct ConstAccess : public AccessConst<UNLOCKED>
   public:
     /// Construct a ConstAccess from a non-constant Unlocked.
     template<typename ...Args>
-    explicit ConstAccess(UNLOCKED& unlocked, Args&&... args) : AccessConst<UNLOCKED>(unlocked, std::forward<Args>(args)...) { }
+    explicit ConstAccess(UNLOCKED& unlocked, Args&&... args) : AccessConst<UNLOCKED>(unlocked, LockStats::rat, std::forward<Args>(args)...) { }
+
+    /// Return a ConstAccess, or an empty optional if the lock can not be obtained without blocking.
+    static std::optional<ConstAccess> try_lock(UNLOCKED& unlocked)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_lock())
+        return std::nullopt;
+      return ConstAccess(unlocked, LockStats::rat, std::adopt_lock);
+    }
+
+    /// Return a ConstAccess, or an empty optional if the lock could not be obtained before deadline (requires a timed mutex).
+    template<typename Clock, typename Duration>
+    static std::optional<ConstAccess> try_lock_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_lock_until(deadline))
+        return std::nullopt;
+      return ConstAccess(unlocked, LockStats::rat, std::adopt_lock);
+    }
 
     operator AccessConst<typename UNLOCKED::const_unlocked_type> const&() const
     {
-      static_assert(sizeof(AccessConst<UNLOCKED>) == sizeof(void*), "Unexpected size when doing reinterpret_cast");
+      static_assert(sizeof(AccessConst<UNLOCKED>) == sizeof(AccessConst<typename UNLOCKED::const_unlocked_type>), "Unexpected size when doing reinterpret_cast");
       return reinterpret_cast<AccessConst<typename UNLOCKED::const_unlocked_type> const&>(static_cast<AccessConst<UNLOCKED> const&>(*this));
     }
+
+  protected:
+    /// Constructor used by Access.
+    template<typename ...Args>
+    ConstAccess(UNLOCKED& unlocked, LockStats::access_type type, Args&&... args) : AccessConst<UNLOCKED>(unlocked, type, std::forward<Args>(args)...) { }
 };
 
 /**
@@ -1209,13 +1642,35 @@ struct Access : public ConstAccess<UNLOCKED>
 {
   public:
     /// Construct a Access from a non-constant Unlocked.
-    using ConstAccess<UNLOCKED>::ConstAccess;
+    template<typename ...Args>
+    explicit Access(UNLOCKED& unlocked, Args&&... args) : ConstAccess<UNLOCKED>(unlocked, LockStats::wat, std::forward<Args>(args)...) { }
+
+    /// Return an Access, or an empty optional if the lock can not be obtained without blocking.
+    static std::optional<Access> try_lock(UNLOCKED& unlocked)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_lock())
+        return std::nullopt;
+      return Access(unlocked, std::adopt_lock);
+    }
+
+    /// Return an Access, or an empty optional if the lock could not be obtained before deadline (requires a timed mutex).
+    template<typename Clock, typename Duration>
+    static std::optional<Access> try_lock_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+    {
+      if (!unlocked.UNLOCKED::policy_type::mutex().try_lock_until(deadline))
+        return std::nullopt;
+      return Access(unlocked, std::adopt_lock);
+    }
 
     /// Access the underlaying object for (read and) write access.
     typename UNLOCKED::data_type* operator->() const { return this->m_unlocked->ptr(); }
 
     /// Access the underlaying object for (read and) write access.
     typename UNLOCKED::data_type& operator*() const { return *this->m_unlocked->ptr(); }
+
+  protected:
+    /// Constructor used by try_lock: unlocked is already locked.
+    Access(UNLOCKED& unlocked, std::adopt_lock_t) : ConstAccess<UNLOCKED>(unlocked, LockStats::wat, std::adopt_lock) { }
 };
 
 // Explicitly convert a ConstAccess to an Access type.
@@ -1317,90 +1772,739 @@ OTAccess<UNLOCKED> const& wat_cast(OTConstAccess<UNLOCKED> const& access)
   return static_cast<OTAccess<UNLOCKED> const&>(access);
 }
 
-template<typename T, typename POLICY_MUTEX>
-Unlocked<T, POLICY_MUTEX> const& Unlocked<T, POLICY_MUTEX>::do_rdlock() /*threadsafe-*/const
-{
-  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().rdlock();
-  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().lock();
-  return *this;
-}
-
-template<typename T, typename POLICY_MUTEX>
-void Unlocked<T, POLICY_MUTEX>::do_rdunlock() /*threadsafe-*/const
+/**
+ * @brief Access a SeqLock protected object for read access.
+ *
+ * This makes a copy of the object, without writing to the lock, and provides access to that copy.
+ * When this is the base class of an SLAccess then it provides access to the (write locked) object itself.
+ */
+template<class UNLOCKED>
+struct SLAccessConst
 {
-  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().rdunlock();
-  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().unlock();
-}
+  public:
+    using unlocked_type = UNLOCKED;
+    using data_type = typename UNLOCKED::data_type;
 
-template<typename T, typename POLICY_MUTEX>
-Unlocked<T, POLICY_MUTEX>& Unlocked<T, POLICY_MUTEX>::do_wrlock()
-{
-  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().wrlock();
-  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().lock();
-  return *this;
-}
+    /// Construct a SLAccessConst from a constant Unlocked.
+    SLAccessConst(UNLOCKED const& unlocked) : m_unlocked(const_cast<UNLOCKED*>(&unlocked))
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+      m_sequence = m_unlocked->UNLOCKED::policy_type::mutex().read(m_copy, m_unlocked->ptr(), sizeof(data_type));
+    }
 
-template<typename T, typename POLICY_MUTEX>
-void Unlocked<T, POLICY_MUTEX>::do_wrunlock()
-{
-  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().wrunlock();
-  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
-    this->mutex().unlock();
-}
+#if THREADSAFE_DEBUG
+    ~SLAccessConst()
+    {
+      if (this->m_unlocked)
+        m_unlocked->decrement_ref();
+    }
+#endif // THREADSAFE_DEBUG
 
-namespace policy {
+    /// Access the underlaying object for read access.
+    data_type const* operator->() const { return ptr(); }
 
-template<typename T> struct helper { static constexpr bool value = false; };
-template<typename UNLOCKED> struct unsupported_w2rCarry
-{
-  static_assert(helper<UNLOCKED>::value, "\n"
-      "* The Primitive/OneThread policy does not support w2rCarry,\n"
-      "* it makes no sense and would require extra space and cpu cycles to make it work.\n"
-      "* Instead, of '{ foo_t::w2rCarry carry(foo); { foo_t::wat foo_rw(carry); ... } foo_t::rat foo_r(carry); ... }',\n"
-      "* just use    '{ foo_t::wat foo_rw(foo); ... }'\n");
-};
+    /// Access the underlaying object for read access.
+    data_type const& operator*() const { return *ptr(); }
 
-template<class RWMUTEX>
-class ReadWriteAccess
-{
   protected:
-    template<class UNLOCKED>
-    struct access_types_unlocked_base
-    {
-      using read_access_type = ReadAccess<UNLOCKED>;
-      using write_access_type = WriteAccess<UNLOCKED>;
-      using write_to_read_carry = Write2ReadCarry<UNLOCKED>;
-      using read_access_base_type = ConstReadAccess<UNLOCKED>;
-    };
+    UNLOCKED* m_unlocked;                               ///< Pointer to the object that we provide access to.
+    uint32_t m_sequence;                                ///< The sequence number of m_copy; or, if odd, of the write lock that we hold.
+    alignas(data_type) unsigned char m_copy[sizeof(data_type)];      ///< The copy of the object if m_sequence is even.
 
-    template<class UNLOCKED>
-    struct access_types_const_unlocked_base
+    /// Constructor used by SLAccess.
+    SLAccessConst(UNLOCKED& unlocked, uint32_t sequence) : m_unlocked(&unlocked), m_sequence(sequence)
     {
-      using const_read_access_type = ConstReadAccess<UNLOCKED>;
-    };
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+    }
 
-    template<class UNLOCKED>
-    struct access_types_unlocked
+    data_type const* ptr() const
     {
-      using const_read_access_type = ConstReadAccess<UNLOCKED>;
-      using read_access_type = ReadAccess<UNLOCKED>;
-      using write_access_type = WriteAccess<UNLOCKED>;
-      using write_to_read_carry = Write2ReadCarry<UNLOCKED>;
-      using read_access_base_type = ConstReadAccess<UNLOCKED>;
-    };
+      if ((m_sequence & 1))
+        return m_unlocked->ptr();
+      return std::launder(reinterpret_cast<data_type const*>(m_copy));
+    }
 
-    template<class UNLOCKED>
-    using access_types = std::conditional_t<
-        utils::is_specialization_of_v<UNLOCKED, UnlockedBase>,
-            access_types_unlocked_base<UNLOCKED>,
-            std::conditional_t<
+    // Disallow copy constructing directly.
+    SLAccessConst(SLAccessConst const&) = delete;
+
+    template<class UNLOCKED2>
+    requires utils::is_specialization_of_v<UNLOCKED2, Unlocked> || utils::is_specialization_of_v<UNLOCKED2, UnlockedBase>
+    friend struct SLAccess;
+};
+
+/**
+ * @brief The Read-Access-Type (rat) of a SeqLock protected object.
+ *
+ * Like the crat this is a copy of the object; but it can be converted to a wat,
+ * which throws a std::exception when the object was changed since the copy was made.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+struct SLConstAccess : public SLAccessConst<UNLOCKED>
+{
+  public:
+    /// Construct an SLConstAccess from a non-constant Unlocked.
+    explicit SLConstAccess(UNLOCKED& unlocked) : SLAccessConst<UNLOCKED>(unlocked) { }
+
+    operator SLAccessConst<typename UNLOCKED::const_unlocked_type> const&() const
+    {
+      static_assert(sizeof(SLAccessConst<UNLOCKED>) == sizeof(SLAccessConst<typename UNLOCKED::const_unlocked_type>),
+          "Unexpected size when doing reinterpret_cast");
+      return reinterpret_cast<SLAccessConst<typename UNLOCKED::const_unlocked_type> const&>(static_cast<SLAccessConst<UNLOCKED> const&>(*this));
+    }
+
+  protected:
+    /// Constructor used by SLAccess.
+    SLConstAccess(UNLOCKED& unlocked, uint32_t sequence) : SLAccessConst<UNLOCKED>(unlocked, sequence) { }
+
+    template<class UNLOCKED2>
+    requires utils::is_specialization_of_v<UNLOCKED2, Unlocked> || utils::is_specialization_of_v<UNLOCKED2, UnlockedBase>
+    friend struct SLAccess;
+};
+
+/**
+ * @brief The Write-Access-Type (wat) of a SeqLock protected object.
+ *
+ * This access type write locks the object and provides non-const (write) access.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+struct SLAccess : public SLConstAccess<UNLOCKED>
+{
+  public:
+    /// Construct an SLAccess from a non-constant Unlocked.
+    explicit SLAccess(UNLOCKED& unlocked) :
+      SLConstAccess<UNLOCKED>(unlocked, unlocked.UNLOCKED::policy_type::mutex().wrlock()), m_rat(nullptr), m_locked(true) { }
+
+    /// Promote read access to write access.
+    // Throws if the object was changed since access made its copy; in that case destroy access and call rd2wryield().
+    explicit SLAccess(SLConstAccess<UNLOCKED>& access) :
+      SLConstAccess<UNLOCKED>(*access.m_unlocked, access.m_sequence | 1), m_rat(&access), m_locked(!(access.m_sequence & 1))
+    {
+      // If access is the base class of a SLAccess then we already have the write lock.
+      if (m_locked && !this->m_unlocked->UNLOCKED::policy_type::mutex().try_wrlock(access.m_sequence))
+      {
+        m_locked = false;       // Don't unlock anything in the destructor (doesn't run when throwing anyway).
+        throw std::exception();
+      }
+    }
+
+    ~SLAccess()
+    {
+      if (!m_locked)
+        return;
+      if (m_rat)
+      {
+        // Update the copy of the rat that we were constructed from, so that it sees what was written.
+        std::memcpy(m_rat->m_copy, this->m_unlocked->ptr(), sizeof(typename UNLOCKED::data_type));
+        m_rat->m_sequence = this->m_sequence + 1;
+      }
+      this->m_unlocked->UNLOCKED::policy_type::mutex().wrunlock();
+    }
+
+    /// Access the underlaying object for (read and) write access.
+    typename UNLOCKED::data_type* operator->() const { return this->m_unlocked->ptr(); }
+
+    /// Access the underlaying object for (read and) write access.
+    typename UNLOCKED::data_type& operator*() const { return *this->m_unlocked->ptr(); }
+
+  private:
+    SLConstAccess<UNLOCKED>* m_rat;     ///< The rat that we were constructed from, if any.
+    bool m_locked;                      ///< True if we have to release the write lock upon destruction.
+};
+
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct RCUAccess;
+
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+class RCUWrite2ReadCarry;
+
+/**
+ * @brief Access an RCU protected object for read access.
+ *
+ * This pins the current version of the object, which remains accessible
+ * (and unchanged) until this object is destructed.
+ */
+template<class UNLOCKED>
+struct RCUAccessConst
+{
+  public:
+    using unlocked_type = UNLOCKED;
+    using data_type = typename UNLOCKED::data_type;
+
+    /// Construct a RCUAccessConst from a constant Unlocked.
+    RCUAccessConst(UNLOCKED const& unlocked) : m_unlocked(const_cast<UNLOCKED*>(&unlocked)), m_state(pinned)
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+      pin();
+    }
+
+    ~RCUAccessConst()
+    {
+      if (m_state == pinned)
+        m_unlocked->UNLOCKED::policy_type::mutex().rdunlock(m_counter);
+#if THREADSAFE_DEBUG
+      m_unlocked->decrement_ref();
+#endif // THREADSAFE_DEBUG
+    }
+
+    /// Access the underlaying object for read access.
+    data_type const* operator->() const { return m_version; }
+
+    /// Access the underlaying object for read access.
+    data_type const& operator*() const { return *m_version; }
+
+  protected:
+    enum state_type
+    {
+      pinned,           ///< A RCUAccessConst or RCUConstAccess.
+      carried,          ///< A RCUConstAccess constructed from a RCUWrite2ReadCarry.
+      writing           ///< The base class of a RCUAccess.
+    };
+
+    UNLOCKED* m_unlocked;               ///< Pointer to the object that we provide access to.
+    state_type const m_state;           ///< What m_version points to.
+    data_type const* m_version;         ///< The version that we provide access to.
+    std::atomic<int>* m_counter;        ///< The reader counter that was incremented by pin(), if m_state == pinned.
+
+    /// Constructor used by RCUConstAccess and RCUAccess.
+    RCUAccessConst(UNLOCKED& unlocked, state_type state, data_type const* version) :
+      m_unlocked(&unlocked), m_state(state), m_version(version), m_counter(nullptr)
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked->increment_ref();
+#endif // THREADSAFE_DEBUG
+    }
+
+    void pin()
+    {
+      void* version = m_unlocked->UNLOCKED::policy_type::mutex().rdlock(m_counter);
+      m_version = version ? static_cast<data_type const*>(version) : m_unlocked->ptr();
+    }
+
+    // Disallow copy constructing directly.
+    RCUAccessConst(RCUAccessConst const&) = delete;
+
+    template<class UNLOCKED2>
+    requires utils::is_specialization_of_v<UNLOCKED2, Unlocked>
+    friend struct RCUAccess;
+};
+
+/**
+ * @brief The Read-Access-Type (rat) of an RCU protected object.
+ *
+ * Converting it to a wat throws a std::exception when a new version
+ * was published after this rat pinned its version.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct RCUConstAccess : public RCUAccessConst<UNLOCKED>
+{
+  public:
+    using RCUAccessConst<UNLOCKED>::carried;
+
+    /// Construct an RCUConstAccess from a non-constant Unlocked.
+    explicit RCUConstAccess(UNLOCKED& unlocked) : RCUAccessConst<UNLOCKED>(unlocked) { }
+
+    /// Construct an RCUConstAccess that reads the version that was published by the wat that w2rc was passed to.
+    explicit RCUConstAccess(RCUWrite2ReadCarry<UNLOCKED> const& w2rc) : RCUAccessConst<UNLOCKED>(w2rc.m_unlocked, carried, w2rc.m_version)
+    {
+      assert(w2rc.m_version); // Always pass a w2rCarry to a wat first.
+    }
+
+  protected:
+    /// Constructor used by RCUAccess.
+    using RCUAccessConst<UNLOCKED>::RCUAccessConst;
+};
+
+/**
+ * @brief Allow to carry the read access from a wat to a rat.
+ *
+ * The wat publishes the new version upon destruction and leaves it pinned by the carry.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+class RCUWrite2ReadCarry
+{
+  private:
+    UNLOCKED& m_unlocked;
+    typename UNLOCKED::data_type const* m_version;      // The pinned version, or nullptr if the carry wasn't passed to a wat yet.
+    std::atomic<int>* m_counter;
+
+    void pin()
+    {
+      m_version = static_cast<typename UNLOCKED::data_type const*>(m_unlocked.UNLOCKED::policy_type::mutex().rdlock(m_counter));
+    }
+
+  public:
+    explicit RCUWrite2ReadCarry(UNLOCKED& unlocked) : m_unlocked(unlocked), m_version(nullptr), m_counter(nullptr)
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked.increment_ref();
+#endif // THREADSAFE_DEBUG
+    }
+
+    ~RCUWrite2ReadCarry()
+    {
+#if THREADSAFE_DEBUG
+      m_unlocked.decrement_ref();
+#endif // THREADSAFE_DEBUG
+      if (m_version)
+        m_unlocked.UNLOCKED::policy_type::mutex().rdunlock(m_counter);
+    }
+
+    friend struct RCUAccess<UNLOCKED>;
+    friend struct RCUConstAccess<UNLOCKED>;
+};
+
+/**
+ * @brief The Write-Access-Type (wat) of an RCU protected object.
+ *
+ * This access type provides write access to a private copy of the current version,
+ * which becomes the current version upon destruction. Writers exclude each other,
+ * but readers can continue to read the previous version in the meantime.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct RCUAccess : public RCUConstAccess<UNLOCKED>
+{
+  public:
+    using data_type = typename UNLOCKED::data_type;
+    using RCUAccessConst<UNLOCKED>::pinned;
+    using RCUAccessConst<UNLOCKED>::writing;
+
+    /// Construct an RCUAccess from a non-constant Unlocked.
+    explicit RCUAccess(UNLOCKED& unlocked) : RCUConstAccess<UNLOCKED>(unlocked, writing, nullptr), m_rat(nullptr), m_w2rc(nullptr)
+    {
+      this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock();
+      make_copy();
+    }
+
+    /// Promote read access to write access.
+    // Throws if a new version was published after access pinned its version; in that case destroy access and call rd2wryield().
+    explicit RCUAccess(RCUConstAccess<UNLOCKED>& access) :
+      RCUConstAccess<UNLOCKED>(*access.m_unlocked, writing, access.m_version), m_rat(nullptr), m_w2rc(nullptr)
+    {
+      // If access is the base class of a RCUAccess then we can just write to its copy.
+      if (access.m_state == writing)
+        return;
+      assert(access.m_state == pinned);       // A rat that was constructed from a w2rCarry can not be converted to a wat.
+      AIRCULock& rcu_lock = this->m_unlocked->UNLOCKED::policy_type::mutex();
+      // Don't block on the write lock while we have a version pinned: the writer would wait for us.
+      // If another thread is writing then our version will be stale anyway.
+      if (!rcu_lock.try_wrlock())
+        throw std::exception();
+      if (current_version() != access.m_version)
+      {
+        rcu_lock.wrunlock();
+        throw std::exception();
+      }
+      m_rat = &access;
+      make_copy();
+    }
+
+    /// Construct an RCUAccess from a RCUWrite2ReadCarry object. Upon destruction leave the new version pinned by the carry.
+    explicit RCUAccess(RCUWrite2ReadCarry<UNLOCKED>& w2rc) : RCUConstAccess<UNLOCKED>(w2rc.m_unlocked, writing, nullptr), m_rat(nullptr), m_w2rc(&w2rc)
+    {
+      assert(!w2rc.m_version); // Always pass a w2rCarry to the wat first. There can only be one wat.
+      this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock();
+      make_copy();
+    }
+
+    ~RCUAccess()
+    {
+      if (!m_copy)
+        return;
+      AIRCULock& rcu_lock = this->m_unlocked->UNLOCKED::policy_type::mutex();
+      // Release the version pinned by the rat that we were constructed from, or publish would wait for ourselves.
+      if (m_rat)
+        rcu_lock.rdunlock(m_rat->m_counter);
+      data_type* previous = static_cast<data_type*>(rcu_lock.publish(m_copy, [](void* version){ delete static_cast<data_type*>(version); }));
+      delete previous;
+      // Pin the new version for the rat or carry, so that they see what we wrote.
+      if (m_rat)
+        m_rat->pin();
+      if (m_w2rc)
+        m_w2rc->pin();
+      rcu_lock.wrunlock();
+    }
+
+    /// Access the private copy for (read and) write access.
+    data_type* operator->() const { return const_cast<data_type*>(this->m_version); }
+
+    /// Access the private copy for (read and) write access.
+    data_type& operator*() const { return *const_cast<data_type*>(this->m_version); }
+
+  private:
+    data_type* m_copy = nullptr;                // The private copy that we'll publish, or nullptr if we write to the copy of another RCUAccess.
+    RCUConstAccess<UNLOCKED>* m_rat;            // The rat that we were constructed from, if any.
+    RCUWrite2ReadCarry<UNLOCKED>* m_w2rc;       // The carry that we were constructed from, if any.
+
+    data_type const* current_version() const
+    {
+      void* version = this->m_unlocked->UNLOCKED::policy_type::mutex().current();
+      return version ? static_cast<data_type const*>(version) : this->m_unlocked->ptr();
+    }
+
+    // Called while holding the write lock, which is released again if the copy constructor of data_type throws.
+    void make_copy()
+    {
+      try
+      {
+        m_copy = new data_type(*current_version());
+      }
+      catch (...)
+      {
+        this->m_unlocked->UNLOCKED::policy_type::mutex().wrunlock();
+        throw;
+      }
+      this->m_version = m_copy;
+    }
+};
+
+/**
+ * @brief A version (snapshot) of an object that is protected by policy::Snapshot.
+ */
+template<typename T>
+struct SnapshotVersion : public AIRefCount
+{
+  T m_data;
+
+  explicit SnapshotVersion(T const& data) : m_data(data) { }
+};
+
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct SnapshotAccess;
+
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+class SnapshotWrite2ReadCarry;
+
+/**
+ * @brief Access a Snapshot protected object for read access.
+ *
+ * This holds a reference to the current version of the object, which remains accessible
+ * (and unchanged) for as long as this object, or a copy of it, exists. No lock is held,
+ * so it can be kept for as long as needed (for example across a co_await), and it may
+ * even outlive the Unlocked object.
+ */
+template<class UNLOCKED>
+struct SnapshotAccessConst
+{
+  public:
+    using unlocked_type = UNLOCKED;
+    using data_type = typename UNLOCKED::data_type;
+    using version_type = SnapshotVersion<data_type>;
+
+    /// Construct a SnapshotAccessConst from a constant Unlocked.
+    SnapshotAccessConst(UNLOCKED const& unlocked) : m_unlocked(const_cast<UNLOCKED*>(&unlocked)), m_writing(false)
+    {
+      acquire();
+    }
+
+    /// Copying a snapshot adds a reference to the same version.
+    SnapshotAccessConst(SnapshotAccessConst const&) = default;
+    SnapshotAccessConst(SnapshotAccessConst&&) = default;
+    SnapshotAccessConst& operator=(SnapshotAccessConst const&) = default;
+    SnapshotAccessConst& operator=(SnapshotAccessConst&&) = default;
+
+    /// Access the underlaying object for read access.
+    data_type const* operator->() const { return &m_version->m_data; }
+
+    /// Access the underlaying object for read access.
+    data_type const& operator*() const { return m_version->m_data; }
+
+  protected:
+    UNLOCKED* m_unlocked;                               ///< Pointer to the object that the snapshot was taken from.
+    bool m_writing;                                     ///< Set if this is the base class of a SnapshotAccess.
+    boost::intrusive_ptr<version_type const> m_version; ///< The version that we provide access to.
+
+    /// Constructor used by SnapshotConstAccess and SnapshotAccess.
+    SnapshotAccessConst(UNLOCKED& unlocked, bool writing, boost::intrusive_ptr<version_type const> version) :
+      m_unlocked(&unlocked), m_writing(writing), m_version(std::move(version)) { }
+
+    void acquire()
+    {
+      AISnapshotLock& snapshot_lock = m_unlocked->UNLOCKED::policy_type::mutex();
+      AIRefCount const* version = snapshot_lock.acquire();
+      if (AI_UNLIKELY(!version))
+      {
+        // This is the first access: publish a copy of the object that is embedded in the Unlocked.
+        // Writers never change the embedded object, so it can be copied before taking the write lock.
+        std::unique_ptr<version_type> first_version(new version_type(*m_unlocked->ptr()));
+        snapshot_lock.wrlock();
+        if (!snapshot_lock.current())
+          snapshot_lock.publish(first_version.release());
+        snapshot_lock.wrunlock();
+        version = snapshot_lock.acquire();
+      }
+      // Adopt the reference that was returned by acquire().
+      m_version.reset(static_cast<version_type const*>(version), false);
+    }
+
+    template<class UNLOCKED2>
+    requires utils::is_specialization_of_v<UNLOCKED2, Unlocked>
+    friend struct SnapshotAccess;
+};
+
+/**
+ * @brief The Read-Access-Type (rat) of a Snapshot protected object.
+ *
+ * Converting it to a wat throws a std::exception when a new version
+ * was published after this rat took its snapshot.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct SnapshotConstAccess : public SnapshotAccessConst<UNLOCKED>
+{
+  public:
+    /// Construct a SnapshotConstAccess from a non-constant Unlocked.
+    explicit SnapshotConstAccess(UNLOCKED& unlocked) : SnapshotAccessConst<UNLOCKED>(unlocked) { }
+
+    /// Construct a SnapshotConstAccess of the version that was published by the wat that w2rc was passed to.
+    explicit SnapshotConstAccess(SnapshotWrite2ReadCarry<UNLOCKED> const& w2rc) : SnapshotAccessConst<UNLOCKED>(w2rc.m_unlocked, false, w2rc.m_version)
+    {
+      assert(w2rc.m_version); // Always pass a w2rCarry to a wat first.
+    }
+
+  protected:
+    /// Constructor used by SnapshotAccess.
+    using SnapshotAccessConst<UNLOCKED>::SnapshotAccessConst;
+};
+
+/**
+ * @brief Allow to carry the read access from a wat to a rat.
+ *
+ * The wat publishes the new version upon destruction and leaves a reference to it in the carry.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+class SnapshotWrite2ReadCarry
+{
+  private:
+    UNLOCKED& m_unlocked;
+    boost::intrusive_ptr<SnapshotVersion<typename UNLOCKED::data_type> const> m_version;        // The published version, or nullptr if the carry wasn't passed to a wat yet.
+
+  public:
+    explicit SnapshotWrite2ReadCarry(UNLOCKED& unlocked) : m_unlocked(unlocked) { }
+
+    friend struct SnapshotAccess<UNLOCKED>;
+    friend struct SnapshotConstAccess<UNLOCKED>;
+};
+
+/**
+ * @brief The Write-Access-Type (wat) of a Snapshot protected object.
+ *
+ * This access type provides write access to a private copy of the current version,
+ * which becomes the current version upon destruction. Writers exclude each other,
+ * but readers keep reading the version that they took a snapshot of in the meantime.
+ */
+template<class UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+struct SnapshotAccess : public SnapshotConstAccess<UNLOCKED>
+{
+  public:
+    using data_type = typename UNLOCKED::data_type;
+    using version_type = SnapshotVersion<data_type>;
+
+    /// Construct a SnapshotAccess from a non-constant Unlocked.
+    explicit SnapshotAccess(UNLOCKED& unlocked) : SnapshotConstAccess<UNLOCKED>(unlocked, true, nullptr), m_rat(nullptr), m_w2rc(nullptr)
+    {
+      this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock();
+      make_copy();
+    }
+
+    /// Promote read access to write access.
+    // Throws if a new version was published after access took its snapshot; in that case destroy access and call rd2wryield().
+    explicit SnapshotAccess(SnapshotConstAccess<UNLOCKED>& access) :
+      SnapshotConstAccess<UNLOCKED>(*access.m_unlocked, true, access.m_version), m_rat(nullptr), m_w2rc(nullptr)
+    {
+      // If access is the base class of a SnapshotAccess then we can just write to its copy.
+      if (access.m_writing)
+        return;
+      AISnapshotLock& snapshot_lock = this->m_unlocked->UNLOCKED::policy_type::mutex();
+      // A snapshot doesn't stop writers, so it is safe to block here.
+      snapshot_lock.wrlock();
+      if (snapshot_lock.current() != access.m_version.get())
+      {
+        snapshot_lock.wrunlock();
+        throw std::exception();
+      }
+      m_rat = &access;
+      make_copy();
+    }
+
+    /// Construct a SnapshotAccess from a SnapshotWrite2ReadCarry object. Upon destruction leave a reference to the new version in the carry.
+    explicit SnapshotAccess(SnapshotWrite2ReadCarry<UNLOCKED>& w2rc) : SnapshotConstAccess<UNLOCKED>(w2rc.m_unlocked, true, nullptr), m_rat(nullptr), m_w2rc(&w2rc)
+    {
+      assert(!w2rc.m_version); // Always pass a w2rCarry to the wat first. There can only be one wat.
+      this->m_unlocked->UNLOCKED::policy_type::mutex().wrlock();
+      make_copy();
+    }
+
+    SnapshotAccess(SnapshotAccess const&) = delete;
+
+    ~SnapshotAccess()
+    {
+      if (!m_copy)
+        return;
+      AISnapshotLock& snapshot_lock = this->m_unlocked->UNLOCKED::policy_type::mutex();
+      snapshot_lock.publish(m_copy);
+      // Let the rat or carry refer to the new version, so that they see what we wrote.
+      if (m_rat)
+        m_rat->m_version = this->m_version;
+      if (m_w2rc)
+        m_w2rc->m_version = this->m_version;
+      snapshot_lock.wrunlock();
+    }
+
+    /// Access the private copy for (read and) write access.
+    data_type* operator->() const { return &const_cast<version_type*>(this->m_version.get())->m_data; }
+
+    /// Access the private copy for (read and) write access.
+    data_type& operator*() const { return const_cast<version_type*>(this->m_version.get())->m_data; }
+
+  private:
+    version_type* m_copy = nullptr;                     // The private copy that we'll publish, or nullptr if we write to the copy of another SnapshotAccess.
+    SnapshotConstAccess<UNLOCKED>* m_rat;               // The rat that we were constructed from, if any.
+    SnapshotWrite2ReadCarry<UNLOCKED>* m_w2rc;          // The carry that we were constructed from, if any.
+
+    // Called while holding the write lock, which is released again if the copy constructor of data_type throws.
+    void make_copy()
+    {
+      AISnapshotLock& snapshot_lock = this->m_unlocked->UNLOCKED::policy_type::mutex();
+      AIRefCount const* current = snapshot_lock.current();
+      try
+      {
+        m_copy = new version_type(current ? static_cast<version_type const*>(current)->m_data : *this->m_unlocked->ptr());
+      }
+      catch (...)
+      {
+        snapshot_lock.wrunlock();
+        throw;
+      }
+      this->m_version = m_copy;
+    }
+};
+
+template<typename T, typename POLICY_MUTEX>
+Unlocked<T, POLICY_MUTEX> const& Unlocked<T, POLICY_MUTEX>::do_rdlock() /*threadsafe-*/const
+{
+  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().rdlock();
+  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().lock();
+  else if constexpr (std::is_same_v<wat, SLAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrlock();        // Copying a SeqLock protected object is rare; just use the write lock.
+  else if constexpr (std::is_same_v<wat, RCUAccess<Unlocked<T, POLICY_MUTEX>>>)
+    static_assert(sizeof(T) == 0, "Copying or moving an Unlocked with policy::RCU is not supported.");
+  else if constexpr (std::is_same_v<wat, SnapshotAccess<Unlocked<T, POLICY_MUTEX>>>)
+    static_assert(sizeof(T) == 0, "Copying or moving an Unlocked with policy::Snapshot is not supported.");
+  return *this;
+}
+
+template<typename T, typename POLICY_MUTEX>
+void Unlocked<T, POLICY_MUTEX>::do_rdunlock() /*threadsafe-*/const
+{
+  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().rdunlock();
+  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().unlock();
+  else if constexpr (std::is_same_v<wat, SLAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrunlock();
+}
+
+template<typename T, typename POLICY_MUTEX>
+Unlocked<T, POLICY_MUTEX>& Unlocked<T, POLICY_MUTEX>::do_wrlock()
+{
+  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrlock();
+  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().lock();
+  else if constexpr (std::is_same_v<wat, SLAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrlock();
+  else if constexpr (std::is_same_v<wat, RCUAccess<Unlocked<T, POLICY_MUTEX>>>)
+    static_assert(sizeof(T) == 0, "Copying or moving an Unlocked with policy::RCU is not supported.");
+  else if constexpr (std::is_same_v<wat, SnapshotAccess<Unlocked<T, POLICY_MUTEX>>>)
+    static_assert(sizeof(T) == 0, "Copying or moving an Unlocked with policy::Snapshot is not supported.");
+  return *this;
+}
+
+template<typename T, typename POLICY_MUTEX>
+void Unlocked<T, POLICY_MUTEX>::do_wrunlock()
+{
+  if constexpr (std::is_same_v<wat, WriteAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrunlock();
+  else if constexpr (std::is_same_v<wat, Access<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().unlock();
+  else if constexpr (std::is_same_v<wat, SLAccess<Unlocked<T, POLICY_MUTEX>>>)
+    this->mutex().wrunlock();
+}
+
+namespace policy {
+
+template<typename T> struct helper { static constexpr bool value = false; };
+template<typename UNLOCKED> struct unsupported_w2rCarry
+{
+  static_assert(helper<UNLOCKED>::value, "\n"
+      "* The Primitive/SeqLock/OneThread policy does not support w2rCarry,\n"
+      "* it makes no sense and would require extra space and cpu cycles to make it work.\n"
+      "* Instead, of '{ foo_t::w2rCarry carry(foo); { foo_t::wat foo_rw(carry); ... } foo_t::rat foo_r(carry); ... }',\n"
+      "* just use    '{ foo_t::wat foo_rw(foo); ... }'\n");
+};
+
+template<typename UNLOCKED> struct unsupported_urat
+{
+  static_assert(helper<UNLOCKED>::value, "\n"
+      "* The SeqLock/RCU/Snapshot policy does not support urat,\n"
+      "* because a read access type of these policies doesn't lock anything that could be upgraded.\n");
+};
+
+template<class RWMUTEX>
+class ReadWriteAccess
+{
+  protected:
+    template<class UNLOCKED>
+    struct access_types_unlocked_base
+    {
+      using read_access_type = ReadAccess<UNLOCKED>;
+      using upgradable_read_access_type = UpgradableReadAccess<UNLOCKED>;
+      using write_access_type = WriteAccess<UNLOCKED>;
+      using write_to_read_carry = Write2ReadCarry<UNLOCKED>;
+      using read_access_base_type = ConstReadAccess<UNLOCKED>;
+    };
+
+    template<class UNLOCKED>
+    struct access_types_const_unlocked_base
+    {
+      using const_read_access_type = ConstReadAccess<UNLOCKED>;
+    };
+
+    template<class UNLOCKED>
+    struct access_types_unlocked
+    {
+      using const_read_access_type = ConstReadAccess<UNLOCKED>;
+      using read_access_type = ReadAccess<UNLOCKED>;
+      using upgradable_read_access_type = UpgradableReadAccess<UNLOCKED>;
+      using write_access_type = WriteAccess<UNLOCKED>;
+      using write_to_read_carry = Write2ReadCarry<UNLOCKED>;
+      using read_access_base_type = ConstReadAccess<UNLOCKED>;
+    };
+
+    template<class UNLOCKED>
+    using access_types = std::conditional_t<
+        utils::is_specialization_of_v<UNLOCKED, UnlockedBase>,
+            access_types_unlocked_base<UNLOCKED>,
+            std::conditional_t<
                 utils::is_specialization_of_v<UNLOCKED, ConstUnlockedBase>,
                 access_types_const_unlocked_base<UNLOCKED>,
                 access_types_unlocked<UNLOCKED>
@@ -1422,8 +2526,16 @@ class ReadWriteRef : public ReadWriteAccess<RWMUTEX>
     requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
     friend struct ::threadsafe::WriteAccess;
 
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+    friend struct ::threadsafe::UpgradableReadAccess;
+
     template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
 
+    template<typename UNLOCKED, typename ACCESS> friend struct ::threadsafe::LockRequest;
+    friend struct ::threadsafe::AccessTracer;
+    template<typename UNLOCKED, typename ACCESS, typename EXECUTOR> friend class ::threadsafe::AsyncAccessAwaiter;
+
     // Use a pointer in order to keep our assignment operator, which in turn
     // that allows assigning to UnlockedBase still.
     RWMUTEX* m_read_write_mutex_ptr;
@@ -1456,8 +2568,16 @@ class ReadWrite : public ReadWriteAccess<RWMUTEX>
     requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
     friend struct WriteAccess;
 
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+    friend struct UpgradableReadAccess;
+
     template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
 
+    template<typename UNLOCKED, typename ACCESS> friend struct ::threadsafe::LockRequest;
+    friend struct ::threadsafe::AccessTracer;
+    template<typename UNLOCKED, typename ACCESS, typename EXECUTOR> friend class ::threadsafe::AsyncAccessAwaiter;
+
     mutable RWMUTEX m_read_write_mutex;
 
     RWMUTEX& mutex() /*threadsafe-*/const { return m_read_write_mutex; }
@@ -1474,6 +2594,7 @@ class PrimitiveAccess
     struct access_types_unlocked_base
     {
       using read_access_type = ConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = ConstAccess<UNLOCKED>;
       using write_access_type = Access<UNLOCKED>;
       using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
       using read_access_base_type = AccessConst<UNLOCKED>;
@@ -1490,6 +2611,7 @@ class PrimitiveAccess
     {
       using const_read_access_type = AccessConst<UNLOCKED>;
       using read_access_type = ConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = ConstAccess<UNLOCKED>;
       using write_access_type = Access<UNLOCKED>;
       using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
       using read_access_base_type = AccessConst<UNLOCKED>;
@@ -1521,6 +2643,9 @@ class PrimitiveRef : public PrimitiveAccess<MUTEX>
 
     template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
 
+    template<typename UNLOCKED, typename ACCESS> friend struct ::threadsafe::LockRequest;
+    friend struct ::threadsafe::AccessTracer;
+
     MUTEX* m_primitive_mutex_ptr;
 
     PrimitiveRef(MUTEX& primitive_mutex) : m_primitive_mutex_ptr(&primitive_mutex) { }
@@ -1545,11 +2670,233 @@ class Primitive : public PrimitiveAccess<MUTEX>
 
     template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
 
+    template<typename UNLOCKED, typename ACCESS> friend struct ::threadsafe::LockRequest;
+    friend struct ::threadsafe::AccessTracer;
+
     mutable MUTEX m_primitive_mutex;
 
     MUTEX& mutex() /*threadsafe-*/const { return m_primitive_mutex; }
 };
 
+// Extract the protected type from UNLOCKED, which might still be incomplete.
+template<typename UNLOCKED> struct unlocked_data_type;
+template<typename T, typename POLICY_MUTEX> struct unlocked_data_type<Unlocked<T, POLICY_MUTEX>> { using type = T; };
+template<typename BASE, typename POLICY_MUTEX> struct unlocked_data_type<ConstUnlockedBase<BASE, POLICY_MUTEX>> { using type = BASE; };
+template<typename BASE, typename POLICY_MUTEX> struct unlocked_data_type<UnlockedBase<BASE, POLICY_MUTEX>> { using type = BASE; };
+
+template<typename UNLOCKED>
+struct seq_lock_requires_trivially_copyable
+{
+  static_assert(std::is_trivially_copyable_v<typename unlocked_data_type<UNLOCKED>::type>, "\n"
+      "* The SeqLock policy can only be used for trivially copyable types,\n"
+      "* because readers make a (possibly torn, and then retried) copy of the object.\n");
+};
+
+class SeqLockAccess
+{
+  private:
+    template<class UNLOCKED>
+    struct access_types_unlocked_base : seq_lock_requires_trivially_copyable<UNLOCKED>
+    {
+      using read_access_type = SLConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = unsupported_urat<UNLOCKED>;
+      using write_access_type = SLAccess<UNLOCKED>;
+      using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
+      using read_access_base_type = SLAccessConst<UNLOCKED>;
+    };
+
+    template<class UNLOCKED>
+    struct access_types_const_unlocked_base : seq_lock_requires_trivially_copyable<UNLOCKED>
+    {
+      using const_read_access_type = SLAccessConst<UNLOCKED>;
+    };
+
+    template<class UNLOCKED>
+    struct access_types_unlocked : seq_lock_requires_trivially_copyable<UNLOCKED>
+    {
+      using const_read_access_type = SLAccessConst<UNLOCKED>;
+      using read_access_type = SLConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = unsupported_urat<UNLOCKED>;
+      using write_access_type = SLAccess<UNLOCKED>;
+      using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
+      using read_access_base_type = SLAccessConst<UNLOCKED>;
+    };
+
+  protected:
+    template<class UNLOCKED>
+    using access_types = std::conditional_t<
+        utils::is_specialization_of_v<UNLOCKED, UnlockedBase>,
+            access_types_unlocked_base<UNLOCKED>,
+            std::conditional_t<
+                utils::is_specialization_of_v<UNLOCKED, ConstUnlockedBase>,
+                access_types_const_unlocked_base<UNLOCKED>,
+                access_types_unlocked<UNLOCKED>
+            >>;
+};
+
+class SeqLockRef : public SeqLockAccess
+{
+  protected:
+    template<class UNLOCKED>
+    friend struct ::threadsafe::SLAccessConst;
+
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+    friend struct ::threadsafe::SLAccess;
+
+    template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
+
+    AISeqLock* m_seq_lock_ptr;
+
+    SeqLockRef(AISeqLock& seq_lock) : m_seq_lock_ptr(&seq_lock) { }
+
+    SeqLockRef(SeqLockRef const&) = default;
+
+    AISeqLock& mutex() const { return *m_seq_lock_ptr; }
+
+  public:
+    void rd2wryield() { m_seq_lock_ptr->rd2wryield(); }
+};
+
+class SeqLock : public SeqLockAccess
+{
+  public:
+    using reference_type = SeqLockRef;
+
+  protected:
+    template<class UNLOCKED>
+    friend struct ::threadsafe::SLAccessConst;
+
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+    friend struct ::threadsafe::SLAccess;
+
+    template<typename BASE, typename POLICY_MUTEX> friend class ::threadsafe::UnlockedBase;
+
+    mutable AISeqLock m_seq_lock;
+
+    AISeqLock& mutex() /*threadsafe-*/const { return m_seq_lock; }
+
+  public:
+    void rd2wryield() { m_seq_lock.rd2wryield(); }
+};
+
+template<typename UNLOCKED>
+struct rcu_requires_copy_constructible
+{
+  static_assert(std::is_copy_constructible_v<typename unlocked_data_type<UNLOCKED>::type>, "\n"
+      "* The RCU policy can only be used for copy constructible types,\n"
+      "* because every wat writes to a copy of the current version.\n");
+};
+
+template<typename UNLOCKED>
+struct rcu_unsupported_unlocked_base
+{
+  static_assert(helper<UNLOCKED>::value, "\n"
+      "* The RCU policy does not support UnlockedBase / ConstUnlockedBase,\n"
+      "* because a wat would have to copy (and publish) the whole object.\n");
+};
+
+class ReadCopyUpdateAccess
+{
+  private:
+    template<class UNLOCKED>
+    struct access_types_unlocked : rcu_requires_copy_constructible<UNLOCKED>
+    {
+      using const_read_access_type = RCUAccessConst<UNLOCKED>;
+      using read_access_type = RCUConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = unsupported_urat<UNLOCKED>;
+      using write_access_type = RCUAccess<UNLOCKED>;
+      using write_to_read_carry = RCUWrite2ReadCarry<UNLOCKED>;
+      using read_access_base_type = RCUAccessConst<UNLOCKED>;
+    };
+
+  protected:
+    template<class UNLOCKED>
+    using access_types = std::conditional_t<
+        utils::is_specialization_of_v<UNLOCKED, Unlocked>,
+            access_types_unlocked<UNLOCKED>,
+            rcu_unsupported_unlocked_base<UNLOCKED>>;
+};
+
+class RCU : public ReadCopyUpdateAccess
+{
+  protected:
+    template<class UNLOCKED>
+    friend struct ::threadsafe::RCUAccessConst;
+
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+    friend struct ::threadsafe::RCUAccess;
+
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+    friend class ::threadsafe::RCUWrite2ReadCarry;
+
+    mutable AIRCULock m_rcu_lock;
+
+    AIRCULock& mutex() /*threadsafe-*/const { return m_rcu_lock; }
+
+  public:
+    void rd2wryield() { m_rcu_lock.rd2wryield(); }
+};
+
+template<typename UNLOCKED>
+struct snapshot_requires_copy_constructible
+{
+  static_assert(std::is_copy_constructible_v<typename unlocked_data_type<UNLOCKED>::type>, "\n"
+      "* The Snapshot policy can only be used for copy constructible types,\n"
+      "* because every wat writes to a copy of the current version.\n");
+};
+
+template<typename UNLOCKED>
+struct snapshot_unsupported_unlocked_base
+{
+  static_assert(helper<UNLOCKED>::value, "\n"
+      "* The Snapshot policy does not support UnlockedBase / ConstUnlockedBase,\n"
+      "* because a wat would have to copy (and publish) the whole object.\n");
+};
+
+class CopyOnWriteAccess
+{
+  private:
+    template<class UNLOCKED>
+    struct access_types_unlocked : snapshot_requires_copy_constructible<UNLOCKED>
+    {
+      using const_read_access_type = SnapshotAccessConst<UNLOCKED>;
+      using read_access_type = SnapshotConstAccess<UNLOCKED>;
+      using upgradable_read_access_type = unsupported_urat<UNLOCKED>;
+      using write_access_type = SnapshotAccess<UNLOCKED>;
+      using write_to_read_carry = SnapshotWrite2ReadCarry<UNLOCKED>;
+      using read_access_base_type = SnapshotAccessConst<UNLOCKED>;
+    };
+
+  protected:
+    template<class UNLOCKED>
+    using access_types = std::conditional_t<
+        utils::is_specialization_of_v<UNLOCKED, Unlocked>,
+            access_types_unlocked<UNLOCKED>,
+            snapshot_unsupported_unlocked_base<UNLOCKED>>;
+};
+
+class Snapshot : public CopyOnWriteAccess
+{
+  protected:
+    template<class UNLOCKED>
+    friend struct ::threadsafe::SnapshotAccessConst;
+
+    template<class UNLOCKED>
+    requires utils::is_specialization_of_v<UNLOCKED, Unlocked>
+    friend struct ::threadsafe::SnapshotAccess;
+
+    mutable AISnapshotLock m_snapshot_lock;
+
+    AISnapshotLock& mutex() /*threadsafe-*/const { return m_snapshot_lock; }
+
+  public:
+    void rd2wryield() { m_snapshot_lock.rd2wryield(); }
+};
+
 class OneThreadAccess
 {
   private:
@@ -1557,6 +2904,7 @@ class OneThreadAccess
     struct access_types_unlocked_base
     {
       using read_access_type = OTAccess<UNLOCKED>;
+      using upgradable_read_access_type = OTAccess<UNLOCKED>;
       using write_access_type = OTAccess<UNLOCKED>;
       using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
       using read_access_base_type = OTAccessConst<UNLOCKED>;
@@ -1573,6 +2921,7 @@ class OneThreadAccess
     {
       using const_read_access_type = OTAccessConst<UNLOCKED>;
       using read_access_type = OTAccess<UNLOCKED>;
+      using upgradable_read_access_type = OTAccess<UNLOCKED>;
       using write_access_type = OTAccess<UNLOCKED>;
       using write_to_read_carry = unsupported_w2rCarry<UNLOCKED>;
       using read_access_base_type = OTAccessConst<UNLOCKED>;
@@ -1637,8 +2986,221 @@ class OneThread : public OneThreadAccess
 #endif // THREADSAFE_DEBUG
 };
 
+/**
+ * @brief A decorator for the ReadWrite and Primitive policies that collects lock contention statistics.
+ *
+ * For example,
+ *
+ * <code>
+ * using foo_t = threadsafe::Unlocked<Foo, threadsafe::policy::Instrumented<threadsafe::policy::ReadWrite<AIReadWriteSpinLock>>>;
+ * </code>
+ *
+ * Locking foo_t's through an UnlockedBase is not counted.
+ */
+template<class POLICY>
+class Instrumented : public POLICY
+{
+    static_assert(utils::is_specialization_of_v<POLICY, ReadWrite> || utils::is_specialization_of_v<POLICY, Primitive>,
+        "policy::Instrumented can only be used with the ReadWrite and Primitive policies.");
+
+  public:
+    static constexpr bool is_instrumented = true;
+
+    LockStats& lock_stats() /*threadsafe-*/const { return m_lock_stats; }
+
+    void rd2wryield() requires utils::is_specialization_of_v<POLICY, ReadWrite>
+    {
+      m_lock_stats.add_rd2wryield();
+      POLICY::rd2wryield();
+    }
+
+  protected:
+    mutable LockStats m_lock_stats;
+};
+
+/**
+ * @brief A decorator for any policy that puts the mutex on its own cache line.
+ *
+ * Normally the mutex of an Unlocked object shares a cache line with the first bytes of T,
+ * and with the end of the previous object when Unlocked objects are stored next to each
+ * other (for example in a std::vector); then every lock operation invalidates that cache
+ * line for the other cores that are accessing the data or the neighbouring objects.
+ *
+ * This aligns the policy (and therefore the Unlocked object) to CACHE_LINE_SIZE and makes
+ * T start on the first cache line after the mutex; the size of the Unlocked object then is
+ * a multiple of the cache line size too. For example,
+ *
+ * <code>
+ * using counter_t = threadsafe::Unlocked<Counter, threadsafe::policy::CacheLineIsolated<threadsafe::policy::Primitive<AIMutex>>>;
+ * std::vector<counter_t> counters(number_of_threads);      // No false sharing.
+ * </code>
+ *
+ * When combined with Instrumented, CacheLineIsolated must be the outer decorator.
+ * See also StripedUnlocked.
+ */
+template<class POLICY, size_t CACHE_LINE_SIZE = 64>
+class alignas(CACHE_LINE_SIZE) CacheLineIsolated : public POLICY
+{
+  public:
+    static constexpr size_t cache_line_size = CACHE_LINE_SIZE;
+
+  private:
+    // Padding alone isn't enough: the compiler is allowed to put T in the tail padding of a base class.
+    // T is placed after this (unused) member, which starts at the first cache line boundary after the mutex.
+    [[maybe_unused]] alignas(CACHE_LINE_SIZE) char m_cache_line_boundary;
+};
+
 } // namespace policy
 
+/**
+ * @brief Obtain an access type without blocking.
+ *
+ * These return an empty std::optional when the lock could not be obtained (in time).
+ * For example,
+ *
+ * <code>
+ * if (auto foo_w = threadsafe::try_wat(foo))
+ *   (*foo_w)->modify();
+ * else
+ *   defer(...);
+ * </code>
+ *
+ * These require the try_rdlock / try_wrlock (and try_rdlock_until / try_wrlock_until) functions of
+ * the RWMUTEX of a ReadWrite policy, or the try_lock (and try_lock_until) functions of the MUTEX of a Primitive policy.
+ */
+template<typename UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::wat> try_wat(UNLOCKED& unlocked)
+{
+  return UNLOCKED::wat::try_lock(unlocked);
+}
+
+template<typename UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::rat> try_rat(UNLOCKED& unlocked)
+{
+  return UNLOCKED::rat::try_lock(unlocked);
+}
+
+template<typename UNLOCKED, typename Clock, typename Duration>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::wat> try_wat_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+{
+  return UNLOCKED::wat::try_lock_until(unlocked, deadline);
+}
+
+template<typename UNLOCKED, typename Clock, typename Duration>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::rat> try_rat_until(UNLOCKED& unlocked, std::chrono::time_point<Clock, Duration> const& deadline)
+{
+  return UNLOCKED::rat::try_lock_until(unlocked, deadline);
+}
+
+template<typename UNLOCKED, typename Rep, typename Period>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::wat> try_wat_for(UNLOCKED& unlocked, std::chrono::duration<Rep, Period> const& timeout)
+{
+  return UNLOCKED::wat::try_lock_until(unlocked, std::chrono::steady_clock::now() + timeout);
+}
+
+template<typename UNLOCKED, typename Rep, typename Period>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+std::optional<typename UNLOCKED::rat> try_rat_for(UNLOCKED& unlocked, std::chrono::duration<Rep, Period> const& timeout)
+{
+  return UNLOCKED::rat::try_lock_until(unlocked, std::chrono::steady_clock::now() + timeout);
+}
+
+template<typename POLICY> struct supports_lock_all : std::false_type { };
+template<class RWMUTEX> struct supports_lock_all<policy::ReadWrite<RWMUTEX>> : std::true_type { };
+template<class RWMUTEX> struct supports_lock_all<policy::ReadWriteRef<RWMUTEX>> : std::true_type { };
+template<class MUTEX> struct supports_lock_all<policy::Primitive<MUTEX>> : std::true_type { };
+template<class MUTEX> struct supports_lock_all<policy::PrimitiveRef<MUTEX>> : std::true_type { };
+template<class POLICY> struct supports_lock_all<policy::Instrumented<POLICY>> : supports_lock_all<POLICY> { };
+template<class POLICY, size_t CACHE_LINE_SIZE> struct supports_lock_all<policy::CacheLineIsolated<POLICY, CACHE_LINE_SIZE>> : supports_lock_all<POLICY> { };
+
+/**
+ * @brief A request to lock UNLOCKED by creating an ACCESS object for it; see lock_all.
+ *
+ * Use wat_of or rat_of to create these.
+ */
+template<typename UNLOCKED, typename ACCESS>
+struct LockRequest
+{
+  static_assert(supports_lock_all<typename UNLOCKED::policy_type>::value,
+      "lock_all can only be used with the ReadWrite and Primitive policies.");
+
+  UNLOCKED& m_unlocked;
+
+  // The address of the mutex that is locked by ACCESS. Two UnlockedBase objects that refer to the same Unlocked return the same address.
+  void const* mutex_address() const { return &m_unlocked.UNLOCKED::policy_type::mutex(); }
+};
+
+// Request a wat for unlocked.
+template<typename UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+LockRequest<UNLOCKED, typename UNLOCKED::wat> wat_of(UNLOCKED& unlocked)
+{
+  return {unlocked};
+}
+
+// Request a rat for unlocked.
+template<typename UNLOCKED>
+requires utils::is_specialization_of_v<UNLOCKED, Unlocked> || utils::is_specialization_of_v<UNLOCKED, UnlockedBase>
+LockRequest<UNLOCKED, typename UNLOCKED::rat> rat_of(UNLOCKED& unlocked)
+{
+  return {unlocked};
+}
+
+namespace detail {
+
+template<size_t... I, typename... UNLOCKED, typename... ACCESS>
+std::tuple<ACCESS...> lock_all(std::index_sequence<I...>, LockRequest<UNLOCKED, ACCESS>... requests)
+{
+  constexpr size_t number_of_requests = sizeof...(I);
+  // Pairs of the address of a mutex and the index of the request that locks it.
+  std::array<std::pair<void const*, size_t>, number_of_requests> order{{ { requests.mutex_address(), I }... }};
+  std::sort(order.begin(), order.end(), [](auto const& p1, auto const& p2){ return std::less<void const*>{}(p1.first, p2.first); });
+  // Create the access objects in the order of the address of their mutex; if one of them throws, the ones that were already created are destructed again.
+  std::tuple<std::optional<ACCESS>...> accesses;
+  for (size_t n = 0; n < number_of_requests; ++n)
+  {
+    // Passing the same object twice (possibly through an UnlockedBase) would cause this thread to lock the same mutex twice.
+    assert(n == 0 || order[n].first != order[n - 1].first);
+    size_t const index = order[n].second;
+    ((index == I ? (void)std::get<I>(accesses).emplace(requests.m_unlocked) : (void)0), ...);
+  }
+  return std::tuple<ACCESS...>(std::move(*std::get<I>(accesses))...);
+}
+
+} // namespace detail
+
+/**
+ * @brief Obtain the access types of several objects at once.
+ *
+ * Nesting the access types of two objects, for example a wat of `a` and then a wat of `b`,
+ * can deadlock when another thread does the same in the opposite order. lock_all
+ * avoids that by always locking the mutexes in the same order (by address),
+ * independent of the order in which the objects are passed.
+ *
+ * For example,
+ *
+ * <code>
+ * auto [a_w, b_w, c_r] = threadsafe::lock_all(threadsafe::wat_of(a), threadsafe::wat_of(b), threadsafe::rat_of(c));
+ * </code>
+ *
+ * where a, b and c are (possibly different) Unlocked or UnlockedBase types with a ReadWrite or Primitive policy.
+ * The returned tuple contains the access objects in the order of the arguments.
+ *
+ * This only protects against deadlocks with other threads that either lock at most one
+ * of these objects at a time, or that use lock_all too. The same object may not be
+ * passed more than once.
+ */
+template<typename... UNLOCKED, typename... ACCESS>
+std::tuple<ACCESS...> lock_all(LockRequest<UNLOCKED, ACCESS>... requests)
+{
+  return detail::lock_all(std::index_sequence_for<ACCESS...>{}, requests...);
+}
+
 template<typename T, typename POLICY_MUTEX>
 requires std::derived_from<T, AIRefCount>
 void intrusive_ptr_add_ref(Unlocked<T, POLICY_MUTEX> const* ptr)